@@ -7,77 +7,147 @@
 #include "my_ascii.h"
 #include "my_font.h"
 #include "my_time.h"
+#include "my_wid.h"
+
+#include <chrono>
+#include <list>
+#include <map>
+#include <tuple>
 
 struct ascii_ ascii;
 
 int ASCII_WIDTH;
 int ASCII_HEIGHT;
 
-class AsciiCell {
+//
+// The cells are kept as planes, one array per field, each indexed by
+// y * ASCII_WIDTH + x, so a row is contiguous and the cells in use are the
+// start of every plane. Tiles are held by their global index, 0 for none,
+// and colours as packed RGBA, as every setter colours the four corners of
+// a cell alike.
+//
+#define ASCII_CELLS_MAX (ASCII_WIDTH_MAX * ASCII_HEIGHT_MAX)
+
+class AsciiRect {
 public:
-    Tilep fg_tile {};
-    Tilep fg2_tile {};
-    Tilep bg_tile {};
-    Tilep bg2_tile {};
+    float x;
+    float y;
+    float dx;
+    float dy;
+};
 
-    Texp tex {};
+class AsciiCells {
+public:
+    uint16_t fg_tile[ASCII_CELLS_MAX];
+    uint16_t fg2_tile[ASCII_CELLS_MAX];
+    uint16_t bg_tile[ASCII_CELLS_MAX];
+    uint16_t bg2_tile[ASCII_CELLS_MAX];
+
+    uint32_t fg_color[ASCII_CELLS_MAX];
+    uint32_t fg2_color[ASCII_CELLS_MAX];
+    uint32_t bg_color[ASCII_CELLS_MAX];
+    uint32_t bg2_color[ASCII_CELLS_MAX];
 
     //
     // For background tex
     //
-    float tx {};
-    float ty {};
-    float dx {};
-    float dy {};
+    Texp tex[ASCII_CELLS_MAX];
+    AsciiRect tex_rect[ASCII_CELLS_MAX];
 
     //
-    // For background tex
+    // The part of the bg2 and fg2 tiles to draw
     //
-    float bg2_tx {};
-    float bg2_ty {};
-    float bg2_dx {};
-    float bg2_dy {};
-    float fg2_tx {};
-    float fg2_ty {};
-    float fg2_dx {};
-    float fg2_dy {};
-
-    color fg_color_tl;
-    color fg_color_bl;
-    color fg_color_tr;
-    color fg_color_br;
-    color bg_color_tl;
-    color bg_color_bl;
-    color bg_color_tr;
-    color bg_color_br;
-    color bg2_color_tl;
-    color bg2_color_bl;
-    color bg2_color_tr;
-    color bg2_color_br;
-    color fg2_color_tl;
-    color fg2_color_bl;
-    color fg2_color_tr;
-    color fg2_color_br;
+    AsciiRect bg2_rect[ASCII_CELLS_MAX];
+    AsciiRect fg2_rect[ASCII_CELLS_MAX];
 
     //
     // Is reset each frame, and so although a pointer potentially should be
     // zeroed out on game load once it is used.
     //
-    void *context {};
+    void *context[ASCII_CELLS_MAX];
 
-    AsciiCell(void) {}
+    //
+    // How many cells may have been set since the last clear.
+    //
+    int used;
 };
 
-static std::vector<std::vector<AsciiCell> > cells;
+//
+// Both sets of cells are one allocation, made once; the frame being built
+// and the one FBO_WID was last drawn from swap each frame.
+//
+static AsciiCells ascii_planes[2];
+static AsciiCells *cells;
+
+//
+// The cells as FBO_WID was last drawn from them, so a frame only redraws
+// what has changed since.
+//
+static AsciiCells *cells_drawn;
+static bool drawn_valid;
+static int drawn_width;
+static int drawn_height;
+static double drawn_cell_w;
+static double drawn_cell_h;
+static GLuint drawn_fbo_tex;
+
+bool ascii_cached = true;
+uint32_t ascii_frames_full;
+uint32_t ascii_frames_partial;
+uint32_t ascii_frames_kept;
+
+//
+// Colour channels as the 0..1 floats the vertex data wants.
+//
+static float ascii_unit[256];
 
 void ascii_init (void)
 {
-    cells.resize(ASCII_WIDTH_MAX);
-    for (auto x = 0; x < ASCII_WIDTH_MAX; x++) {
-        cells[x].resize(ASCII_HEIGHT_MAX);
+    cells = &ascii_planes[0];
+    cells_drawn = &ascii_planes[1];
+
+    for (auto i = 0; i < 256; i++) {
+        ascii_unit[i] = ((double)i) / 255.0;
     }
 }
 
+static inline int ascii_cell (int x, int y)
+{
+    return (y * ASCII_WIDTH + x);
+}
+
+static inline uint32_t ascii_rgba (color c)
+{
+    return (((uint32_t) c.a << 24) | ((uint32_t) c.b << 16) |
+            ((uint32_t) c.g << 8) | (uint32_t) c.r);
+}
+
+static inline uint16_t ascii_tile (const Tilep tile)
+{
+    return (tile ? tile->global_index : 0);
+}
+
+static void ascii_cells_clear (AsciiCells *c)
+{
+    size_t n = c->used;
+
+    memset(c->fg_tile, 0, n * sizeof(c->fg_tile[0]));
+    memset(c->fg2_tile, 0, n * sizeof(c->fg2_tile[0]));
+    memset(c->bg_tile, 0, n * sizeof(c->bg_tile[0]));
+    memset(c->bg2_tile, 0, n * sizeof(c->bg2_tile[0]));
+    memset(c->fg_color, 0, n * sizeof(c->fg_color[0]));
+    memset(c->fg2_color, 0, n * sizeof(c->fg2_color[0]));
+    memset(c->bg_color, 0, n * sizeof(c->bg_color[0]));
+    memset(c->bg2_color, 0, n * sizeof(c->bg2_color[0]));
+    memset(c->tex, 0, n * sizeof(c->tex[0]));
+    memset(c->tex_rect, 0, n * sizeof(c->tex_rect[0]));
+    memset(c->bg2_rect, 0, n * sizeof(c->bg2_rect[0]));
+    memset(c->fg2_rect, 0, n * sizeof(c->fg2_rect[0]));
+    memset(c->context, 0, n * sizeof(c->context[0]));
+
+    c->used = 0;
+}
+
 //
 // For drawing the mouse cursor.
 //
@@ -132,12 +202,7 @@ void ascii_set_fg (int x, int y, color c)
         return;
     }
 
-    AsciiCell *cell = &getref(cells, x, y);
-
-    cell->fg_color_tl = c;
-    cell->fg_color_tr = c;
-    cell->fg_color_bl = c;
-    cell->fg_color_br = c;
+    cells->fg_color[ascii_cell(x, y)] = ascii_rgba(c);
 }
 
 void ascii_set_bg (int x, int y, color c)
@@ -146,12 +211,7 @@ void ascii_set_bg (int x, int y, color c)
         return;
     }
 
-    AsciiCell *cell = &getref(cells, x, y);
-
-    cell->bg_color_tl = c;
-    cell->bg_color_tr = c;
-    cell->bg_color_bl = c;
-    cell->bg_color_br = c;
+    cells->bg_color[ascii_cell(x, y)] = ascii_rgba(c);
 }
 
 void ascii_set_bg2 (int x, int y, color c)
@@ -160,12 +220,7 @@ void ascii_set_bg2 (int x, int y, color c)
         return;
     }
 
-    AsciiCell *cell = &getref(cells, x, y);
-
-    cell->bg2_color_tl = c;
-    cell->bg2_color_tr = c;
-    cell->bg2_color_bl = c;
-    cell->bg2_color_br = c;
+    cells->bg2_color[ascii_cell(x, y)] = ascii_rgba(c);
 }
 
 void ascii_set_fg2 (int x, int y, color c)
@@ -174,12 +229,7 @@ void ascii_set_fg2 (int x, int y, color c)
         return;
     }
 
-    AsciiCell *cell = &getref(cells, x, y);
-
-    cell->fg2_color_tl = c;
-    cell->fg2_color_tr = c;
-    cell->fg2_color_bl = c;
-    cell->fg2_color_br = c;
+    cells->fg2_color[ascii_cell(x, y)] = ascii_rgba(c);
 }
 
 void ascii_set_context (int x, int y, void *context)
@@ -192,9 +242,7 @@ void ascii_set_context (int x, int y, void *context)
         return;
     }
 
-    AsciiCell *cell = &getref(cells, x, y);
-
-    cell->context = context;
+    cells->context[ascii_cell(x, y)] = context;
 }
 
 void *ascii_get_context (int x, int y)
@@ -203,9 +251,7 @@ void *ascii_get_context (int x, int y)
         return (0);
     }
 
-    AsciiCell *cell = &getref(cells, x, y);
-
-    return (cell->context);
+    return (cells->context[ascii_cell(x, y)]);
 }
 
 void ascii_set_bg (int x, int y, const Texp tex,
@@ -215,13 +261,10 @@ void ascii_set_bg (int x, int y, const Texp tex,
         return;
     }
 
-    AsciiCell *cell = &getref(cells, x, y);
+    int i = ascii_cell(x, y);
 
-    cell->tex = tex;
-    cell->tx = tx;
-    cell->ty = ty;
-    cell->dx = dx;
-    cell->dy = dy;
+    cells->tex[i] = tex;
+    cells->tex_rect[i] = AsciiRect { tx, ty, dx, dy };
 }
 
 void ascii_set_bg (int x, int y, const Tilep tile)
@@ -230,13 +273,10 @@ void ascii_set_bg (int x, int y, const Tilep tile)
         return;
     }
 
-    AsciiCell *cell = &getref(cells, x, y);
+    int i = ascii_cell(x, y);
 
-    cell->bg_tile = tile;
-    cell->tx = 0;
-    cell->ty = 0;
-    cell->dx = 1;
-    cell->dy = 1;
+    cells->bg_tile[i] = ascii_tile(tile);
+    cells->tex_rect[i] = AsciiRect { 0, 0, 1, 1 };
 }
 
 void ascii_set_bg2 (int x, int y, const Tilep tile)
@@ -245,13 +285,10 @@ void ascii_set_bg2 (int x, int y, const Tilep tile)
         return;
     }
 
-    AsciiCell *cell = &getref(cells, x, y);
+    int i = ascii_cell(x, y);
 
-    cell->bg2_tile = tile;
-    cell->bg2_tx = 0;
-    cell->bg2_ty = 0;
-    cell->bg2_dx = 1;
-    cell->bg2_dy = 1;
+    cells->bg2_tile[i] = ascii_tile(tile);
+    cells->bg2_rect[i] = AsciiRect { 0, 0, 1, 1 };
 }
 
 void ascii_set_bg2 (int x, int y, const Tilep tile,
@@ -261,13 +298,10 @@ void ascii_set_bg2 (int x, int y, const Tilep tile,
         return;
     }
 
-    AsciiCell *cell = &getref(cells, x, y);
+    int i = ascii_cell(x, y);
 
-    cell->bg2_tile = tile;
-    cell->bg2_tx = tx;
-    cell->bg2_ty = ty;
-    cell->bg2_dx = dx;
-    cell->bg2_dy = dy;
+    cells->bg2_tile[i] = ascii_tile(tile);
+    cells->bg2_rect[i] = AsciiRect { tx, ty, dx, dy };
 }
 
 void ascii_set_bg (int x, int y, const char *tilename)
@@ -297,13 +331,10 @@ void ascii_set_fg (int x, int y, const Texp tex,
         return;
     }
 
-    AsciiCell *cell = &getref(cells, x, y);
+    int i = ascii_cell(x, y);
 
-    cell->tex = tex;
-    cell->tx = tx;
-    cell->ty = ty;
-    cell->dx = dx;
-    cell->dy = dy;
+    cells->tex[i] = tex;
+    cells->tex_rect[i] = AsciiRect { tx, ty, dx, dy };
 }
 
 void ascii_set_fg (int x, int y, const Tilep tile)
@@ -312,13 +343,10 @@ void ascii_set_fg (int x, int y, const Tilep tile)
         return;
     }
 
-    AsciiCell *cell = &getref(cells, x, y);
+    int i = ascii_cell(x, y);
 
-    cell->fg_tile = tile;
-    cell->tx = 0;
-    cell->ty = 0;
-    cell->dx = 1;
-    cell->dy = 1;
+    cells->fg_tile[i] = ascii_tile(tile);
+    cells->tex_rect[i] = AsciiRect { 0, 0, 1, 1 };
 }
 
 void ascii_set_fg2 (int x, int y, const Tilep tile)
@@ -327,13 +355,10 @@ void ascii_set_fg2 (int x, int y, const Tilep tile)
         return;
     }
 
-    AsciiCell *cell = &getref(cells, x, y);
+    int i = ascii_cell(x, y);
 
-    cell->fg2_tile = tile;
-    cell->fg2_tx = 0;
-    cell->fg2_ty = 0;
-    cell->fg2_dx = 1;
-    cell->fg2_dy = 1;
+    cells->fg2_tile[i] = ascii_tile(tile);
+    cells->fg2_rect[i] = AsciiRect { 0, 0, 1, 1 };
 }
 
 void ascii_set_fg2 (int x, int y, const Tilep tile,
@@ -343,13 +368,10 @@ void ascii_set_fg2 (int x, int y, const Tilep tile,
         return;
     }
 
-    AsciiCell *cell = &getref(cells, x, y);
+    int i = ascii_cell(x, y);
 
-    cell->fg2_tile = tile;
-    cell->fg2_tx = tx;
-    cell->fg2_ty = ty;
-    cell->fg2_dx = dx;
-    cell->fg2_dy = dy;
+    cells->fg2_tile[i] = ascii_tile(tile);
+    cells->fg2_rect[i] = AsciiRect { tx, ty, dx, dy };
 }
 
 void ascii_set_fg (int x, int y, const char *tilename)
@@ -372,27 +394,65 @@ void ascii_set_fg2 (int x, int y, const wchar_t c)
     ascii_set_fg2(x, y, fixed_font->unicode_to_tile(c));
 }
 
-void ascii_putf__ (int x, int y, color fg, color bg, std::wstring const& text)
-{_
-    Tilep tile;
-    int bg_set = false;
-    auto text_iter = text.begin();
+//
+// Text as ascii_putf__ last parsed it; the markup read, and each character
+// turned into its tile and colours, ready to be written to the cells.
+//
+class AsciiGlyph {
+public:
+    uint16_t fg_tile {};
+    uint16_t bg_tile {};
+    uint32_t fg_color {};
+    uint32_t bg_color {};
+    bool bg_set {};
+    //
+    // The tile was given by %tile= rather than by the character.
+    //
+    bool from_markup {};
+    bool is_cursor {};
+};
 
-// printf("ascii_putf__ [%S]/%ld scissors x %d y %d scissors %d %d %d %d %d\n", text.c_str(), text.size(), x, y, scissors_tl.x, scissors_tl.y, scissors_br.x, scissors_br.y, scissors_enabled);
-    if (unlikely(y < 0)) {
-        return;
+class AsciiRunKey {
+public:
+    std::wstring text;
+    uint32_t fg {};
+    uint32_t bg {};
+    Fontp font {};
+
+    bool operator< (const AsciiRunKey &o) const
+    {
+        return (std::tie(fg, bg, font, text) <
+                std::tie(o.fg, o.bg, o.font, o.text));
     }
+};
 
-    if (unlikely(y >= ASCII_HEIGHT)) {
-        return;
-    }
+class AsciiRun {
+public:
+    AsciiRunKey key;
+    std::vector<AsciiGlyph> glyphs;
+};
+
+//
+// Most recently used first.
+//
+static const size_t ASCII_RUNS_MAX = 512;
+static std::list<AsciiRun> ascii_runs;
+static std::map<AsciiRunKey, std::list<AsciiRun>::iterator> ascii_runs_found;
+
+uint32_t ascii_runs_hit;
+uint32_t ascii_runs_miss;
+
+static void ascii_run_parse (AsciiRun &run, color fg, color bg)
+{_
+    std::wstring const& text = run.key.text;
+    Tilep tile = nullptr;
+    int bg_set = false;
+    auto text_iter = text.begin();
 
     if (bg != COLOR_NONE) {
         bg_set = true;
     }
 
-    tile = nullptr;
-
     while (text_iter != text.end()) {
         auto c = *text_iter;
         text_iter++;
@@ -429,71 +489,138 @@ void ascii_putf__ (int x, int y, color fg, color bg, std::wstring const& text)
             continue;
         }
 
-        if (unlikely(!ascii_ok_for_scissors(x, y))) {
-            x++;
-            continue;
-        }
+        AsciiGlyph g;
 
+        g.from_markup = (tile != nullptr);
         if (!tile) {
-            tile = fixed_font->unicode_to_tile(c);
+            tile = run.key.font->unicode_to_tile(c);
             if (tile == nullptr) {
                 tile = tile_find_mand(ASCII_UNKNOWN_TILE);
             }
         }
 
-        auto saved_fg = fg;
+        g.fg_tile = ascii_tile(tile);
+        g.fg_color = ascii_rgba(fg);
+        g.is_cursor = (c == ASCII_CURSOR_UCHAR);
 
-        auto is_cursor = (c == ASCII_CURSOR_UCHAR);
-        if (unlikely(is_cursor)) {
-            static uint32_t last;
-            static uint8_t first = true;
+        if (bg_set) {
+            g.bg_set = true;
 
-            if (first) {
-                first = false;
-                last = time_get_time_ms_cached();
+            if (bg.r || bg.g || bg.b || bg.a) {
+                static Tilep tile;
+                if (!tile) {
+                    tile = tile_find_mand(ASCII_CURSOR_TILE);
+                }
+                g.bg_tile = ascii_tile(tile);
             }
 
-            if (time_have_x_tenths_passed_since(10, last)) {
-                fg = CONSOLE_CURSOR_COLOR;
-                last = time_get_time_ms_cached();
-            } else if (time_have_x_tenths_passed_since(5, last)) {
-                fg = CONSOLE_CURSOR_COLOR;
-            } else {
-                fg = CONSOLE_CURSOR_OTHER_COLOR;
-            }
+            g.bg_color = ascii_rgba(bg);
         }
 
-        AsciiCell *cell = &getref(cells, x++, y);
+        run.glyphs.push_back(g);
+
+        tile = nullptr;
+    }
+}
+
+static const AsciiRun &ascii_run_find (std::wstring const& text,
+                                       color fg, color bg)
+{_
+    AsciiRunKey key;
+    key.text = text;
+    key.fg = ascii_rgba(fg);
+    key.bg = ascii_rgba(bg);
+    key.font = fixed_font;
+
+    auto found = ascii_runs_found.find(key);
+    if (found != ascii_runs_found.end()) {
+        ascii_runs_hit++;
+        ascii_runs.splice(ascii_runs.begin(), ascii_runs, found->second);
+        return (*found->second);
+    }
 
-        cell->fg_tile = tile;
+    ascii_runs_miss++;
 
-        cell->fg_color_tl = fg;
-        cell->fg_color_tr = fg;
-        cell->fg_color_bl = fg;
-        cell->fg_color_br = fg;
+    if (ascii_runs.size() >= ASCII_RUNS_MAX) {
+        ascii_runs_found.erase(ascii_runs.back().key);
+        ascii_runs.pop_back();
+    }
 
-        if (bg_set) {
-            if (bg.r || bg.g || bg.b || bg.a) {
-                static Tilep tile;
-                if (!tile) {
-                    tile = tile_find_mand(ASCII_CURSOR_TILE);
-                }
-                cell->bg_tile = tile;
-            } else {
-                cell->bg_tile = 0;
+    ascii_runs.emplace_front();
+    auto run = ascii_runs.begin();
+    run->key = key;
+    ascii_run_parse(*run, fg, bg);
+    ascii_runs_found[key] = run;
+
+    return (*run);
+}
+
+static color ascii_cursor_color (void)
+{
+    static uint32_t last;
+    static uint8_t first = true;
+
+    if (first) {
+        first = false;
+        last = time_get_time_ms_cached();
+    }
+
+    if (time_have_x_tenths_passed_since(10, last)) {
+        last = time_get_time_ms_cached();
+        return (CONSOLE_CURSOR_COLOR);
+    } else if (time_have_x_tenths_passed_since(5, last)) {
+        return (CONSOLE_CURSOR_COLOR);
+    } else {
+        return (CONSOLE_CURSOR_OTHER_COLOR);
+    }
+}
+
+void ascii_putf__ (int x, int y, color fg, color bg, std::wstring const& text)
+{_
+    if (unlikely(y < 0)) {
+        return;
+    }
+
+    if (unlikely(y >= ASCII_HEIGHT)) {
+        return;
+    }
+
+    const AsciiRun &run = ascii_run_find(text, fg, bg);
+
+    //
+    // A %tile= before a character that is clipped is kept for the next one
+    // drawn.
+    //
+    uint16_t carried = 0;
+
+    for (const auto &g : run.glyphs) {
+        if (unlikely(!ascii_ok_for_scissors(x, y))) {
+            if (g.from_markup) {
+                carried = g.fg_tile;
             }
+            x++;
+            continue;
+        }
+
+        int i = ascii_cell(x++, y);
 
-            cell->bg_color_tl = bg;
-            cell->bg_color_tr = bg;
-            cell->bg_color_bl = bg;
-            cell->bg_color_br = bg;
+        if (unlikely(carried) && !g.from_markup) {
+            cells->fg_tile[i] = carried;
+        } else {
+            cells->fg_tile[i] = g.fg_tile;
         }
+        carried = 0;
 
-        if (unlikely(is_cursor)) {
-            fg = saved_fg;
+        if (unlikely(g.is_cursor)) {
+            cells->fg_color[i] = ascii_rgba(ascii_cursor_color());
+        } else {
+            cells->fg_color[i] = g.fg_color;
         }
 
-        tile = nullptr;
+        if (g.bg_set) {
+            cells->bg_tile[i] = g.bg_tile;
+            cells->bg_color[i] = g.bg_color;
+        }
     }
 }
 
@@ -909,83 +1036,32 @@ void ascii_draw_line (int x0, int y0, int x1, int y1,
 }
 
 //
-// Display one z layer of the ascii.
+// Find the cell the mouse is over.
 //
-static void ascii_blit (void)
-{_
-    //
-    // Get the mouse position to use. We use this to find the mouse tile that
-    // we are over.
-    //
-    int x;
-    int y;
-    float tile_x;
-    float tile_y;
-
-    glcolor(WHITE);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
+static void ascii_find_mouse (void)
+{
     float mx = mouse_x;
     float my = mouse_y;
 
-    tile_y = 0;
-    for (y = 0; y < ASCII_HEIGHT; y++) {
-
-        tile_x = 0;
-        for (x = 0; x < ASCII_WIDTH; x++) {
-
-            const AsciiCell *cell = &getref(cells, x, y);
-
-            fpoint tile_tl;
-            fpoint tile_br;
-
-            tile_tl.x = tile_x;
-            tile_tl.y = tile_y;
-            tile_br.x = tile_x + game->config.ascii_gl_width;
-            tile_br.y = tile_y + game->config.ascii_gl_height;
-
-            if (!mouse_found) {
-                if ((mx < tile_br.x) &&
-                    (my < tile_br.y) &&
-                    (mx >= tile_tl.x) &&
-                    (my >= tile_tl.y)) {
-                    mouse_found = true;
+    float tile_y = 0;
+    for (auto y = 0; y < ASCII_HEIGHT; y++) {
+        float tile_x = 0;
+        for (auto x = 0; x < ASCII_WIDTH; x++) {
+            fpoint tile_tl(tile_x, tile_y);
+            fpoint tile_br(tile_x + game->config.ascii_gl_width,
+                           tile_y + game->config.ascii_gl_height);
 
-                    mouse_tile_tl = tile_tl;
-                    mouse_tile_br = tile_br;
+            if ((mx < tile_br.x) &&
+                (my < tile_br.y) &&
+                (mx >= tile_tl.x) &&
+                (my >= tile_tl.y)) {
+                mouse_found = true;
 
-                    ascii.mouse_at = point(x, y);
-                }
-            }
+                mouse_tile_tl = tile_tl;
+                mouse_tile_br = tile_br;
 
-            //
-            // Background
-            //
-            if (cell->tex) {
-                Texp tex = cell->tex;
-
-                blit(tex_get_gl_binding(tex),
-                     cell->tx,
-                     cell->ty,
-                     cell->tx + cell->dx,
-                     cell->ty + cell->dy,
-                     tile_tl.x,
-                     tile_tl.y,
-                     tile_br.x,
-                     tile_br.y);
-            } else if (cell->bg_tile) {
-                color bg_color_tl = cell->bg_color_tl;
-                color bg_color_tr = cell->bg_color_tr;
-                color bg_color_bl = cell->bg_color_bl;
-                color bg_color_br = cell->bg_color_br;
-
-                tile_blit_colored(cell->bg_tile,
-                                  tile_tl,
-                                  tile_br,
-                                  bg_color_tl,
-                                  bg_color_tr,
-                                  bg_color_bl,
-                                  bg_color_br);
+                ascii.mouse_at = point(x, y);
+                return;
             }
 
             tile_x += game->config.ascii_gl_width;
@@ -993,169 +1069,350 @@ static void ascii_blit (void)
 
         tile_y += game->config.ascii_gl_height;
     }
+}
+
+//
+// Unpack a cell colour to the floats the vertex data wants.
+//
+static inline void ascii_unpack (uint32_t c, float *rgba)
+{
+    rgba[0] = ascii_unit[c & 0xff];
+    rgba[1] = ascii_unit[(c >> 8) & 0xff];
+    rgba[2] = ascii_unit[(c >> 16) & 0xff];
+    rgba[3] = ascii_unit[c >> 24];
+}
+
+static inline void ascii_blit_tile (uint16_t index,
+                                    float left, float top,
+                                    float right, float bottom,
+                                    const float *rgba)
+{
+    Tilep tile = tile_index_to_tile(index);
+
+    blit_colored(tile->gl_binding(),
+                 tile->x1, tile->y2, tile->x2, tile->y1,
+                 left, bottom, right, top,
+                 rgba);
+}
+
+static inline void ascii_blit_tile_section (uint16_t index,
+                                            const AsciiRect &r,
+                                            float left, float top,
+                                            float right, float bottom,
+                                            const float *rgba)
+{
+    Tilep tile = tile_index_to_tile(index);
+
+    double tw = tile->x2 - tile->x1;
+    double th = tile->y2 - tile->y1;
+
+    double x1 = tile->x1 + r.x * tw;
+    double x2 = tile->x1 + (r.x + r.dx) * tw;
+    double y1 = tile->y1 + r.y * th;
+    double y2 = tile->y1 + (r.y + r.dy) * th;
+
+    blit_colored(tile->gl_binding(),
+                 x1, y2, x2, y1,
+                 left, bottom, right, top,
+                 rgba);
+}
+
+//
+// Display the ascii cells from tl to br inclusive. Each pass walks the
+// planes in order, a row at a time.
+//
+static void ascii_blit (int tlx, int tly, int brx, int bry)
+{_
+    const AsciiCells *c = cells;
+    float cw = game->config.ascii_gl_width;
+    float ch = game->config.ascii_gl_height;
+    float left = tlx * cw;
+    float rgba[4];
+    float tile_x;
+    float tile_y;
+
+    glcolor(WHITE);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
     //
-    // Tiles outline
+    // Background
     //
-#if 0
-    tile_y = 0;
-    for (y = 0; y < ASCII_HEIGHT; y++) {
-
-        tile_x = 0;
-        for (x = 0; x < ASCII_WIDTH; x++) {
-
-            const AsciiCell *cell = &getref(cells, x, y);
-
-            fpoint tile_tl;
-            fpoint tile_br;
-
-            tile_tl.x = tile_x;
-            tile_tl.y = tile_y;
-            tile_br.x = tile_x + game->config.ascii_gl_width;
-            tile_br.y = tile_y + game->config.ascii_gl_height;
-
-            if (cell->bg2_tile) {
-                color bg2_color_tl = cell->bg2_color_tl;
-                color bg2_color_tr = cell->bg2_color_tr;
-                color bg2_color_bl = cell->bg2_color_bl;
-                color bg2_color_br = cell->bg2_color_br;
-
-                tile_blit_outline_section_colored(
-                   cell->bg2_tile,
-                   fpoint(cell->bg2_tx, cell->bg2_ty),
-                   fpoint(cell->bg2_tx + cell->bg2_dx,
-                          cell->bg2_ty + cell->bg2_dy),
-                   tile_tl, tile_br,
-                   bg2_color_tl,
-                   bg2_color_tr,
-                   bg2_color_bl,
-                   bg2_color_br,
-                   0.05 / cell->bg2_dx);
+    tile_y = tly * ch;
+    for (auto y = tly; y <= bry; y++) {
+        int i = ascii_cell(tlx, y);
+
+        tile_x = left;
+        for (auto x = tlx; x <= brx; x++, i++) {
+            if (c->tex[i]) {
+                const AsciiRect &r = c->tex_rect[i];
+
+                blit(tex_get_gl_binding(c->tex[i]),
+                     r.x, r.y, r.x + r.dx, r.y + r.dy,
+                     tile_x, tile_y, tile_x + cw, tile_y + ch);
+            } else if (c->bg_tile[i]) {
+                ascii_unpack(c->bg_color[i], rgba);
+                ascii_blit_tile(c->bg_tile[i],
+                                tile_x, tile_y, tile_x + cw, tile_y + ch,
+                                rgba);
             }
 
-            tile_x += game->config.ascii_gl_width;
+            tile_x += cw;
         }
 
-        tile_y += game->config.ascii_gl_height;
+        tile_y += ch;
     }
-#endif
 
     //
     // Tiles
     //
-    tile_y = 0;
-    for (y = 0; y < ASCII_HEIGHT; y++) {
-
-        tile_x = 0;
-        for (x = 0; x < ASCII_WIDTH; x++) {
-
-            const AsciiCell *cell = &getref(cells, x, y);
-
-            fpoint tile_tl;
-            fpoint tile_br;
-
-            tile_tl.x = tile_x;
-            tile_tl.y = tile_y;
-            tile_br.x = tile_x + game->config.ascii_gl_width;
-            tile_br.y = tile_y + game->config.ascii_gl_height;
-
-            if (cell->bg2_tile) {
-                color bg2_color_tl = cell->bg2_color_tl;
-                color bg2_color_tr = cell->bg2_color_tr;
-                color bg2_color_bl = cell->bg2_color_bl;
-                color bg2_color_br = cell->bg2_color_br;
-
-                tile_blit_section_colored(
-                   cell->bg2_tile,
-                   fpoint(cell->bg2_tx, cell->bg2_ty),
-                   fpoint(cell->bg2_tx + cell->bg2_dx,
-                          cell->bg2_ty + cell->bg2_dy),
-                   tile_tl, tile_br,
-                   bg2_color_tl,
-                   bg2_color_tr,
-                   bg2_color_bl,
-                   bg2_color_br);
+    tile_y = tly * ch;
+    for (auto y = tly; y <= bry; y++) {
+        int i = ascii_cell(tlx, y);
+
+        tile_x = left;
+        for (auto x = tlx; x <= brx; x++, i++) {
+            if (c->bg2_tile[i]) {
+                ascii_unpack(c->bg2_color[i], rgba);
+                ascii_blit_tile_section(c->bg2_tile[i], c->bg2_rect[i],
+                                        tile_x, tile_y,
+                                        tile_x + cw, tile_y + ch,
+                                        rgba);
             }
 
-            if (cell->fg2_tile) {
-                color fg2_color_tl = cell->fg2_color_tl;
-                color fg2_color_tr = cell->fg2_color_tr;
-                color fg2_color_bl = cell->fg2_color_bl;
-                color fg2_color_br = cell->fg2_color_br;
-
-                tile_blit_section_colored(
-                   cell->fg2_tile,
-                   fpoint(cell->fg2_tx, cell->fg2_ty),
-                   fpoint(cell->fg2_tx + cell->fg2_dx,
-                          cell->fg2_ty + cell->fg2_dy),
-                   tile_tl, tile_br,
-                   fg2_color_tl,
-                   fg2_color_tr,
-                   fg2_color_bl,
-                   fg2_color_br);
+            if (c->fg2_tile[i]) {
+                ascii_unpack(c->fg2_color[i], rgba);
+                ascii_blit_tile_section(c->fg2_tile[i], c->fg2_rect[i],
+                                        tile_x, tile_y,
+                                        tile_x + cw, tile_y + ch,
+                                        rgba);
             }
 
-            tile_x += game->config.ascii_gl_width;
+            tile_x += cw;
         }
 
-        tile_y += game->config.ascii_gl_height;
+        tile_y += ch;
+    }
+
+    //
+    // Foreground
+    //
+    tile_y = tly * ch;
+    for (auto y = tly; y <= bry; y++) {
+        int i = ascii_cell(tlx, y);
+
+        tile_x = left;
+        for (auto x = tlx; x <= brx; x++, i++) {
+            if (c->fg_tile[i]) {
+                ascii_unpack(c->fg_color[i], rgba);
+                ascii_blit_tile(c->fg_tile[i],
+                                tile_x, tile_y, tile_x + cw, tile_y + ch,
+                                rgba);
+            }
+
+            tile_x += cw;
+        }
+
+        tile_y += ch;
     }
+}
+
+//
+// Do n cells from i look the same as they did when last drawn? The context
+// is not drawn, so is not compared.
+//
+static bool ascii_cells_same (int i, int n)
+{
+    const AsciiCells *a = cells;
+    const AsciiCells *b = cells_drawn;
+
+    return (!memcmp(&a->fg_tile[i], &b->fg_tile[i],
+                    n * sizeof(a->fg_tile[0])) &&
+            !memcmp(&a->fg2_tile[i], &b->fg2_tile[i],
+                    n * sizeof(a->fg2_tile[0])) &&
+            !memcmp(&a->bg_tile[i], &b->bg_tile[i],
+                    n * sizeof(a->bg_tile[0])) &&
+            !memcmp(&a->bg2_tile[i], &b->bg2_tile[i],
+                    n * sizeof(a->bg2_tile[0])) &&
+            !memcmp(&a->fg_color[i], &b->fg_color[i],
+                    n * sizeof(a->fg_color[0])) &&
+            !memcmp(&a->fg2_color[i], &b->fg2_color[i],
+                    n * sizeof(a->fg2_color[0])) &&
+            !memcmp(&a->bg_color[i], &b->bg_color[i],
+                    n * sizeof(a->bg_color[0])) &&
+            !memcmp(&a->bg2_color[i], &b->bg2_color[i],
+                    n * sizeof(a->bg2_color[0])) &&
+            !memcmp(&a->tex[i], &b->tex[i],
+                    n * sizeof(a->tex[0])) &&
+            !memcmp(&a->tex_rect[i], &b->tex_rect[i],
+                    n * sizeof(a->tex_rect[0])) &&
+            !memcmp(&a->bg2_rect[i], &b->bg2_rect[i],
+                    n * sizeof(a->bg2_rect[0])) &&
+            !memcmp(&a->fg2_rect[i], &b->fg2_rect[i],
+                    n * sizeof(a->fg2_rect[0])));
+}
+
+//
+// Cells differing from what FBO_WID holds, as runs of rows that each have
+// a change, and the columns spanning the changes in those rows.
+//
+class AsciiDirty {
+public:
+    int tlx;
+    int tly;
+    int brx;
+    int bry;
+};
+
+static std::vector<AsciiDirty> ascii_dirty;
+
+//
+// Returns the number of cells that changed.
+//
+static int ascii_find_dirty (void)
+{
+    int changed = 0;
+    AsciiDirty d {};
+    bool in_run = false;
+
+    ascii_dirty.clear();
 
-    tile_y = 0;
-    for (y = 0; y < ASCII_HEIGHT; y++) {
-
-        tile_x = 0;
-        for (x = 0; x < ASCII_WIDTH; x++) {
-            const AsciiCell *cell = &getref(cells, x, y);
-
-            fpoint tile_tl;
-            fpoint tile_br;
-
-            tile_tl.x = tile_x;
-            tile_tl.y = tile_y;
-            tile_br.x = tile_x + game->config.ascii_gl_width;
-            tile_br.y = tile_y + game->config.ascii_gl_height;
-
-            //
-            // Foreground
-            //
-            {
-                tile_br.x = tile_x + game->config.ascii_gl_width;
-                Tilep tile = cell->fg_tile;
-
-                if (tile) {
-                    color fg_color_tl = cell->fg_color_tl;
-                    color fg_color_tr = cell->fg_color_tr;
-                    color fg_color_bl = cell->fg_color_bl;
-                    color fg_color_br = cell->fg_color_br;
-
-                    tile_blit_colored(tile,
-                                      tile_tl,
-                                      tile_br,
-                                      fg_color_tl,
-                                      fg_color_tr,
-                                      fg_color_bl,
-                                      fg_color_br);
+    for (auto y = 0; y < ASCII_HEIGHT; y++) {
+        int minx = ASCII_WIDTH;
+        int maxx = -1;
+        int row = ascii_cell(0, y);
+
+        //
+        // Most rows are unchanged, and that is the whole row at once.
+        //
+        if (!ascii_cells_same(row, ASCII_WIDTH)) {
+            for (auto x = 0; x < ASCII_WIDTH; x++) {
+                if (!ascii_cells_same(row + x, 1)) {
+                    minx = std::min(minx, x);
+                    maxx = x;
+                    changed++;
                 }
             }
+        }
 
-            tile_x += game->config.ascii_gl_width;
+        if (maxx < 0) {
+            if (in_run) {
+                ascii_dirty.push_back(d);
+                in_run = false;
+            }
+            continue;
         }
 
-        tile_y += game->config.ascii_gl_height;
+        if (!in_run) {
+            d.tlx = minx;
+            d.tly = y;
+            d.brx = maxx;
+            in_run = true;
+        } else {
+            d.tlx = std::min(d.tlx, minx);
+            d.brx = std::max(d.brx, maxx);
+        }
+        d.bry = y;
     }
+
+    if (in_run) {
+        ascii_dirty.push_back(d);
+    }
+
+    return (changed);
 }
 
 //
-// The big ascii renderer
+// Redraw just the changed cells. Each run is cleared under a scissor and
+// the cells around it drawn again; cells do not overlap, so what is left
+// is what a full redraw would have drawn there.
 //
-void ascii_display (void)
+static void ascii_display_dirty (void)
 {_
-    mouse_found = false;
+    float cw = game->config.ascii_gl_width;
+    float ch = game->config.ascii_gl_height;
+
+    glEnable(GL_SCISSOR_TEST);
+
+    for (const auto &d : ascii_dirty) {
+        gl_scissor_2d(d.tlx * cw, d.tly * ch,
+                      (d.brx + 1) * cw, (d.bry + 1) * ch);
+        glClear(GL_COLOR_BUFFER_BIT);
+
+        //
+        // One more cell all round, for the pixels a scaled projection
+        // rounds into the scissor.
+        //
+        blit_init();
+        ascii_blit(std::max(d.tlx - 1, 0),
+                   std::max(d.tly - 1, 0),
+                   std::min(d.brx + 1, ASCII_WIDTH - 1),
+                   std::min(d.bry + 1, ASCII_HEIGHT - 1));
+        blit_flush();
+    }
+
+    glDisable(GL_SCISSOR_TEST);
+}
+
+//
+// Draw everything; nothing of FBO_WID is kept.
+//
+static void ascii_display_all (void)
+{_
+    glClear(GL_COLOR_BUFFER_BIT);
 
     blit_init();
-    ascii_blit();
+    ascii_blit(0, 0, ASCII_WIDTH - 1, ASCII_HEIGHT - 1);
     blit_flush();
+}
+
+void ascii_invalidate (void)
+{
+    drawn_valid = false;
+}
+
+//
+// The big ascii renderer. Called with FBO_WID bound, which is left as it
+// was if no cell has changed since it was last drawn.
+//
+void ascii_display (void)
+{_
+    mouse_found = false;
+    ascii_find_mouse();
+
+    bool full = !ascii_cached || !drawn_valid ||
+                (drawn_width != ASCII_WIDTH) ||
+                (drawn_height != ASCII_HEIGHT) ||
+                (drawn_cell_w != game->config.ascii_gl_width) ||
+                (drawn_cell_h != game->config.ascii_gl_height) ||
+                (drawn_fbo_tex != fbo_tex_id[FBO_WID]);
+
+#ifdef ENABLE_ASCII_MOUSE
+    //
+    // The cursor is drawn into the layer, so it cannot be kept.
+    //
+    full = true;
+#endif
+
+    if (!full) {
+        int changed = ascii_find_dirty();
+
+        //
+        // Past half the screen, the scissored runs cost more than they save.
+        //
+        if (changed * 2 > ASCII_WIDTH * ASCII_HEIGHT) {
+            full = true;
+        } else if (!changed) {
+            ascii_frames_kept++;
+        } else {
+            ascii_display_dirty();
+            ascii_frames_partial++;
+        }
+    }
+
+    if (full) {
+        ascii_display_all();
+        ascii_frames_full++;
+    }
 
 #ifdef ENABLE_ASCII_MOUSE
     if (mouse_found) {
@@ -1163,10 +1420,101 @@ void ascii_display (void)
     }
 #endif
 
-    for (auto y = 0; y < ASCII_HEIGHT; y++) {
-        for (auto x = 0; x < ASCII_WIDTH; x++) {
-            AsciiCell *cell = &getref(cells, x, y);
-            *cell = {};
+    //
+    // Keep what was drawn to compare the next frame against.
+    //
+    cells->used = ASCII_WIDTH * ASCII_HEIGHT;
+    std::swap(cells, cells_drawn);
+    drawn_valid = true;
+    drawn_width = ASCII_WIDTH;
+    drawn_height = ASCII_HEIGHT;
+    drawn_cell_w = game->config.ascii_gl_width;
+    drawn_cell_h = game->config.ascii_gl_height;
+    drawn_fbo_tex = fbo_tex_id[FBO_WID];
+
+    ascii_cells_clear(cells);
+}
+
+//
+// User has entered a command, run it
+//
+uint8_t ascii_cache_set (tokens_t *tokens, void *context)
+{_
+    char *s = tokens->args[2];
+
+    if (s && (*s != '\0')) {
+        ascii_cached = strtol(s, 0, 10) ? true : false;
+        ascii_invalidate();
+    }
+
+    CON("UI cache %s", ascii_cached ? "on" : "off");
+    return (true);
+}
+
+//
+// User has entered a command, run it
+//
+uint8_t ascii_bench (tokens_t *tokens, void *context)
+{_
+    char *s = tokens->args[2];
+    int frames = 100;
+
+    if (s && (*s != '\0')) {
+        frames = atoi(s);
+    }
+    if (frames <= 0) {
+        frames = 1;
+    }
+
+    bool cached = ascii_cached;
+    auto fps = game->fps_value;
+
+    CON("bench ui: %d frames, each way", frames);
+
+    for (auto on = 0; on < 2; on++) {
+        ascii_cached = on;
+        ascii_invalidate();
+
+        //
+        // Once with nothing changing, and once with a new FPS count every
+        // frame, as if the counter were always ticking over.
+        //
+        for (auto ticking = 0; ticking < 2; ticking++) {
+            wid_display_all();
+            glFinish();
+
+            auto full = ascii_frames_full;
+            auto partial = ascii_frames_partial;
+            auto kept = ascii_frames_kept;
+            auto draws = gl_draw_calls;
+            auto hit = ascii_runs_hit;
+            auto miss = ascii_runs_miss;
+
+            auto start = std::chrono::steady_clock::now();
+            for (auto f = 0; f < frames; f++) {
+                if (ticking) {
+                    game->fps_value = f;
+                }
+                wid_display_all();
+            }
+            glFinish();
+            auto end = std::chrono::steady_clock::now();
+            double ms =
+                std::chrono::duration<double, std::milli>(end - start).count();
+
+            CON("  cache %-3s %-9s: %7.3f ms/frame, %5.1f draws/frame, "
+                "%u full %u partial %u kept, text %u hit %u miss",
+                on ? "on" : "off", ticking ? "fps" : "idle", ms / frames,
+                (double) (gl_draw_calls - draws) / frames,
+                ascii_frames_full - full, ascii_frames_partial - partial,
+                ascii_frames_kept - kept,
+                ascii_runs_hit - hit, ascii_runs_miss - miss);
         }
     }
+
+    ascii_cached = cached;
+    ascii_invalidate();
+    game->fps_value = fps;
+
+    return (true);
 }
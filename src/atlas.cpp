@@ -0,0 +1,320 @@
+//
+// Copyright goblinhack@gmail.com
+// See the README file for license info.
+//
+
+#include "my_game.h"
+#include "my_atlas.h"
+#include "my_tile.h"
+#include "my_pixel.h"
+#include "my_wid.h"
+#include "my_ascii.h"
+
+#include <algorithm>
+
+bool atlas_enabled;
+
+//
+// Each texture is packed with a one pixel border copied from its edges,
+// so sampling at a tile's edge reads what clamping to the edge of its own
+// texture would have.
+//
+static const int ATLAS_BORDER = 1;
+
+//
+// Largest page we will make, whatever the driver allows.
+//
+static const int ATLAS_PAGE_MAX = 4096;
+
+class AtlasItem {
+public:
+    Texp tex {};
+    int w {};
+    int h {};
+    int page {};
+    int x {};
+    int y {};
+};
+
+//
+// Where a tile was before it was moved into the atlas.
+//
+class AtlasTile {
+public:
+    Tilep tile {};
+    int item {};
+    int32_t gl_binding {};
+    double x1 {};
+    double y1 {};
+    double x2 {};
+    double y2 {};
+    double pct_width {};
+    double pct_height {};
+};
+
+static std::vector<AtlasItem> items;
+static std::vector<AtlasTile> moved;
+static std::vector<Texp> pages;
+static int page_size;
+
+//
+// Shelf pack the items, tallest first, into pages of the given size.
+// Returns the number of pages used, or 0 if something cannot fit at all.
+//
+static int atlas_pack (int size)
+{
+    int page = 0;
+    int x = 0;
+    int y = 0;
+    int shelf_h = 0;
+
+    for (auto &i : items) {
+        int w = i.w + ATLAS_BORDER * 2;
+        int h = i.h + ATLAS_BORDER * 2;
+
+        if ((w > size) || (h > size)) {
+            return (0);
+        }
+
+        if (x + w > size) {
+            x = 0;
+            y += shelf_h;
+            shelf_h = 0;
+        }
+
+        if (y + h > size) {
+            page++;
+            x = 0;
+            y = 0;
+            shelf_h = 0;
+        }
+
+        i.page = page;
+        i.x = x + ATLAS_BORDER;
+        i.y = y + ATLAS_BORDER;
+
+        x += w;
+        shelf_h = std::max(shelf_h, h);
+    }
+
+    return (page + 1);
+}
+
+static void atlas_copy (SDL_Surface *to, const AtlasItem &i)
+{
+    auto from = tex_get_surface(i.tex);
+
+    for (auto y = -ATLAS_BORDER; y < i.h + ATLAS_BORDER; y++) {
+        auto row = (uint32_t*) ((uint8_t*) to->pixels +
+                                (i.y + y) * to->pitch);
+        int sy = std::min(std::max(y, 0), i.h - 1);
+
+        for (auto x = -ATLAS_BORDER; x < i.w + ATLAS_BORDER; x++) {
+            int sx = std::min(std::max(x, 0), i.w - 1);
+            color c = getPixel(from, sx, sy);
+            row[i.x + x] = (c.a << 24) | (c.b << 16) | (c.g << 8) | c.r;
+        }
+    }
+}
+
+void atlas_init (void)
+{_
+    for (auto t : all_tiles_array) {
+        if (!t->tex || !tex_get_surface(t->tex)) {
+            continue;
+        }
+
+        auto found = std::find_if(items.begin(), items.end(),
+                                  [&](const AtlasItem &i) {
+                                      return (i.tex == t->tex);
+                                  });
+        if (found != items.end()) {
+            continue;
+        }
+
+        AtlasItem i;
+        i.tex = t->tex;
+        i.w = tex_get_width(t->tex);
+        i.h = tex_get_height(t->tex);
+        items.push_back(i);
+    }
+
+    if (items.size() < 2) {
+        items.clear();
+        return;
+    }
+
+    std::stable_sort(items.begin(), items.end(),
+                     [](const AtlasItem &a, const AtlasItem &b) {
+                         return (a.h > b.h);
+                     });
+
+    GLint max_size = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+    max_size = std::min(max_size, ATLAS_PAGE_MAX);
+
+    //
+    // The smallest square page that takes everything, else as many of the
+    // largest as it needs.
+    //
+    int npages = 0;
+    for (page_size = 256; page_size <= max_size; page_size *= 2) {
+        npages = atlas_pack(page_size);
+        if (npages == 1) {
+            break;
+        }
+    }
+    if (npages != 1) {
+        page_size = max_size;
+        npages = atlas_pack(page_size);
+    }
+
+    if (!npages) {
+        CON("INIT: atlas: a texture is larger than %d, not packing",
+            max_size);
+        items.clear();
+        return;
+    }
+
+    for (auto p = 0; p < npages; p++) {
+        auto surf = SDL_CreateRGBSurface(0, page_size, page_size, 32,
+                                         0x000000ff, 0x0000ff00,
+                                         0x00ff0000, 0xff000000);
+        newptr(surf, "SDL_CreateRGBSurface");
+        memset(surf->pixels, 0, surf->pitch * page_size);
+
+        for (auto &i : items) {
+            if (i.page == p) {
+                atlas_copy(surf, i);
+            }
+        }
+
+        auto name = "atlas" + std::to_string(p);
+        pages.push_back(tex_from_surface(surf, name, name, GL_NEAREST));
+    }
+
+    for (auto t : all_tiles_array) {
+        auto found = std::find_if(items.begin(), items.end(),
+                                  [&](const AtlasItem &i) {
+                                      return (i.tex == t->tex);
+                                  });
+        if (found == items.end()) {
+            continue;
+        }
+
+        AtlasTile m;
+        m.tile = t;
+        m.item = found - items.begin();
+        m.gl_binding = t->gl_binding();
+        m.x1 = t->x1;
+        m.y1 = t->y1;
+        m.x2 = t->x2;
+        m.y2 = t->y2;
+        m.pct_width = t->pct_width;
+        m.pct_height = t->pct_height;
+        moved.push_back(m);
+    }
+
+    CON("INIT: atlas: %d textures, %d tiles, into %d page(s) of %dx%d",
+        (int) items.size(), (int) moved.size(), npages,
+        page_size, page_size);
+
+    atlas_select(true);
+}
+
+void atlas_fini (void)
+{_
+    atlas_select(false);
+    items.clear();
+    moved.clear();
+    pages.clear();
+}
+
+void atlas_select (bool enabled)
+{_
+    if (moved.empty()) {
+        atlas_enabled = false;
+        return;
+    }
+
+    if (enabled == atlas_enabled) {
+        return;
+    }
+
+    atlas_enabled = enabled;
+
+    for (auto &m : moved) {
+        auto t = m.tile;
+
+        if (!enabled) {
+            t->set_gl_binding(m.gl_binding);
+            t->x1 = m.x1;
+            t->y1 = m.y1;
+            t->x2 = m.x2;
+            t->y2 = m.y2;
+            t->pct_width = m.pct_width;
+            t->pct_height = m.pct_height;
+            continue;
+        }
+
+        auto i = &items[m.item];
+        double sx = (double) i->w / page_size;
+        double sy = (double) i->h / page_size;
+        double ox = (double) i->x / page_size;
+        double oy = (double) i->y / page_size;
+
+        t->set_gl_binding(tex_get_gl_binding(pages[i->page]));
+        t->x1 = ox + m.x1 * sx;
+        t->y1 = oy + m.y1 * sy;
+        t->x2 = ox + m.x2 * sx;
+        t->y2 = oy + m.y2 * sy;
+        t->pct_width = m.pct_width * sx;
+        t->pct_height = m.pct_height * sy;
+    }
+}
+
+//
+// User has entered a command, run it
+//
+uint8_t atlas_set (tokens_t *tokens, void *context)
+{_
+    char *s = tokens->args[2];
+
+    if (s && (*s != '\0')) {
+        atlas_select(strtol(s, 0, 10) ? true : false);
+    }
+
+    CON("tile atlas %s", atlas_enabled ? "on" : "off");
+    return (true);
+}
+
+//
+// User has entered a command, run it
+//
+uint8_t atlas_bench (tokens_t *tokens, void *context)
+{_
+    bool enabled = atlas_enabled;
+
+    if (moved.empty()) {
+        CON("bench atlas: no atlas");
+        return (true);
+    }
+
+    //
+    // Count the draws for one whole UI frame each way.
+    //
+    uint32_t draws[2];
+    for (auto on = 0; on < 2; on++) {
+        atlas_select(on);
+        auto before = gl_draw_calls;
+        ascii_invalidate();
+        wid_display_all();
+        draws[on] = gl_draw_calls - before;
+    }
+
+    atlas_select(enabled);
+
+    CON("bench atlas: UI frame, %u draws from separate textures, "
+        "%u from the atlas", draws[0], draws[1]);
+    return (true);
+}
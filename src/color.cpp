@@ -1517,7 +1517,9 @@ void glcolor_restore (void)
 {_
     color s = gl_last_color = gl_save_color;
 
-    glColor4ub(s.r, s.g, s.b, s.a);
+    if (!gl_core) {
+        glColor4ub(s.r, s.g, s.b, s.a);
+    }
 }
 
 color string2color (const char **s)
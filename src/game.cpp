@@ -4,6 +4,7 @@
 //
 
 #include "my_game.h"
+#include "my_sph.h"
 
 class Game *game;
 bool game_needs_restart;
@@ -20,7 +21,9 @@ game_mouse_down (int32_t x, int32_t y, uint32_t button)
         return (false);
     }
 
-    return (false);
+    sph_brush_down(button);
+
+    return (true);
 }
 
 uint8_t
@@ -30,5 +33,7 @@ game_mouse_up (int32_t x, int32_t y, uint32_t button)
         return (false);
     }
 
-    return (false);
+    sph_brush_up();
+
+    return (true);
 }
@@ -4,6 +4,7 @@
 //
 
 #include "my_tile.h"
+#include "my_atlas.h"
 
 static void gfx_init_ui_box (void)
 {
@@ -263,8 +264,10 @@ void gfx_init (void)
     gfx_init_text();
     gfx_init_ui_box();
     gfx_init_tiles();
+    atlas_init();
 }
 
 void gfx_fini (void)
 {
+    atlas_fini();
 }
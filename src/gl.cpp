@@ -6,6 +6,8 @@
 #include "my_game.h"
 #include "my_tile.h"
 
+#include <chrono>
+
 static void gl_init_fbo(void);
 
 float glapi_last_tex_right;
@@ -13,6 +15,18 @@ float glapi_last_tex_bottom;
 float glapi_last_right;
 float glapi_last_bottom;
 
+//
+// The size of the last 2D projection, that composites cover.
+//
+static int gl_2d_width;
+static int gl_2d_height;
+
+//
+// And the viewport it maps onto.
+//
+static int gl_viewport_width;
+static int gl_viewport_height;
+
 #define GL_ERROR_CHECK() { \
     auto errCode = glGetError();                                   \
     if (errCode == GL_NO_ERROR) {                                  \
@@ -42,8 +56,10 @@ void gl_init_2d_mode (void)
     //
     // Enable Texture Worldping
     //
-    CON("INIT: OpenGL enable textures");
-    glEnable(GL_TEXTURE_2D);
+    if (!gl_core) {
+        CON("INIT: OpenGL enable textures");
+        glEnable(GL_TEXTURE_2D);
+    }
 
     //
     // Enable alpha blending for sprites
@@ -59,28 +75,49 @@ void gl_init_2d_mode (void)
     glViewport(0, 0,
                game->config.outer_pix_width,
                game->config.outer_pix_height);
-    //
-    // Make sure we're changing the model view and not the projection
-    //
-    CON("INIT: OpenGL modelview");
-    glMatrixMode(GL_MODELVIEW);
-    glPushMatrix();
+    gl_viewport_width = game->config.outer_pix_width;
+    gl_viewport_height = game->config.outer_pix_height;
 
-    //
-    // Reset the view
-    //
-    CON("INIT: OpenGL identity");
-    glLoadIdentity();
+    if (gl_core) {
+        CON("INIT: OpenGL core profile shaders");
+        if (!gl_core_init()) {
+            DIE("OpenGL: could not set up the core profile renderer");
+        }
+    } else {
+        //
+        // Make sure we're changing the model view and not the projection
+        //
+        CON("INIT: OpenGL modelview");
+        glMatrixMode(GL_MODELVIEW);
+        glPushMatrix();
+
+        //
+        // Reset the view
+        //
+        CON("INIT: OpenGL identity");
+        glLoadIdentity();
+    }
 
     gl_init_fbo();
 
     CON("INIT: OpenGL misc");
     glLineWidth(1.0);
     glEnable(GL_LINE_SMOOTH);
+
+    CON("INIT: OpenGL stream buffers");
+    gl_stream_select(GL_STREAM_PERSISTENT);
 }
 
 void gl_enter_2d_mode (void)
 {_
+    gl_2d_width = game->config.inner_pix_width;
+    gl_2d_height = game->config.inner_pix_height;
+
+    if (gl_core) {
+        gl_core_ortho(0, gl_2d_width, gl_2d_height, 0, -1200.0, 1200.0);
+        return;
+    }
+
     //
     // Change to the projection matrix and set our viewing volume.
     //
@@ -116,6 +153,17 @@ void gl_enter_2d_mode (void)
 
 void gl_enter_2d_mode (int w, int h)
 {_
+    gl_2d_width = w;
+    gl_2d_height = h;
+    gl_viewport_width = w;
+    gl_viewport_height = h;
+
+    if (gl_core) {
+        gl_core_ortho(0, w, h, 0, -1200.0, 1200.0);
+        glViewport(0, 0, w, h);
+        return;
+    }
+
     //
     // Change to the projection matrix and set our viewing volume.
     //
@@ -151,9 +199,30 @@ void gl_enter_2d_mode (int w, int h)
     glLoadIdentity();
 }
 
+//
+// Scissor to a rectangle of the current 2D projection, rounded out to
+// whole pixels.
+//
+void gl_scissor_2d (float left, float top, float right, float bottom)
+{
+    float sx = (float) gl_viewport_width / gl_2d_width;
+    float sy = (float) gl_viewport_height / gl_2d_height;
+
+    int x1 = (int) floor(left * sx);
+    int x2 = (int) ceil(right * sx);
+    int y1 = (int) floor(top * sy);
+    int y2 = (int) ceil(bottom * sy);
+
+    glScissor(x1, gl_viewport_height - y2, x2 - x1, y2 - y1);
+}
+
 void
 gl_leave_2d_mode (void)
 {_
+    if (gl_core) {
+        return;
+    }
+
     glMatrixMode(GL_MODELVIEW);
     glPopMatrix();
 
@@ -166,6 +235,12 @@ void gl_enter_2_5d_mode (void)
     glEnable(GL_DEPTH_TEST);
     glClear(GL_COLOR_BUFFER_BIT);
 
+    if (gl_core) {
+        gl_core_enter_2_5d(15);
+        glCullFace(GL_BACK);
+        return;
+    }
+
     glMatrixMode(GL_PROJECTION);
     glPushMatrix();
 
@@ -200,6 +275,11 @@ gl_leave_2_5d_mode (void)
 {_
     glDisable(GL_DEPTH_TEST);
 
+    if (gl_core) {
+        gl_core_leave_2_5d();
+        return;
+    }
+
     glMatrixMode(GL_MODELVIEW);
     glPopMatrix();
 
@@ -353,27 +433,42 @@ std::array<GLuint, MAX_FBO> render_buf_id = {};
 std::array<GLuint, MAX_FBO> fbo_id = {};
 std::array<GLuint, MAX_FBO> fbo_tex_id = {};
 
+static void gl_fbo_size (int fbo, GLuint *tex_width, GLuint *tex_height)
+{
+    *tex_width = game->config.inner_pix_width;
+    *tex_height = game->config.inner_pix_height;
+
+    switch (fbo) {
+        case FBO_MAP:
+            *tex_width = game->config.inner_pix_width;
+            *tex_height = game->config.inner_pix_height;
+            break;
+        case FBO_WID:
+        case FBO_FINAL:
+            *tex_width = game->config.outer_pix_width;
+            *tex_height = game->config.outer_pix_height;
+            break;
+    }
+}
+
 void gl_init_fbo (void)
 {
     int i;
 
     CON("INIT: OpenGL create FBOs");
     for (i = 0; i < MAX_FBO; i++) {
-        GLuint tex_width = game->config.inner_pix_width;
-        GLuint tex_height = game->config.inner_pix_height;
-
-        switch (i) {
-            case FBO_MAP:
-                tex_width = game->config.inner_pix_width;
-                tex_height = game->config.inner_pix_height;
-                break;
-            case FBO_WID:
-            case FBO_FINAL:
-                tex_width = game->config.outer_pix_width;
-                tex_height = game->config.outer_pix_height;
-                break;
+        //
+        // Only needed if compositing cannot be done in one pass; see
+        // blit_fbo_need.
+        //
+        if (i == FBO_FINAL) {
+            continue;
         }
 
+        GLuint tex_width;
+        GLuint tex_height;
+        gl_fbo_size(i, &tex_width, &tex_height);
+
         gl_init_fbo_(i, &render_buf_id[i], &fbo_id[i], &fbo_tex_id[i],
                      tex_width, tex_height);
         gl_enter_2d_mode(tex_width, tex_height);
@@ -384,6 +479,28 @@ void gl_init_fbo (void)
     }
 }
 
+//
+// Create an FBO the first time it is used. Leaves the window's frame
+// buffer bound.
+//
+void blit_fbo_need (int fbo)
+{_
+    if (fbo_id[fbo]) {
+        return;
+    }
+
+    GLuint tex_width;
+    GLuint tex_height;
+    gl_fbo_size(fbo, &tex_width, &tex_height);
+
+    gl_init_fbo_(fbo, &render_buf_id[fbo], &fbo_id[fbo], &fbo_tex_id[fbo],
+                 tex_width, tex_height);
+    blit_fbo_bind(fbo);
+    glClearColor(0, 0, 0, 0);
+    glClear(GL_COLOR_BUFFER_BIT);
+    blit_fbo_unbind();
+}
+
 void blit_fbo (int fbo)
 {
     blit_init();
@@ -406,6 +523,219 @@ void blit_fbo_outer (int fbo)
     blit_flush();
 }
 
+//
+// Draw an FBO over the whole of the current 2D projection, inverting the
+// colours if asked.
+//
+void blit_fbo_composite (int fbo, bool inverted)
+{_
+    if (gl_core) {
+        gl_core_composite(fbo_tex_id[fbo], 0, inverted);
+        return;
+    }
+
+    if (inverted) {
+        glLogicOp(GL_COPY_INVERTED);
+        glEnable(GL_COLOR_LOGIC_OP);
+    }
+
+    blit_init();
+    blit(fbo_tex_id[fbo],
+         0.0, 1.0, 1.0, 0.0,
+         0, 0, gl_2d_width, gl_2d_height);
+    blit_flush();
+
+    if (inverted) {
+        glLogicOp(GL_COPY);
+        glDisable(GL_COLOR_LOGIC_OP);
+    }
+}
+
+//
+// Map and UI in one draw: the UI is blended over the map in the shader, as
+// glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA) would have blended it
+// into FBO_FINAL.
+//
+static const char *composite_over_vs =
+    "#version 120\n"
+    "varying vec2 tex_at;\n"
+    "void main ()\n"
+    "{\n"
+    "    gl_Position = ftransform();\n"
+    "    tex_at = gl_MultiTexCoord0.xy;\n"
+    "}\n";
+
+static const char *composite_over_fs =
+    "#version 120\n"
+    "uniform sampler2D tex;\n"
+    "uniform sampler2D over;\n"
+    "uniform bool inverted;\n"
+    "varying vec2 tex_at;\n"
+    "void main ()\n"
+    "{\n"
+    "    vec4 c = texture2D(tex, tex_at);\n"
+    "    vec4 o = texture2D(over, tex_at);\n"
+    "    c = vec4(mix(c.rgb, o.rgb, o.a), o.a * o.a + c.a * (1.0 - o.a));\n"
+    "    gl_FragColor = inverted ? vec4(1.0) - c : c;\n"
+    "}\n";
+
+static GLuint composite_over_program;
+static GLint composite_over_inverted;
+static bool composite_over_tried;
+static bool composite_over_ok;
+
+//
+// Cleared to force the composite through FBO_FINAL, for comparison.
+//
+static bool composite_one_pass = true;
+
+static bool blit_fbo_composite_over_init (void)
+{_
+    if (composite_over_tried) {
+        return (composite_over_ok);
+    }
+    composite_over_tried = true;
+
+    if (gl_core) {
+        composite_over_ok = true;
+        return (true);
+    }
+
+    if (!glActiveTexture_EXT) {
+        CON("OpenGL: no multitexture, compositing through FBO_FINAL");
+        return (false);
+    }
+
+    composite_over_program = gl_program_new("composite",
+                                            composite_over_vs,
+                                            composite_over_fs);
+    if (!composite_over_program) {
+        CON("OpenGL: no composite shader, compositing through FBO_FINAL");
+        return (false);
+    }
+
+    composite_over_inverted =
+        glGetUniformLocation_EXT(composite_over_program, "inverted");
+
+    glUseProgram_EXT(composite_over_program);
+    glUniform1i_EXT(glGetUniformLocation_EXT(composite_over_program, "tex"), 0);
+    glUniform1i_EXT(glGetUniformLocation_EXT(composite_over_program, "over"), 1);
+    glUseProgram_EXT(0);
+
+    composite_over_ok = true;
+    return (true);
+}
+
+//
+// The old way; three full screen passes.
+//
+static void blit_fbo_composite_passes (int under, int over, bool inverted)
+{_
+    blit_fbo_need(FBO_FINAL);
+
+    blit_fbo_bind(FBO_FINAL);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glcolor(WHITE);
+    glBlendFunc(GL_ONE, GL_ZERO);
+    blit_fbo_outer(under);
+
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    blit_fbo_outer(over);
+    blit_fbo_unbind();
+
+    glBlendFunc(GL_ONE, GL_ZERO);
+    blit_fbo_composite(FBO_FINAL, inverted);
+}
+
+//
+// Lay one FBO over another and draw them to the window's frame buffer in a
+// single pass over the current 2D projection, inverting if asked.
+//
+void blit_fbo_composite_over (int under, int over, bool inverted)
+{_
+    if (!composite_one_pass || !blit_fbo_composite_over_init()) {
+        blit_fbo_composite_passes(under, over, inverted);
+        return;
+    }
+
+    glBlendFunc(GL_ONE, GL_ZERO);
+
+    if (gl_core) {
+        gl_core_composite(fbo_tex_id[under], fbo_tex_id[over], inverted);
+        return;
+    }
+
+    glUseProgram_EXT(composite_over_program);
+    glUniform1i_EXT(composite_over_inverted, inverted ? 1 : 0);
+
+    glActiveTexture_EXT(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, fbo_tex_id[over]);
+    glActiveTexture_EXT(GL_TEXTURE0);
+
+    blit_init();
+    blit(fbo_tex_id[under],
+         0.0, 1.0, 1.0, 0.0,
+         0, 0, gl_2d_width, gl_2d_height);
+    blit_flush();
+
+    glActiveTexture_EXT(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture_EXT(GL_TEXTURE0);
+    glUseProgram_EXT(0);
+}
+
+//
+// User has entered a command, run it
+//
+uint8_t gl_bench_composite (tokens_t *tokens, void *context)
+{_
+    char *s = tokens->args[2];
+    int frames = 100;
+
+    if (s && (*s != '\0')) {
+        frames = atoi(s);
+    }
+    if (frames <= 0) {
+        frames = 1;
+    }
+
+    bool one_pass = composite_one_pass;
+    double mpix = ((double) game->config.outer_pix_width *
+                   game->config.outer_pix_height) / 1e6;
+
+    CON("bench composite: %d frames at %dx%d",
+        frames, game->config.outer_pix_width, game->config.outer_pix_height);
+
+    for (auto passes : { 3, 1 }) {
+        composite_one_pass = (passes == 1);
+
+        blit_fbo_composite_over(FBO_MAP, FBO_WID, false);
+        glFinish();
+
+        auto start = std::chrono::steady_clock::now();
+        for (auto f = 0; f < frames; f++) {
+            blit_fbo_composite_over(FBO_MAP, FBO_WID, false);
+        }
+        glFinish();
+        auto end = std::chrono::steady_clock::now();
+        double ms =
+            std::chrono::duration<double, std::milli>(end - start).count();
+
+        //
+        // Each pass writes every pixel of the frame once.
+        //
+        CON("  %d pass%s: %8.3f ms/frame, %6.1f Mpixels written, "
+            "%7.1f Mpixels/s",
+            passes, passes == 1 ? " " : "es", ms / frames, mpix * passes,
+            mpix * passes * frames * 1000.0 / ms);
+    }
+
+    composite_one_pass = one_pass;
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    return (true);
+}
+
 void blit_fbo_bind (int fbo)
 {
     glBindFramebuffer_EXT(GL_FRAMEBUFFER, fbo_id[fbo]);
@@ -416,6 +746,91 @@ void blit_fbo_unbind (void)
     glBindFramebuffer_EXT(GL_FRAMEBUFFER, 0);
 }
 
+static GLuint gl_shader_new (const char *name, GLenum type, const char *src)
+{_
+    GLuint shader = glCreateShader_EXT(type);
+    glShaderSource_EXT(shader, 1, &src, 0);
+    glCompileShader_EXT(shader);
+
+    GLint ok = 0;
+    glGetShaderiv_EXT(shader, GL_COMPILE_STATUS, &ok);
+    if (!ok) {
+        char log[1024] = {};
+        glGetShaderInfoLog_EXT(shader, sizeof(log), 0, log);
+        ERR("OpenGL: %s shader %s failed to compile: %s",
+            name, type == GL_VERTEX_SHADER ? "vertex" : "fragment", log);
+        glDeleteShader_EXT(shader);
+        return (0);
+    }
+
+    return (shader);
+}
+
+//
+// Compile and link a vertex and fragment shader. Returns 0, having logged
+// why, if either fails or shaders are not supported at all.
+//
+GLuint gl_program_new (const char *name, const char *vs, const char *fs)
+{_
+    if (!glCreateProgram_EXT || !glGetShaderiv_EXT) {
+        CON("OpenGL: no shader support for %s", name);
+        return (0);
+    }
+
+    GLuint v = gl_shader_new(name, GL_VERTEX_SHADER, vs);
+    GLuint f = gl_shader_new(name, GL_FRAGMENT_SHADER, fs);
+    if (!v || !f) {
+        if (v) {
+            glDeleteShader_EXT(v);
+        }
+        if (f) {
+            glDeleteShader_EXT(f);
+        }
+        return (0);
+    }
+
+    GLuint program = glCreateProgram_EXT();
+    glAttachShader_EXT(program, v);
+    glAttachShader_EXT(program, f);
+    glLinkProgram_EXT(program);
+
+    //
+    // The program keeps the shaders alive until it is itself deleted.
+    //
+    glDeleteShader_EXT(v);
+    glDeleteShader_EXT(f);
+
+    GLint ok = 0;
+    glGetProgramiv_EXT(program, GL_LINK_STATUS, &ok);
+    if (!ok) {
+        char log[1024] = {};
+        glGetProgramInfoLog_EXT(program, sizeof(log), 0, log);
+        ERR("OpenGL: %s shader failed to link: %s", name, log);
+        glDeleteProgram_EXT(program);
+        return (0);
+    }
+
+    LOG("OpenGL: %s shader ready", name);
+    return (program);
+}
+
+//
+// From the context's version string, as extension lists differ by profile.
+//
+bool gl_version_at_least (int major, int minor)
+{
+    auto version = (const char *) glGetString(GL_VERSION);
+    int have_major = 0;
+    int have_minor = 0;
+
+    if (!version || (sscanf(version, "%d.%d", &have_major, &have_minor) != 2)) {
+        return (false);
+    }
+
+    return ((have_major > major) ||
+            ((have_major == major) && (have_minor >= minor)));
+}
+
 //
 // x and y per element.
 //
@@ -457,36 +872,389 @@ GLfloat *bufp;
 GLfloat *bufp_end;
 int buf_tex;
 
-void blit_init (void)
-{_
-    buf_tex = 0;
+uint32_t gl_draw_calls;
+
+int gl_stream_mode = GL_STREAM_CLIENT;
+
+static const char *gl_stream_names[] = {
+    "client", "orphan", "persistent",
+};
+
+//
+// The client buffer, and each section of the ring, are this big. A batch
+// may fill up to two thirds of that, and is given some slack past bufp_end
+// for the push that crosses it.
+//
+static const uint32_t GL_STREAM_SECTION = 8 * 1024 * 1024;
+static const uint32_t GL_STREAM_BATCH = (GL_STREAM_SECTION * 2) / 3;
+static const uint32_t GL_STREAM_RESERVE = GL_STREAM_BATCH + 64 * 1024;
+static const int GL_STREAM_SECTIONS = 3;
+static const uint32_t GL_STREAM_RING = GL_STREAM_SECTION * GL_STREAM_SECTIONS;
+
+static float *gl_client_buf;
+
+static GLuint stream_vbo;
+
+//
+// The whole ring, mapped once, when persistent.
+//
+static char *stream_base;
+
+//
+// Offset into the ring at which the current batch starts, and when
+// orphaning, whether that batch's range is mapped.
+//
+static uint32_t stream_at;
+static bool stream_mapped;
+
+//
+// When persistent, each section is fenced as we move off it, and that
+// fence waited on before we write to it again.
+//
+static int stream_section;
+static std::array<GLsync, GL_STREAM_SECTIONS> stream_fence {};
 
-    if (gl_array_buf) {
-        bufp = gl_array_buf;
+static void gl_stream_wait (int section)
+{
+    auto &fence = stream_fence[section];
+    if (!fence) {
         return;
     }
 
-    //
-    // Our array size requirements.
-    //
-    uint32_t gl_array_size_required;
+    for (;;) {
+        auto r = glClientWaitSync_EXT(fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                                      1000000000);
+        if ((r == GL_ALREADY_SIGNALED) || (r == GL_CONDITION_SATISFIED)) {
+            break;
+        }
+        if (r == GL_WAIT_FAILED) {
+            ERR("OpenGL: wait on stream buffer fence failed");
+            break;
+        }
+    }
 
-    //
-    // If the screen size has changed or this is the first run, allocate our
-    // buffer if our size requirements have changed.
-    //
-    gl_array_size_required = 8 * 1024 * 1024;
+    glDeleteSync_EXT(fence);
+    fence = 0;
+}
+
+//
+// Find room for a whole batch and point the batch buffer at it.
+//
+static void gl_stream_begin (void)
+{
+    if (gl_stream_mode == GL_STREAM_PERSISTENT) {
+        uint32_t end = (stream_section + 1) * GL_STREAM_SECTION;
+        if (stream_at + GL_STREAM_RESERVE > end) {
+            stream_fence[stream_section] =
+                glFenceSync_EXT(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            stream_section = (stream_section + 1) % GL_STREAM_SECTIONS;
+            gl_stream_wait(stream_section);
+            stream_at = stream_section * GL_STREAM_SECTION;
+        }
+
+        gl_array_buf = (float *) (stream_base + stream_at);
+    } else {
+        if (stream_mapped) {
+            bufp = gl_array_buf;
+            return;
+        }
+
+        glBindBufferARB_EXT(GL_ARRAY_BUFFER, stream_vbo);
+
+        //
+        // Past the end of the ring, respecify it; the driver hands us new
+        // storage while draws from the old finish.
+        //
+        if (stream_at + GL_STREAM_RESERVE > GL_STREAM_RING) {
+            glBufferDataARB_EXT(GL_ARRAY_BUFFER, GL_STREAM_RING, 0,
+                                GL_STREAM_DRAW);
+            stream_at = 0;
+        }
+
+        gl_array_buf = (float *)
+            glMapBufferRange_EXT(GL_ARRAY_BUFFER, stream_at,
+                                 GL_STREAM_RESERVE,
+                                 GL_MAP_WRITE_BIT |
+                                 GL_MAP_INVALIDATE_RANGE_BIT |
+                                 GL_MAP_UNSYNCHRONIZED_BIT |
+                                 GL_MAP_FLUSH_EXPLICIT_BIT);
+        glBindBufferARB_EXT(GL_ARRAY_BUFFER, 0);
+
+        if (!gl_array_buf) {
+            ERR("OpenGL: could not map stream buffer, using client arrays");
+            gl_stream_select(GL_STREAM_CLIENT);
+            return;
+        }
+
+        stream_mapped = true;
+    }
+
+    gl_array_buf_end = (float *) (((char *) gl_array_buf) + GL_STREAM_BATCH);
+    bufp = gl_array_buf;
+    bufp_end = gl_array_buf_end;
+}
+
+//
+// Called by each flush before it sets its array pointers. Returns what to
+// hand them as the start of the batch: our memory for client arrays, else
+// the batch's offset in the bound ring.
+//
+static const char *gl_stream_flush (void)
+{
+    if (gl_stream_mode == GL_STREAM_CLIENT) {
+        return ((const char *) gl_array_buf);
+    }
+
+    glBindBufferARB_EXT(GL_ARRAY_BUFFER, stream_vbo);
+
+    if (gl_stream_mode == GL_STREAM_ORPHAN) {
+        glFlushMappedBufferRange_EXT(GL_ARRAY_BUFFER, 0,
+                                     (char *) bufp - (char *) gl_array_buf);
+        glUnmapBuffer_EXT(GL_ARRAY_BUFFER);
+        stream_mapped = false;
+    }
+
+    return ((const char *) (uintptr_t) stream_at);
+}
+
+//
+// Called by each flush after its draw. The next batch starts after this
+// one, kept 16 byte aligned.
+//
+static void gl_stream_done (void)
+{
+    if (gl_stream_mode == GL_STREAM_CLIENT) {
+        return;
+    }
+
+    glBindBufferARB_EXT(GL_ARRAY_BUFFER, 0);
+
+    stream_at += (((char *) bufp - (char *) gl_array_buf) + 15) & ~15;
+}
+
+static void gl_stream_release (void)
+{
+    if (!stream_vbo) {
+        return;
+    }
 
-    gl_array_buf = (__typeof__(gl_array_buf))
-                    myzalloc(gl_array_size_required, "GL xy buffer");
+    for (auto s = 0; s < GL_STREAM_SECTIONS; s++) {
+        gl_stream_wait(s);
+    }
+
+    if (stream_base || stream_mapped) {
+        glBindBufferARB_EXT(GL_ARRAY_BUFFER, stream_vbo);
+        glUnmapBuffer_EXT(GL_ARRAY_BUFFER);
+        glBindBufferARB_EXT(GL_ARRAY_BUFFER, 0);
+    }
+
+    glDeleteBuffersARB_EXT(1, &stream_vbo);
+    stream_vbo = 0;
+    stream_base = 0;
+    stream_mapped = false;
+    stream_at = 0;
+    stream_section = 0;
+}
+
+static bool gl_stream_create (int mode)
+{_
+    glGenBuffersARB_EXT(1, &stream_vbo);
+    glBindBufferARB_EXT(GL_ARRAY_BUFFER, stream_vbo);
+
+    if (mode == GL_STREAM_PERSISTENT) {
+        GLbitfield flags = GL_MAP_WRITE_BIT |
+                           GL_MAP_PERSISTENT_BIT |
+                           GL_MAP_COHERENT_BIT;
+        glBufferStorage_EXT(GL_ARRAY_BUFFER, GL_STREAM_RING, 0, flags);
+        stream_base = (char *)
+            glMapBufferRange_EXT(GL_ARRAY_BUFFER, 0, GL_STREAM_RING, flags);
+    } else {
+        glBufferDataARB_EXT(GL_ARRAY_BUFFER, GL_STREAM_RING, 0,
+                            GL_STREAM_DRAW);
+    }
+
+    glBindBufferARB_EXT(GL_ARRAY_BUFFER, 0);
+    GL_ERROR_CHECK();
+
+    if ((mode == GL_STREAM_PERSISTENT) && !stream_base) {
+        glDeleteBuffersARB_EXT(1, &stream_vbo);
+        stream_vbo = 0;
+        return (false);
+    }
+
+    return (true);
+}
+
+//
+// Falls back from persistent to orphan to client arrays as the context
+// lacks buffer storage or mapped ranges.
+//
+void gl_stream_select (int mode)
+{_
+    if ((mode == GL_STREAM_PERSISTENT) &&
+        (!gl_version_at_least(4, 4) || !glBufferStorage_EXT ||
+         !glFenceSync_EXT)) {
+        CON("OpenGL: no buffer storage, streaming by orphaning instead");
+        mode = GL_STREAM_ORPHAN;
+    }
+
+    if ((mode == GL_STREAM_ORPHAN) &&
+        (!gl_version_at_least(3, 0) || !glMapBufferRange_EXT)) {
+        CON("OpenGL: no mapped buffer ranges, using client arrays");
+        mode = GL_STREAM_CLIENT;
+    }
 
     //
-    // Make the end a bit smaller so we have plenty of headroom.
+    // There are no client arrays in a core profile.
     //
-    gl_array_buf_end =
-            (__typeof__(gl_array_buf_end))
-                ((char *)gl_array_buf) +
-                ((gl_array_size_required * 2) / 3);
+    if ((mode == GL_STREAM_CLIENT) && gl_core) {
+        CON("OpenGL: core profile, streaming by orphaning instead");
+        mode = GL_STREAM_ORPHAN;
+    }
+
+    if ((mode == gl_stream_mode) && ((mode == GL_STREAM_CLIENT) || stream_vbo)) {
+        return;
+    }
+
+    gl_stream_release();
+    gl_stream_mode = GL_STREAM_CLIENT;
+
+    if ((mode != GL_STREAM_CLIENT) && !gl_stream_create(mode)) {
+        ERR("OpenGL: could not create %s stream buffer, using client arrays",
+            gl_stream_names[mode]);
+        mode = GL_STREAM_CLIENT;
+    }
+
+    gl_stream_mode = mode;
+    LOG("OpenGL: blit batches stream via %s", gl_stream_names[mode]);
+
+    blit_init();
+}
+
+bool gl_stream_parse (const char *name)
+{
+    for (auto i = 0; i < GL_STREAM_MAX; i++) {
+        if (!strcasecmp(name, gl_stream_names[i])) {
+            gl_stream_select(i);
+            return (true);
+        }
+    }
+
+    return (false);
+}
+
+const char *gl_stream_name (int mode)
+{
+    if ((mode < 0) || (mode >= GL_STREAM_MAX)) {
+        return ("?");
+    }
+    return (gl_stream_names[mode]);
+}
+
+//
+// User has entered a command, run it
+//
+uint8_t gl_stream_set (tokens_t *tokens, void *context)
+{_
+    char *s = tokens->args[2];
+
+    if (s && (*s != '\0') && !gl_stream_parse(s)) {
+        CON("unknown stream %s; try client orphan or persistent", s);
+        return (false);
+    }
+
+    CON("blit batches stream via %s", gl_stream_name(gl_stream_mode));
+    return (true);
+}
+
+//
+// User has entered a command, run it
+//
+uint8_t gl_bench_blit (tokens_t *tokens, void *context)
+{_
+    static const int FRAMES = 100;
+
+    char *s = tokens->args[2];
+    int tiles = 20000;
+
+    if (s && (*s != '\0')) {
+        tiles = atoi(s);
+    }
+    if (tiles <= 0) {
+        tiles = 1;
+    }
+
+    auto tile = tile_find_mand("box");
+    auto mode = gl_stream_mode;
+    int w = game->config.inner_pix_width;
+    int h = game->config.inner_pix_height;
+
+    CON("bench blit: %d tiles, %d frames", tiles, FRAMES);
+
+    auto frame = [&]() {
+        blit_fbo_bind(FBO_MAP);
+        blit_init();
+        for (auto i = 0; i < tiles; i++) {
+            float x = (i * 7) % w;
+            float y = ((i * 7) / w * 5) % h;
+            tile_blit(tile, fpoint(x, y), fpoint(x + 8, y + 8));
+        }
+        blit_flush();
+    };
+
+    for (auto m = 0; m < GL_STREAM_MAX; m++) {
+        gl_stream_select(m);
+        if (gl_stream_mode != m) {
+            CON("  %-10s: unavailable", gl_stream_name(m));
+            continue;
+        }
+
+        frame();
+        glFinish();
+
+        //
+        // Submit is the time to write the batches and hand them over; the
+        // rest is the driver and GPU catching up.
+        //
+        auto start = std::chrono::steady_clock::now();
+        for (auto f = 0; f < FRAMES; f++) {
+            frame();
+        }
+        auto submitted = std::chrono::steady_clock::now();
+        glFinish();
+        auto end = std::chrono::steady_clock::now();
+        double submit_ms =
+            std::chrono::duration<double, std::milli>(submitted - start).count();
+        double ms =
+            std::chrono::duration<double, std::milli>(end - start).count();
+
+        CON("  %-10s: %8.3f ms/frame, %8.3f ms submit",
+            gl_stream_name(m), ms / FRAMES, submit_ms / FRAMES);
+    }
+
+    gl_stream_select(mode);
+    blit_fbo_unbind();
+
+    return (true);
+}
+
+void blit_init (void)
+{_
+    buf_tex = 0;
+
+    if (gl_stream_mode != GL_STREAM_CLIENT) {
+        gl_stream_begin();
+        return;
+    }
+
+    if (!gl_client_buf) {
+        gl_client_buf = (__typeof__(gl_client_buf))
+                        myzalloc(GL_STREAM_SECTION, "GL xy buffer");
+    }
+
+    gl_array_buf = gl_client_buf;
+    gl_array_buf_end = (__typeof__(gl_array_buf_end))
+                       (((char *) gl_client_buf) + GL_STREAM_BATCH);
 
     bufp = gl_array_buf;
     bufp_end = gl_array_buf_end;
@@ -494,10 +1262,15 @@ void blit_init (void)
 
 void blit_fini (void)
 {_
-    if (gl_array_buf) {
-        myfree(gl_array_buf);
-        gl_array_buf = 0;
+    gl_stream_release();
+    gl_stream_mode = GL_STREAM_CLIENT;
+
+    if (gl_client_buf) {
+        myfree(gl_client_buf);
+        gl_client_buf = 0;
     }
+
+    gl_array_buf = 0;
 }
 
 void blit_flush (void)
@@ -506,6 +1279,17 @@ void blit_flush (void)
         return;
     }
 
+    const char *base = gl_stream_flush();
+
+    if (gl_core) {
+        gl_core_draw(GL_TRIANGLE_STRIP, GL_CORE_UV_XY_RGBA, base,
+                     ((char*)bufp - (char*)gl_array_buf) /
+                        NUMBER_BYTES_PER_VERTICE_2D, buf_tex);
+        gl_stream_done();
+        blit_init();
+        return;
+    }
+
     //
     // Display all the tiles selected above in one blast.
     //
@@ -524,13 +1308,13 @@ void blit_flush (void)
         NUMBER_DIMENSIONS_PER_COORD_2D, // (u,v)
         GL_FLOAT,
         NUMBER_BYTES_PER_VERTICE_2D,
-        gl_array_buf);
+        base);
 
     glVertexPointer(
         NUMBER_DIMENSIONS_PER_COORD_2D, // (x,y)
         GL_FLOAT,
         NUMBER_BYTES_PER_VERTICE_2D,
-        ((char*)gl_array_buf) +
+        base +
             sizeof(GLfloat) *        // skip (u,v)
             NUMBER_DIMENSIONS_PER_COORD_2D);
 
@@ -538,13 +1322,14 @@ void blit_flush (void)
         NUMBER_COMPONENTS_PER_COLOR, // (r,g,b,a)
         GL_FLOAT,
         NUMBER_BYTES_PER_VERTICE_2D,
-        ((char*)gl_array_buf) +
+        base +
             sizeof(GLfloat) *        // skip (x,y)
             NUMBER_DIMENSIONS_PER_COORD_2D +
             sizeof(GLfloat) *        // skip (u,v)
             NUMBER_DIMENSIONS_PER_COORD_2D);
 
     glDrawArrays(GL_TRIANGLE_STRIP, 0, (GLsizei) nvertices);
+    gl_draw_calls++;
 
     glBindTexture(GL_TEXTURE_2D, 0);
 
@@ -552,6 +1337,7 @@ void blit_flush (void)
     glDisableClientState(GL_VERTEX_ARRAY);
     glDisableClientState(GL_COLOR_ARRAY);
 
+    gl_stream_done();
     blit_init();
 }
 
@@ -561,6 +1347,17 @@ void blit_flush_3d (void)
         return;
     }
 
+    const char *base = gl_stream_flush();
+
+    if (gl_core) {
+        gl_core_draw(GL_TRIANGLE_STRIP, GL_CORE_UV_XYZ_RGBA, base,
+                     ((char*)bufp - (char*)gl_array_buf) /
+                        NUMBER_BYTES_PER_VERTICE_3D, buf_tex);
+        gl_stream_done();
+        blit_init();
+        return;
+    }
+
     //
     // Display all the tiles selected above in one blast.
     //
@@ -579,13 +1376,13 @@ void blit_flush_3d (void)
         NUMBER_DIMENSIONS_PER_COORD_2D, // (u,v)
         GL_FLOAT,
         NUMBER_BYTES_PER_VERTICE_3D,
-        gl_array_buf);
+        base);
 
     glVertexPointer(
         NUMBER_DIMENSIONS_PER_COORD_3D, // (x,y)
         GL_FLOAT,
         NUMBER_BYTES_PER_VERTICE_3D,
-        ((char*)gl_array_buf) +
+        base +
             sizeof(GLfloat) *        // skip (u,v)
             NUMBER_DIMENSIONS_PER_COORD_2D);
 
@@ -593,13 +1390,14 @@ void blit_flush_3d (void)
         NUMBER_COMPONENTS_PER_COLOR, // (r,g,b,a)
         GL_FLOAT,
         NUMBER_BYTES_PER_VERTICE_3D,
-        ((char*)gl_array_buf) +
+        base +
             sizeof(GLfloat) *        // skip (x,y)
             NUMBER_DIMENSIONS_PER_COORD_3D +
             sizeof(GLfloat) *        // skip (u,v)
             NUMBER_DIMENSIONS_PER_COORD_2D);
 
     glDrawArrays(GL_TRIANGLE_STRIP, 0, (GLsizei) nvertices);
+    gl_draw_calls++;
 
     glBindTexture(GL_TEXTURE_2D, 0);
 
@@ -607,6 +1405,7 @@ void blit_flush_3d (void)
     glDisableClientState(GL_VERTEX_ARRAY);
     glDisableClientState(GL_COLOR_ARRAY);
 
+    gl_stream_done();
     blit_init();
 }
 
@@ -616,6 +1415,17 @@ void blit_flush_colored_triangles (void)
         return;
     }
 
+    const char *base = gl_stream_flush();
+
+    if (gl_core) {
+        gl_core_draw(GL_TRIANGLES, GL_CORE_XY_RGBA, base,
+                     ((char*)bufp - (char*)gl_array_buf) /
+                        (sizeof(GLfloat) * 6), 0);
+        gl_stream_done();
+        blit_init();
+        return;
+    }
+
     //
     // Display all the tiles selected above in one blast.
     //
@@ -636,21 +1446,23 @@ void blit_flush_colored_triangles (void)
         NUMBER_DIMENSIONS_PER_COORD_2D, // (x,y)
         GL_FLOAT,
         stride,
-        gl_array_buf);
+        base);
 
     glColorPointer(
         NUMBER_COMPONENTS_PER_COLOR, // (r,g,b,a)
         GL_FLOAT,
         stride,
-        ((char*)gl_array_buf) +
+        base +
             sizeof(GLfloat) *        // skip (x,y)
             NUMBER_DIMENSIONS_PER_COORD_2D);
 
     glDrawArrays(GL_TRIANGLES, 0, (GLsizei) nvertices);
+    gl_draw_calls++;
 
     glDisableClientState(GL_VERTEX_ARRAY);
     glDisableClientState(GL_COLOR_ARRAY);
 
+    gl_stream_done();
     blit_init();
 }
 
@@ -661,6 +1473,16 @@ void blit_flush_triangle_fan (void)
 
 void blit_flush_triangle_fan (float *b, float *e)
 {_
+    const char *base = gl_stream_flush() + ((char*)b - (char*)gl_array_buf);
+
+    if (gl_core) {
+        gl_core_draw(GL_TRIANGLE_FAN, GL_CORE_XY_RGBA, base,
+                     ((char*)e - (char*)b) / (sizeof(GLfloat) * 6), 0);
+        gl_stream_done();
+        blit_init();
+        return;
+    }
+
     //
     // Display all the tiles selected above in one blast.
     //
@@ -681,21 +1503,23 @@ void blit_flush_triangle_fan (float *b, float *e)
         NUMBER_DIMENSIONS_PER_COORD_2D, // (x,y)
         GL_FLOAT,
         stride,
-        b);
+        base);
 
     glColorPointer(
         NUMBER_COMPONENTS_PER_COLOR, // (r,g,b,a)
         GL_FLOAT,
         stride,
-        ((char*)b) +
+        base +
             sizeof(GLfloat) *        // skip (x,y)
             NUMBER_DIMENSIONS_PER_COORD_2D);
 
     glDrawArrays(GL_TRIANGLE_FAN, 0, (GLsizei) nvertices);
+    gl_draw_calls++;
 
     glDisableClientState(GL_VERTEX_ARRAY);
     glDisableClientState(GL_COLOR_ARRAY);
 
+    gl_stream_done();
     blit_init();
 }
 
@@ -705,6 +1529,17 @@ void blit_flush_tex_triangle_fan (void)
         return;
     }
 
+    const char *base = gl_stream_flush();
+
+    if (gl_core) {
+        gl_core_draw(GL_TRIANGLE_FAN, GL_CORE_UV_XY_RGBA, base,
+                     ((char*)bufp - (char*)gl_array_buf) /
+                        NUMBER_BYTES_PER_VERTICE_2D, buf_tex);
+        gl_stream_done();
+        blit_init();
+        return;
+    }
+
     //
     // Display all the tiles selected above in one blast.
     //
@@ -723,13 +1558,13 @@ void blit_flush_tex_triangle_fan (void)
         NUMBER_DIMENSIONS_PER_COORD_2D, // (u,v)
         GL_FLOAT,
         NUMBER_BYTES_PER_VERTICE_2D,
-        gl_array_buf);
+        base);
 
     glVertexPointer(
         NUMBER_DIMENSIONS_PER_COORD_2D, // (x,y)
         GL_FLOAT,
         NUMBER_BYTES_PER_VERTICE_2D,
-        ((char*)gl_array_buf) +
+        base +
             sizeof(GLfloat) *        // skip (x,y)
             NUMBER_DIMENSIONS_PER_COORD_2D);
 
@@ -737,13 +1572,14 @@ void blit_flush_tex_triangle_fan (void)
         NUMBER_COMPONENTS_PER_COLOR, // (r,g,b,a)
         GL_FLOAT,
         NUMBER_BYTES_PER_VERTICE_2D,
-        ((char*)gl_array_buf) +
+        base +
             sizeof(GLfloat) *        // skip (x,y)
             NUMBER_DIMENSIONS_PER_COORD_2D +
             sizeof(GLfloat) *        // skip (u,v)
             NUMBER_DIMENSIONS_PER_COORD_2D);
 
     glDrawArrays(GL_TRIANGLE_FAN, 0, (GLsizei) nvertices);
+    gl_draw_calls++;
 
     glBindTexture(GL_TEXTURE_2D, 0);
 
@@ -751,6 +1587,7 @@ void blit_flush_tex_triangle_fan (void)
     glDisableClientState(GL_VERTEX_ARRAY);
     glDisableClientState(GL_COLOR_ARRAY);
 
+    gl_stream_done();
     blit_init();
 }
 
@@ -760,6 +1597,17 @@ void blit_flush_triangle_strip (void)
         return;
     }
 
+    const char *base = gl_stream_flush();
+
+    if (gl_core) {
+        gl_core_draw(GL_TRIANGLE_STRIP, GL_CORE_XY_RGBA, base,
+                     ((char*)bufp - (char*)gl_array_buf) /
+                        (sizeof(GLfloat) * 6), 0);
+        gl_stream_done();
+        blit_init();
+        return;
+    }
+
     //
     // Display all the tiles selected above in one blast.
     //
@@ -780,21 +1628,23 @@ void blit_flush_triangle_strip (void)
         NUMBER_DIMENSIONS_PER_COORD_2D, // (x,y)
         GL_FLOAT,
         stride,
-        gl_array_buf);
+        base);
 
     glColorPointer(
         NUMBER_COMPONENTS_PER_COLOR, // (r,g,b,a)
         GL_FLOAT,
         stride,
-        ((char*)gl_array_buf) +
+        base +
             sizeof(GLfloat) *        // skip (x,y)
             NUMBER_DIMENSIONS_PER_COORD_2D);
 
     glDrawArrays(GL_TRIANGLE_STRIP, 0, (GLsizei) nvertices);
+    gl_draw_calls++;
 
     glDisableClientState(GL_VERTEX_ARRAY);
     glDisableClientState(GL_COLOR_ARRAY);
 
+    gl_stream_done();
     blit_init();
 }
 
@@ -804,6 +1654,17 @@ void blit_flush_triangles (void)
         return;
     }
 
+    const char *base = gl_stream_flush();
+
+    if (gl_core) {
+        gl_core_draw(GL_TRIANGLES, GL_CORE_XY, base,
+                     ((char*)bufp - (char*)gl_array_buf) /
+                        (sizeof(GLfloat) * 2), 0);
+        gl_stream_done();
+        blit_init();
+        return;
+    }
+
     //
     // Display all the tiles selected above in one blast.
     //
@@ -821,12 +1682,14 @@ void blit_flush_triangles (void)
         NUMBER_DIMENSIONS_PER_COORD_2D, // (x,y)
         GL_FLOAT,
         0, // stride
-        ((char*)gl_array_buf));
+        base);
 
     glDrawArrays(GL_TRIANGLES, 0, (GLsizei) nvertices);
+    gl_draw_calls++;
 
     glDisableClientState(GL_VERTEX_ARRAY);
 
+    gl_stream_done();
     blit_init();
 }
 
@@ -840,10 +1703,16 @@ void gl_blitquad (float left, float top, float right, float bottom)
     Vertex2f(left, bottom);
     Vertex2f(right, bottom);
 
+    if (gl_core) {
+        gl_core_draw_xy(GL_TRIANGLE_STRIP, xy, 4);
+        return;
+    }
+
     glEnableClientState(GL_VERTEX_ARRAY);
 
     glVertexPointer(2, GL_FLOAT, 0, xy);
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    gl_draw_calls++;
 
     glDisableClientState(GL_VERTEX_ARRAY);
 }
@@ -858,10 +1727,16 @@ void gl_blitsquare (float left, float top, float right, float bottom)
     Vertex2f(right, bottom);
     Vertex2f(left, bottom);
 
+    if (gl_core) {
+        gl_core_draw_xy(GL_LINE_LOOP, xy, 4);
+        return;
+    }
+
     glEnableClientState(GL_VERTEX_ARRAY);
 
     glVertexPointer(2, GL_FLOAT, 0, xy);
     glDrawArrays(GL_LINE_LOOP, 0, 4);
+    gl_draw_calls++;
 
     glDisableClientState(GL_VERTEX_ARRAY);
 }
@@ -874,10 +1749,16 @@ void gl_blitline (float left, float top, float right, float bottom)
     Vertex2f(left, top);
     Vertex2f(right, bottom);
 
+    if (gl_core) {
+        gl_core_draw_xy(GL_LINES, xy, 2);
+        return;
+    }
+
     glEnableClientState(GL_VERTEX_ARRAY);
 
     glVertexPointer(2, GL_FLOAT, 0, xy);
     glDrawArrays(GL_LINES, 0, 2);
+    gl_draw_calls++;
 
     glDisableClientState(GL_VERTEX_ARRAY);
 }
@@ -924,6 +1805,30 @@ PFNGLGENBUFFERSARBPROC glGenBuffersARB_EXT;
 PFNGLBINDBUFFERARBPROC glBindBufferARB_EXT;
 PFNGLBUFFERDATAARBPROC glBufferDataARB_EXT;
 PFNGLDELETEBUFFERSARBPROC glDeleteBuffersARB_EXT;
+PFNGLGETSHADERIVPROC glGetShaderiv_EXT;
+PFNGLGETPROGRAMIVPROC glGetProgramiv_EXT;
+PFNGLGETATTRIBLOCATIONPROC glGetAttribLocation_EXT;
+PFNGLVERTEXATTRIBPOINTERPROC glVertexAttribPointer_EXT;
+PFNGLENABLEVERTEXATTRIBARRAYPROC glEnableVertexAttribArray_EXT;
+PFNGLDISABLEVERTEXATTRIBARRAYPROC glDisableVertexAttribArray_EXT;
+PFNGLUNIFORM4FPROC glUniform4f_EXT;
+PFNGLVERTEXATTRIBDIVISORPROC glVertexAttribDivisor_EXT;
+PFNGLDRAWARRAYSINSTANCEDPROC glDrawArraysInstanced_EXT;
+PFNGLBUFFERSUBDATAARBPROC glBufferSubDataARB_EXT;
+PFNGLVERTEXATTRIB1FPROC glVertexAttrib1f_EXT;
+PFNGLMAPBUFFERRANGEPROC glMapBufferRange_EXT;
+PFNGLUNMAPBUFFERPROC glUnmapBuffer_EXT;
+PFNGLFLUSHMAPPEDBUFFERRANGEPROC glFlushMappedBufferRange_EXT;
+PFNGLBUFFERSTORAGEPROC glBufferStorage_EXT;
+PFNGLFENCESYNCPROC glFenceSync_EXT;
+PFNGLCLIENTWAITSYNCPROC glClientWaitSync_EXT;
+PFNGLDELETESYNCPROC glDeleteSync_EXT;
+PFNGLGENVERTEXARRAYSPROC glGenVertexArrays_EXT;
+PFNGLBINDVERTEXARRAYPROC glBindVertexArray_EXT;
+PFNGLDELETEVERTEXARRAYSPROC glDeleteVertexArrays_EXT;
+PFNGLUNIFORMMATRIX4FVPROC glUniformMatrix4fv_EXT;
+PFNGLVERTEXATTRIB4FPROC glVertexAttrib4f_EXT;
+PFNGLACTIVETEXTUREPROC glActiveTexture_EXT;
 
 static void gl_ext_load (void)
 {_
@@ -1198,6 +2103,198 @@ static void gl_ext_load (void)
     } else {
         CON("INIT: - glDeleteBuffersARB_EXT - present");
     }
+
+    glGetShaderiv_EXT =
+        (__typeof__(glGetShaderiv_EXT)) wglGetProcAddress("glGetShaderiv");
+    if (!glGetShaderiv_EXT) {
+        CON("INIT: - glGetShaderiv_EXT - NOT present");
+    } else {
+        CON("INIT: - glGetShaderiv_EXT - present");
+    }
+
+    glGetProgramiv_EXT =
+        (__typeof__(glGetProgramiv_EXT)) wglGetProcAddress("glGetProgramiv");
+    if (!glGetProgramiv_EXT) {
+        CON("INIT: - glGetProgramiv_EXT - NOT present");
+    } else {
+        CON("INIT: - glGetProgramiv_EXT - present");
+    }
+
+    glGetAttribLocation_EXT =
+        (__typeof__(glGetAttribLocation_EXT)) wglGetProcAddress("glGetAttribLocation");
+    if (!glGetAttribLocation_EXT) {
+        CON("INIT: - glGetAttribLocation_EXT - NOT present");
+    } else {
+        CON("INIT: - glGetAttribLocation_EXT - present");
+    }
+
+    glVertexAttribPointer_EXT =
+        (__typeof__(glVertexAttribPointer_EXT)) wglGetProcAddress("glVertexAttribPointer");
+    if (!glVertexAttribPointer_EXT) {
+        CON("INIT: - glVertexAttribPointer_EXT - NOT present");
+    } else {
+        CON("INIT: - glVertexAttribPointer_EXT - present");
+    }
+
+    glEnableVertexAttribArray_EXT =
+        (__typeof__(glEnableVertexAttribArray_EXT)) wglGetProcAddress("glEnableVertexAttribArray");
+    if (!glEnableVertexAttribArray_EXT) {
+        CON("INIT: - glEnableVertexAttribArray_EXT - NOT present");
+    } else {
+        CON("INIT: - glEnableVertexAttribArray_EXT - present");
+    }
+
+    glDisableVertexAttribArray_EXT =
+        (__typeof__(glDisableVertexAttribArray_EXT)) wglGetProcAddress("glDisableVertexAttribArray");
+    if (!glDisableVertexAttribArray_EXT) {
+        CON("INIT: - glDisableVertexAttribArray_EXT - NOT present");
+    } else {
+        CON("INIT: - glDisableVertexAttribArray_EXT - present");
+    }
+
+    glUniform4f_EXT =
+        (__typeof__(glUniform4f_EXT)) wglGetProcAddress("glUniform4f");
+    if (!glUniform4f_EXT) {
+        CON("INIT: - glUniform4f_EXT - NOT present");
+    } else {
+        CON("INIT: - glUniform4f_EXT - present");
+    }
+
+    glVertexAttribDivisor_EXT =
+        (__typeof__(glVertexAttribDivisor_EXT)) wglGetProcAddress("glVertexAttribDivisor");
+    if (!glVertexAttribDivisor_EXT) {
+        CON("INIT: - glVertexAttribDivisor_EXT - NOT present");
+    } else {
+        CON("INIT: - glVertexAttribDivisor_EXT - present");
+    }
+
+    glDrawArraysInstanced_EXT =
+        (__typeof__(glDrawArraysInstanced_EXT)) wglGetProcAddress("glDrawArraysInstanced");
+    if (!glDrawArraysInstanced_EXT) {
+        CON("INIT: - glDrawArraysInstanced_EXT - NOT present");
+    } else {
+        CON("INIT: - glDrawArraysInstanced_EXT - present");
+    }
+
+    glBufferSubDataARB_EXT =
+        (__typeof__(glBufferSubDataARB_EXT)) wglGetProcAddress("glBufferSubDataARB");
+    if (!glBufferSubDataARB_EXT) {
+        CON("INIT: - glBufferSubDataARB_EXT - NOT present");
+    } else {
+        CON("INIT: - glBufferSubDataARB_EXT - present");
+    }
+
+    glVertexAttrib1f_EXT =
+        (__typeof__(glVertexAttrib1f_EXT)) wglGetProcAddress("glVertexAttrib1f");
+    if (!glVertexAttrib1f_EXT) {
+        CON("INIT: - glVertexAttrib1f_EXT - NOT present");
+    } else {
+        CON("INIT: - glVertexAttrib1f_EXT - present");
+    }
+
+    glMapBufferRange_EXT =
+        (__typeof__(glMapBufferRange_EXT)) wglGetProcAddress("glMapBufferRange");
+    if (!glMapBufferRange_EXT) {
+        CON("INIT: - glMapBufferRange_EXT - NOT present");
+    } else {
+        CON("INIT: - glMapBufferRange_EXT - present");
+    }
+
+    glUnmapBuffer_EXT =
+        (__typeof__(glUnmapBuffer_EXT)) wglGetProcAddress("glUnmapBuffer");
+    if (!glUnmapBuffer_EXT) {
+        CON("INIT: - glUnmapBuffer_EXT - NOT present");
+    } else {
+        CON("INIT: - glUnmapBuffer_EXT - present");
+    }
+
+    glFlushMappedBufferRange_EXT =
+        (__typeof__(glFlushMappedBufferRange_EXT)) wglGetProcAddress("glFlushMappedBufferRange");
+    if (!glFlushMappedBufferRange_EXT) {
+        CON("INIT: - glFlushMappedBufferRange_EXT - NOT present");
+    } else {
+        CON("INIT: - glFlushMappedBufferRange_EXT - present");
+    }
+
+    glBufferStorage_EXT =
+        (__typeof__(glBufferStorage_EXT)) wglGetProcAddress("glBufferStorage");
+    if (!glBufferStorage_EXT) {
+        CON("INIT: - glBufferStorage_EXT - NOT present");
+    } else {
+        CON("INIT: - glBufferStorage_EXT - present");
+    }
+
+    glFenceSync_EXT =
+        (__typeof__(glFenceSync_EXT)) wglGetProcAddress("glFenceSync");
+    if (!glFenceSync_EXT) {
+        CON("INIT: - glFenceSync_EXT - NOT present");
+    } else {
+        CON("INIT: - glFenceSync_EXT - present");
+    }
+
+    glClientWaitSync_EXT =
+        (__typeof__(glClientWaitSync_EXT)) wglGetProcAddress("glClientWaitSync");
+    if (!glClientWaitSync_EXT) {
+        CON("INIT: - glClientWaitSync_EXT - NOT present");
+    } else {
+        CON("INIT: - glClientWaitSync_EXT - present");
+    }
+
+    glDeleteSync_EXT =
+        (__typeof__(glDeleteSync_EXT)) wglGetProcAddress("glDeleteSync");
+    if (!glDeleteSync_EXT) {
+        CON("INIT: - glDeleteSync_EXT - NOT present");
+    } else {
+        CON("INIT: - glDeleteSync_EXT - present");
+    }
+
+    glGenVertexArrays_EXT =
+        (__typeof__(glGenVertexArrays_EXT)) wglGetProcAddress("glGenVertexArrays");
+    if (!glGenVertexArrays_EXT) {
+        CON("INIT: - glGenVertexArrays_EXT - NOT present");
+    } else {
+        CON("INIT: - glGenVertexArrays_EXT - present");
+    }
+
+    glBindVertexArray_EXT =
+        (__typeof__(glBindVertexArray_EXT)) wglGetProcAddress("glBindVertexArray");
+    if (!glBindVertexArray_EXT) {
+        CON("INIT: - glBindVertexArray_EXT - NOT present");
+    } else {
+        CON("INIT: - glBindVertexArray_EXT - present");
+    }
+
+    glDeleteVertexArrays_EXT =
+        (__typeof__(glDeleteVertexArrays_EXT)) wglGetProcAddress("glDeleteVertexArrays");
+    if (!glDeleteVertexArrays_EXT) {
+        CON("INIT: - glDeleteVertexArrays_EXT - NOT present");
+    } else {
+        CON("INIT: - glDeleteVertexArrays_EXT - present");
+    }
+
+    glUniformMatrix4fv_EXT =
+        (__typeof__(glUniformMatrix4fv_EXT)) wglGetProcAddress("glUniformMatrix4fv");
+    if (!glUniformMatrix4fv_EXT) {
+        CON("INIT: - glUniformMatrix4fv_EXT - NOT present");
+    } else {
+        CON("INIT: - glUniformMatrix4fv_EXT - present");
+    }
+
+    glVertexAttrib4f_EXT =
+        (__typeof__(glVertexAttrib4f_EXT)) wglGetProcAddress("glVertexAttrib4f");
+    if (!glVertexAttrib4f_EXT) {
+        CON("INIT: - glVertexAttrib4f_EXT - NOT present");
+    } else {
+        CON("INIT: - glVertexAttrib4f_EXT - present");
+    }
+
+    glActiveTexture_EXT =
+        (__typeof__(glActiveTexture_EXT)) wglGetProcAddress("glActiveTexture");
+    if (!glActiveTexture_EXT) {
+        CON("INIT: - glActiveTexture_EXT - NOT present");
+    } else {
+        CON("INIT: - glActiveTexture_EXT - present");
+    }
 }
 
 static void
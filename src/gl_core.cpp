@@ -0,0 +1,429 @@
+//
+// Copyright goblinhack@gmail.com
+// See the README file for license info.
+//
+
+#include "my_game.h"
+#include "my_gl.h"
+
+#include <cmath>
+
+bool gl_core;
+bool gl_core_requested;
+
+//
+// Attribute locations, fixed in the shaders so every layout's vertex array
+// object agrees on them.
+//
+enum {
+    GL_CORE_ATTR_XY,
+    GL_CORE_ATTR_UV,
+    GL_CORE_ATTR_RGBA,
+};
+
+static const char *gl_core_textured_vs =
+    "#version 330 core\n"
+    "layout(location = 0) in vec4 xy;\n"
+    "layout(location = 1) in vec2 uv;\n"
+    "layout(location = 2) in vec4 rgba;\n"
+    "uniform mat4 projection;\n"
+    "out vec2 tex_at;\n"
+    "out vec4 color;\n"
+    "void main ()\n"
+    "{\n"
+    "    gl_Position = projection * xy;\n"
+    "    tex_at = uv;\n"
+    "    color = rgba;\n"
+    "}\n";
+
+static const char *gl_core_textured_fs =
+    "#version 330 core\n"
+    "uniform sampler2D tex;\n"
+    "in vec2 tex_at;\n"
+    "in vec4 color;\n"
+    "out vec4 frag;\n"
+    "void main ()\n"
+    "{\n"
+    "    frag = texture(tex, tex_at) * color;\n"
+    "}\n";
+
+static const char *gl_core_colored_vs =
+    "#version 330 core\n"
+    "layout(location = 0) in vec4 xy;\n"
+    "layout(location = 2) in vec4 rgba;\n"
+    "uniform mat4 projection;\n"
+    "out vec4 color;\n"
+    "void main ()\n"
+    "{\n"
+    "    gl_Position = projection * xy;\n"
+    "    color = rgba;\n"
+    "}\n";
+
+static const char *gl_core_colored_fs =
+    "#version 330 core\n"
+    "in vec4 color;\n"
+    "out vec4 frag;\n"
+    "void main ()\n"
+    "{\n"
+    "    frag = color;\n"
+    "}\n";
+
+//
+// One triangle that covers the viewport, made from the vertex index, with
+// the frame buffer's texture laid over it the right way up, and optionally
+// a second blended over that. Inverting here replaces the logic op the
+// compatibility path uses.
+//
+static const char *gl_core_composite_vs =
+    "#version 330 core\n"
+    "out vec2 tex_at;\n"
+    "void main ()\n"
+    "{\n"
+    "    vec2 at = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);\n"
+    "    tex_at = at;\n"
+    "    gl_Position = vec4(at * 2.0 - 1.0, 0.0, 1.0);\n"
+    "}\n";
+
+static const char *gl_core_composite_fs =
+    "#version 330 core\n"
+    "uniform sampler2D tex;\n"
+    "uniform sampler2D over;\n"
+    "uniform bool layered;\n"
+    "uniform bool inverted;\n"
+    "in vec2 tex_at;\n"
+    "out vec4 frag;\n"
+    "void main ()\n"
+    "{\n"
+    "    vec4 c = texture(tex, tex_at);\n"
+    "    if (layered) {\n"
+    "        vec4 o = texture(over, tex_at);\n"
+    "        c = vec4(mix(c.rgb, o.rgb, o.a), o.a * o.a + c.a * (1.0 - o.a));\n"
+    "    }\n"
+    "    frag = inverted ? vec4(1.0) - c : c;\n"
+    "}\n";
+
+class GlCoreProgram {
+public:
+    GLuint program {};
+    GLint projection {};
+    GLint tex {};
+    GLint inverted {};
+    GLint layered {};
+
+    //
+    // Projection generation last handed to this program.
+    //
+    uint32_t generation {};
+};
+
+static GlCoreProgram textured;
+static GlCoreProgram colored;
+static GlCoreProgram composite;
+
+static std::array<GLuint, GL_CORE_LAYOUT_MAX> layout_vao;
+static GLuint composite_vao;
+
+//
+// For the quad and line helpers, which have no batch to draw from.
+//
+static GLuint immediate_vbo;
+
+//
+// Bound in place of texture 0, which in the compatibility profile turns
+// texturing off and so leaves just the colour.
+//
+static GLuint white_tex;
+
+static std::array<float, 16> projection;
+static std::array<float, 16> projection_saved;
+static uint32_t projection_generation = 1;
+
+static bool gl_core_program (GlCoreProgram *p, const char *name,
+                             const char *vs, const char *fs)
+{_
+    p->program = gl_program_new(name, vs, fs);
+    if (!p->program) {
+        return (false);
+    }
+
+    p->projection = glGetUniformLocation_EXT(p->program, "projection");
+    p->tex = glGetUniformLocation_EXT(p->program, "tex");
+    p->inverted = glGetUniformLocation_EXT(p->program, "inverted");
+    p->layered = glGetUniformLocation_EXT(p->program, "layered");
+
+    glUseProgram_EXT(p->program);
+    if (p->tex >= 0) {
+        glUniform1i_EXT(p->tex, 0);
+    }
+    GLint over = glGetUniformLocation_EXT(p->program, "over");
+    if (over >= 0) {
+        glUniform1i_EXT(over, 1);
+    }
+    glUseProgram_EXT(0);
+
+    return (true);
+}
+
+static void gl_core_use (GlCoreProgram *p)
+{
+    glUseProgram_EXT(p->program);
+
+    if ((p->projection >= 0) && (p->generation != projection_generation)) {
+        glUniformMatrix4fv_EXT(p->projection, 1, GL_FALSE,
+                               projection.data());
+        p->generation = projection_generation;
+    }
+}
+
+bool gl_core_init (void)
+{_
+    if (!gl_version_at_least(3, 3) || !glGenVertexArrays_EXT ||
+        !glUniformMatrix4fv_EXT) {
+        ERR("OpenGL: core profile needs GL 3.3");
+        return (false);
+    }
+
+    if (!gl_core_program(&textured, "core textured",
+                         gl_core_textured_vs, gl_core_textured_fs) ||
+        !gl_core_program(&colored, "core colored",
+                         gl_core_colored_vs, gl_core_colored_fs) ||
+        !gl_core_program(&composite, "core composite",
+                         gl_core_composite_vs, gl_core_composite_fs)) {
+        return (false);
+    }
+
+    glGenVertexArrays_EXT(GL_CORE_LAYOUT_MAX, layout_vao.data());
+    glGenVertexArrays_EXT(1, &composite_vao);
+
+    //
+    // Each layout's arrays stay enabled in its vertex array object; only
+    // the pointers change, as each batch sits at a new offset.
+    //
+    for (auto l = 0; l < GL_CORE_LAYOUT_MAX; l++) {
+        glBindVertexArray_EXT(layout_vao[l]);
+        glEnableVertexAttribArray_EXT(GL_CORE_ATTR_XY);
+        if ((l == GL_CORE_UV_XY_RGBA) || (l == GL_CORE_UV_XYZ_RGBA)) {
+            glEnableVertexAttribArray_EXT(GL_CORE_ATTR_UV);
+        }
+        if (l != GL_CORE_XY) {
+            glEnableVertexAttribArray_EXT(GL_CORE_ATTR_RGBA);
+        }
+    }
+    glBindVertexArray_EXT(0);
+
+    glGenBuffersARB_EXT(1, &immediate_vbo);
+
+    static const uint8_t white[4] = { 255, 255, 255, 255 };
+    glGenTextures(1, &white_tex);
+    glBindTexture(GL_TEXTURE_2D, white_tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0,
+                 GL_RGBA, GL_UNSIGNED_BYTE, white);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    gl_core_ortho(0, 1, 1, 0, -1, 1);
+
+    CON("INIT: OpenGL core profile renderer");
+
+    return (true);
+}
+
+void gl_core_fini (void)
+{_
+    for (auto p : { &textured, &colored, &composite }) {
+        if (p->program) {
+            glDeleteProgram_EXT(p->program);
+            *p = GlCoreProgram();
+        }
+    }
+
+    if (layout_vao[0]) {
+        glDeleteVertexArrays_EXT(GL_CORE_LAYOUT_MAX, layout_vao.data());
+        glDeleteVertexArrays_EXT(1, &composite_vao);
+        layout_vao = {};
+        composite_vao = 0;
+    }
+
+    if (immediate_vbo) {
+        glDeleteBuffersARB_EXT(1, &immediate_vbo);
+        immediate_vbo = 0;
+    }
+
+    if (white_tex) {
+        glDeleteTextures(1, &white_tex);
+        white_tex = 0;
+    }
+}
+
+//
+// As glOrtho would, column major.
+//
+void gl_core_ortho (float left, float right, float bottom, float top,
+                    float near, float far)
+{
+    projection = {};
+    projection[0] = 2.0f / (right - left);
+    projection[5] = 2.0f / (top - bottom);
+    projection[10] = -2.0f / (far - near);
+    projection[12] = -(right + left) / (right - left);
+    projection[13] = -(top + bottom) / (top - bottom);
+    projection[14] = -(far + near) / (far - near);
+    projection[15] = 1.0f;
+    projection_generation++;
+}
+
+//
+// Multiply the projection by a rotation of the given degrees about the x
+// or y axis, as glRotatef would.
+//
+static void gl_core_rotate (float degrees, bool about_x)
+{
+    float r = degrees * (float) M_PI / 180.0f;
+    float c = cosf(r);
+    float s = sinf(r);
+
+    std::array<float, 16> m {};
+    m[0] = m[5] = m[10] = m[15] = 1.0f;
+    if (about_x) {
+        m[5] = c;  m[6] = s;
+        m[9] = -s; m[10] = c;
+    } else {
+        m[0] = c;  m[2] = -s;
+        m[8] = s;  m[10] = c;
+    }
+
+    std::array<float, 16> out {};
+    for (auto col = 0; col < 4; col++) {
+        for (auto row = 0; row < 4; row++) {
+            float v = 0;
+            for (auto k = 0; k < 4; k++) {
+                v += projection[k * 4 + row] * m[col * 4 + k];
+            }
+            out[col * 4 + row] = v;
+        }
+    }
+
+    projection = out;
+    projection_generation++;
+}
+
+void gl_core_enter_2_5d (float scale)
+{
+    projection_saved = projection;
+    gl_core_ortho(-scale, scale, -scale * 0.7, scale * 0.7, -scale, scale);
+    gl_core_rotate(35.264f, true);
+    gl_core_rotate(-45.0f, false);
+}
+
+void gl_core_leave_2_5d (void)
+{
+    projection = projection_saved;
+    projection_generation++;
+}
+
+const float *gl_core_projection (void)
+{
+    return (projection.data());
+}
+
+//
+// Draw n vertices of the given layout from base, which is an offset into
+// the buffer bound to GL_ARRAY_BUFFER.
+//
+void gl_core_draw (GLenum mode, int layout, const char *base, GLsizei n,
+                   GLuint tex)
+{
+    static const GLsizei F = sizeof(GLfloat);
+
+    if (layout == GL_CORE_XY) {
+        color c = gl_color_current();
+        glVertexAttrib4f_EXT(GL_CORE_ATTR_RGBA, c.r / 255.0f, c.g / 255.0f,
+                             c.b / 255.0f, c.a / 255.0f);
+    }
+
+    gl_core_use(((layout == GL_CORE_UV_XY_RGBA) ||
+                 (layout == GL_CORE_UV_XYZ_RGBA)) ? &textured : &colored);
+    glBindVertexArray_EXT(layout_vao[layout]);
+
+    switch (layout) {
+    case GL_CORE_UV_XY_RGBA:
+        glVertexAttribPointer_EXT(GL_CORE_ATTR_UV, 2, GL_FLOAT, GL_FALSE,
+                                  8 * F, base);
+        glVertexAttribPointer_EXT(GL_CORE_ATTR_XY, 2, GL_FLOAT, GL_FALSE,
+                                  8 * F, base + 2 * F);
+        glVertexAttribPointer_EXT(GL_CORE_ATTR_RGBA, 4, GL_FLOAT, GL_FALSE,
+                                  8 * F, base + 4 * F);
+        break;
+    case GL_CORE_UV_XYZ_RGBA:
+        glVertexAttribPointer_EXT(GL_CORE_ATTR_UV, 2, GL_FLOAT, GL_FALSE,
+                                  9 * F, base);
+        glVertexAttribPointer_EXT(GL_CORE_ATTR_XY, 3, GL_FLOAT, GL_FALSE,
+                                  9 * F, base + 2 * F);
+        glVertexAttribPointer_EXT(GL_CORE_ATTR_RGBA, 4, GL_FLOAT, GL_FALSE,
+                                  9 * F, base + 5 * F);
+        break;
+    case GL_CORE_XY_RGBA:
+        glVertexAttribPointer_EXT(GL_CORE_ATTR_XY, 2, GL_FLOAT, GL_FALSE,
+                                  6 * F, base);
+        glVertexAttribPointer_EXT(GL_CORE_ATTR_RGBA, 4, GL_FLOAT, GL_FALSE,
+                                  6 * F, base + 2 * F);
+        break;
+    case GL_CORE_XY:
+        glVertexAttribPointer_EXT(GL_CORE_ATTR_XY, 2, GL_FLOAT, GL_FALSE,
+                                  2 * F, base);
+        break;
+    }
+
+    if ((layout == GL_CORE_UV_XY_RGBA) || (layout == GL_CORE_UV_XYZ_RGBA)) {
+        glBindTexture(GL_TEXTURE_2D, tex ? tex : white_tex);
+    }
+
+    glDrawArrays(mode, 0, n);
+    gl_draw_calls++;
+
+    glBindVertexArray_EXT(0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glUseProgram_EXT(0);
+}
+
+//
+// Draw a few vertices of just xy, in the current colour.
+//
+void gl_core_draw_xy (GLenum mode, const float *xy, GLsizei n)
+{
+    glBindBufferARB_EXT(GL_ARRAY_BUFFER, immediate_vbo);
+    glBufferDataARB_EXT(GL_ARRAY_BUFFER, n * 2 * sizeof(float), xy,
+                        GL_STREAM_DRAW);
+    gl_core_draw(mode, GL_CORE_XY, 0, n, 0);
+    glBindBufferARB_EXT(GL_ARRAY_BUFFER, 0);
+}
+
+//
+// Draw tex over the viewport, with over blended on top of it if given.
+//
+void gl_core_composite (GLuint tex, GLuint over, bool inverted)
+{
+    gl_core_use(&composite);
+    glUniform1i_EXT(composite.inverted, inverted ? 1 : 0);
+    glUniform1i_EXT(composite.layered, over ? 1 : 0);
+    glBindVertexArray_EXT(composite_vao);
+    if (over) {
+        glActiveTexture_EXT(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, over);
+        glActiveTexture_EXT(GL_TEXTURE0);
+    }
+    glBindTexture(GL_TEXTURE_2D, tex);
+
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    gl_draw_calls++;
+
+    if (over) {
+        glActiveTexture_EXT(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        glActiveTexture_EXT(GL_TEXTURE0);
+    }
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindVertexArray_EXT(0);
+    glUseProgram_EXT(0);
+}
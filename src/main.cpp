@@ -21,6 +21,10 @@
 #include "my_traceback.h"
 #include "my_ascii.h"
 #include "my_gfx.h"
+#include "my_sph_render.h"
+#include "my_sph_sdf.h"
+#include "my_sph_solver.h"
+#include "my_sph_stats.h"
 
 #include <random>       // std::default_random_engine
 std::default_random_engine rng;
@@ -33,6 +37,7 @@ char *DATA_PATH;
 char *TTF_PATH;
 char *GFX_PATH;
 bool opt_debug_mode;
+int opt_stats_every;
 
 FILE *LOG_STDOUT;
 FILE *LOG_STDERR;
@@ -430,6 +435,25 @@ static void usage (void)
     CON(" ");
     CON(" --new-game");
     CON(" --debug-mode");
+    CON(" --solver <name>        pressure solver: wcsph pcisph pbf flip");
+    CON(" --pbf-iterations <n>   constraint iterations per pbf substep");
+    CON(" --pbf-substeps <n>     fewest substeps per pbf step");
+    CON(" --pbf-dt <secs>        largest pbf timestep, up to --dt-max");
+    CON(" --dt-min <secs>        smallest adaptive timestep");
+    CON(" --dt-max <secs>        largest adaptive timestep");
+    CON(" --dt-fixed             always step by the default timestep");
+    CON(" --integrator <name>    euler leapfrog verlet, for wcsph and pcisph");
+    CON(" --obstacles <png>      obstacle mask, opaque is solid");
+    CON(" --periodic <axes>      wrap x, y or xy instead of walls");
+    CON(" --search <name>        neighbour search: slots sort permute");
+    CON(" --render <name>        particle drawing: sprites instanced parallel");
+    CON("                        density");
+    CON(" --density-from <n>     draw as density from n particles, 0 never");
+    CON(" --density-until <n>    then until under n particles");
+    CON(" --gl-stream <name>     blit batches: client orphan persistent");
+    CON(" --gl-core              use an OpenGL 3.3 core profile context");
+    CON(" --stats <steps>        write solver stats every N steps");
+    CON(" --stats-file <file>    stats csv, default sph_stats.csv");
     CON(" ");
     CON("Written by goblinhack@gmail.com");
 }
@@ -456,6 +480,198 @@ static void parse_args (int32_t argc, char *argv[])
             continue;
         }
 
+        if (!strcasecmp(argv[i], "--solver") ||
+            !strcasecmp(argv[i], "-solver")) {
+            if (i + 1 >= argc) {
+                usage();
+                DIE("missing argument for %s", argv[i]);
+            }
+            sph_solver_name = argv[++i];
+            continue;
+        }
+
+        if (!strcasecmp(argv[i], "--pbf-iterations") ||
+            !strcasecmp(argv[i], "-pbf-iterations")) {
+            if (i + 1 >= argc) {
+                usage();
+                DIE("missing argument for %s", argv[i]);
+            }
+            sph_pbf_iterations = strtol(argv[++i], 0, 10);
+            continue;
+        }
+
+        if (!strcasecmp(argv[i], "--pbf-substeps") ||
+            !strcasecmp(argv[i], "-pbf-substeps")) {
+            if (i + 1 >= argc) {
+                usage();
+                DIE("missing argument for %s", argv[i]);
+            }
+            sph_pbf_substeps = strtol(argv[++i], 0, 10);
+            continue;
+        }
+
+        if (!strcasecmp(argv[i], "--pbf-dt") ||
+            !strcasecmp(argv[i], "-pbf-dt")) {
+            if (i + 1 >= argc) {
+                usage();
+                DIE("missing argument for %s", argv[i]);
+            }
+            sph_pbf_dt = strtof(argv[++i], 0);
+            continue;
+        }
+
+        if (!strcasecmp(argv[i], "--dt-min") ||
+            !strcasecmp(argv[i], "-dt-min")) {
+            if (i + 1 >= argc) {
+                usage();
+                DIE("missing argument for %s", argv[i]);
+            }
+            sph_dt_min = strtof(argv[++i], 0);
+            continue;
+        }
+
+        if (!strcasecmp(argv[i], "--dt-max") ||
+            !strcasecmp(argv[i], "-dt-max")) {
+            if (i + 1 >= argc) {
+                usage();
+                DIE("missing argument for %s", argv[i]);
+            }
+            sph_dt_max = strtof(argv[++i], 0);
+            continue;
+        }
+
+        if (!strcasecmp(argv[i], "--dt-fixed") ||
+            !strcasecmp(argv[i], "-dt-fixed")) {
+            sph_dt_adaptive = false;
+            continue;
+        }
+
+        if (!strcasecmp(argv[i], "--obstacles") ||
+            !strcasecmp(argv[i], "-obstacles")) {
+            if (i + 1 >= argc) {
+                usage();
+                DIE("missing argument for %s", argv[i]);
+            }
+            sph_sdf_file = argv[++i];
+            continue;
+        }
+
+        if (!strcasecmp(argv[i], "--periodic") ||
+            !strcasecmp(argv[i], "-periodic")) {
+            if (i + 1 >= argc) {
+                usage();
+                DIE("missing argument for %s", argv[i]);
+            }
+            if (!sph_periodic_parse(argv[++i])) {
+                usage();
+                DIE("unknown periodic axes %s", argv[i]);
+            }
+            continue;
+        }
+
+        if (!strcasecmp(argv[i], "--search") ||
+            !strcasecmp(argv[i], "-search")) {
+            if (i + 1 >= argc) {
+                usage();
+                DIE("missing argument for %s", argv[i]);
+            }
+            if (!sph_search_parse(argv[++i])) {
+                usage();
+                DIE("unknown search %s", argv[i]);
+            }
+            continue;
+        }
+
+        if (!strcasecmp(argv[i], "--render") ||
+            !strcasecmp(argv[i], "-render")) {
+            if (i + 1 >= argc) {
+                usage();
+                DIE("missing argument for %s", argv[i]);
+            }
+            if (!sph_render_parse(argv[++i])) {
+                usage();
+                DIE("unknown render %s", argv[i]);
+            }
+            continue;
+        }
+
+        if (!strcasecmp(argv[i], "--density-from") ||
+            !strcasecmp(argv[i], "-density-from")) {
+            if (i + 1 >= argc) {
+                usage();
+                DIE("missing argument for %s", argv[i]);
+            }
+            sph_render_density_from =
+                std::max((int) strtol(argv[++i], 0, 10), 0);
+            continue;
+        }
+
+        if (!strcasecmp(argv[i], "--density-until") ||
+            !strcasecmp(argv[i], "-density-until")) {
+            if (i + 1 >= argc) {
+                usage();
+                DIE("missing argument for %s", argv[i]);
+            }
+            sph_render_density_until =
+                std::max((int) strtol(argv[++i], 0, 10), 0);
+            continue;
+        }
+
+        if (!strcasecmp(argv[i], "--gl-stream") ||
+            !strcasecmp(argv[i], "-gl-stream")) {
+            if (i + 1 >= argc) {
+                usage();
+                DIE("missing argument for %s", argv[i]);
+            }
+            if (!gl_stream_parse(argv[++i])) {
+                usage();
+                DIE("unknown gl stream %s", argv[i]);
+            }
+            continue;
+        }
+
+        //
+        // Read before the window is made, see main.
+        //
+        if (!strcasecmp(argv[i], "--gl-core") ||
+            !strcasecmp(argv[i], "-gl-core")) {
+            continue;
+        }
+
+        if (!strcasecmp(argv[i], "--integrator") ||
+            !strcasecmp(argv[i], "-integrator")) {
+            if (i + 1 >= argc) {
+                usage();
+                DIE("missing argument for %s", argv[i]);
+            }
+            sph_integrator = sph_integrator_find(argv[++i]);
+            if (sph_integrator < 0) {
+                usage();
+                DIE("unknown integrator %s", argv[i]);
+            }
+            continue;
+        }
+
+        if (!strcasecmp(argv[i], "--stats") ||
+            !strcasecmp(argv[i], "-stats")) {
+            if (i + 1 >= argc) {
+                usage();
+                DIE("missing argument for %s", argv[i]);
+            }
+            opt_stats_every = strtol(argv[++i], 0, 10);
+            continue;
+        }
+
+        if (!strcasecmp(argv[i], "--stats-file") ||
+            !strcasecmp(argv[i], "-stats-file")) {
+            if (i + 1 >= argc) {
+                usage();
+                DIE("missing argument for %s", argv[i]);
+            }
+            sph_stats_file = argv[++i];
+            continue;
+        }
+
         //
         // Bad argument.
         //
@@ -554,6 +770,17 @@ int32_t main (int32_t argc, char *argv[])
         game->config.debug_mode = opt_debug_mode;
     }
 
+    //
+    // The context profile has to be known before the window is made, which
+    // is before the other arguments are parsed.
+    //
+    for (auto i = 1; i < argc; i++) {
+        if (!strcasecmp(argv[i], "--gl-core") ||
+            !strcasecmp(argv[i], "-gl-core")) {
+            gl_core_requested = true;
+        }
+    }
+
     CON("INIT: SDL create window");
     if (!sdl_init()) {
         ERR("SDL init");
@@ -679,8 +906,14 @@ int32_t main (int32_t argc, char *argv[])
 
     game->init();
 
+    if (opt_stats_every) {
+        sph_stats_set_every(opt_stats_every);
+    }
+
     sdl_loop();
 
+    sph_stats_set_every(0);
+
     CON("FINI: Leave 2D mode");
     gl_leave_2d_mode();
 
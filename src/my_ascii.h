@@ -6,6 +6,7 @@
 #include <wchar.h>
 #include "my_point.h"
 #include "my_color.h"
+#include "my_command.h"
 
 class Tile;
 typedef class Tile* Tilep;
@@ -81,6 +82,26 @@ void ascii_putf(int x, int y, color fg, color bg, std::wstring const& fmt, ...);
 void ascii_putf__(int x, int y, color fg, color bg, std::wstring const& text);
 
 void ascii_display(void);
+void ascii_invalidate(void);
+
+//
+// When set, ascii_display only redraws the cells that changed since
+// FBO_WID was last drawn, and nothing at all if none did.
+//
+extern bool ascii_cached;
+extern uint32_t ascii_frames_full;
+extern uint32_t ascii_frames_partial;
+extern uint32_t ascii_frames_kept;
+
+//
+// ascii_putf__ keeps the last few hundred strings it has parsed, with
+// their colours, so repeated text skips the markup and font lookups.
+//
+extern uint32_t ascii_runs_hit;
+extern uint32_t ascii_runs_miss;
+
+uint8_t ascii_cache_set(tokensp, void *context);
+uint8_t ascii_bench(tokensp, void *context);
 
 int ascii_tp_tl1_tile(int x, int y, fpoint *);
 int ascii_tp_br1_tile(int x, int y, fpoint *);
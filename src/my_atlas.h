@@ -0,0 +1,26 @@
+//
+// Copyright goblinhack@gmail.com
+// See the README file for license info.
+//
+
+#pragma once
+#ifndef _MY_ATLAS_H_
+#define _MY_ATLAS_H_
+
+#include "my_command.h"
+
+//
+// Packs the textures of every loaded tile, the font included, into one or
+// a few atlas pages, and points each tile at its place there, so tile
+// batches stop flushing each time the texture changes. The tiles' own
+// textures are kept, so the atlas can be switched off again.
+//
+extern bool atlas_enabled;
+
+void atlas_init(void);
+void atlas_fini(void);
+void atlas_select(bool enabled);
+uint8_t atlas_set(tokensp, void *context);
+uint8_t atlas_bench(tokensp, void *context);
+
+#endif
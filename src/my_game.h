@@ -8,11 +8,16 @@
 typedef struct Particle_ {
 public:
     bool in_use;
+    bool asleep;
+    uint8_t attach_level;
     fpoint at;
+    fpoint sleep_at;
     spoint attach_at;
     fpoint velocity;
     fpoint force;
+    fpoint accel;
     float mass;
+    float h;
     float density;
     float pressure;
 } Particle;
@@ -51,6 +56,30 @@ public:
         std::array<uint16_t, PARTICLE_SLOTS>, PARTICLES_HEIGHT>, PARTICLES_WIDTH>
           all_particle_ids_at {};
 
+    //
+    // Particles with a longer smoothing length than standard are kept in
+    // a grid of twice the cell size, so searching for them walks as many
+    // cells as a standard particle's search does.
+    //
+#define PARTICLE_LEVELS  2
+
+    std::array<
+      std::array<
+        std::array<uint16_t, PARTICLE_SLOTS>, PARTICLES_HEIGHT / 2>,
+          PARTICLES_WIDTH / 2> coarse_particle_ids_at {};
+    int num_coarse_particles {};
+
+    //
+    // Slots of one cell of a grid level, in that level's coordinates.
+    //
+    uint16_t *particle_ids_at (int level, int x, int y)
+    {
+        if (level) {
+            return (getptr(coarse_particle_ids_at, x, y, 0));
+        }
+        return (getptr(all_particle_ids_at, x, y, 0));
+    }
+
     std::array<Particle, PARTICLE_MAX> particles {};
     int num_particles {};
 
@@ -64,7 +93,10 @@ public:
 };
 
 extern spoint point_to_grid(const fpoint &p);
+extern spoint point_to_grid(const fpoint &p, int level);
+extern fpoint grid_cell_size(void);
 extern spoint particle_to_grid(const Particle* p);
+extern int particle_grid_level(const Particle* p);
 
 extern class Game *game;
 
@@ -46,6 +46,7 @@
 
 #include "my_color.h"
 #include "my_point.h"
+#include "my_command.h"
 
 //
 // gl.c
@@ -53,6 +54,7 @@
 void gl_init_2d_mode(void);
 void gl_enter_2d_mode(void);
 void gl_enter_2d_mode(int, int);
+void gl_scissor_2d(float left, float top, float right, float bottom);
 void gl_leave_2d_mode(void);
 void gl_enter_2_5d_mode(void);
 void gl_leave_2_5d_mode(void);
@@ -123,6 +125,12 @@ extern GLfloat *bufp;
 extern GLfloat *bufp_end;
 extern int buf_tex;
 
+//
+// Every draw the batcher and the quad helpers make, for seeing how well
+// things batch. Never reset here.
+//
+extern uint32_t gl_draw_calls;
+
 extern void blit_init(void);
 
 extern float glapi_last_tex_right;
@@ -264,41 +272,89 @@ extern PFNGLGENBUFFERSARBPROC glGenBuffersARB_EXT;
 extern PFNGLBINDBUFFERARBPROC glBindBufferARB_EXT;
 extern PFNGLBUFFERDATAARBPROC glBufferDataARB_EXT;
 extern PFNGLDELETEBUFFERSARBPROC glDeleteBuffersARB_EXT;
+extern PFNGLGETSHADERIVPROC glGetShaderiv_EXT;
+extern PFNGLGETPROGRAMIVPROC glGetProgramiv_EXT;
+extern PFNGLGETATTRIBLOCATIONPROC glGetAttribLocation_EXT;
+extern PFNGLVERTEXATTRIBPOINTERPROC glVertexAttribPointer_EXT;
+extern PFNGLENABLEVERTEXATTRIBARRAYPROC glEnableVertexAttribArray_EXT;
+extern PFNGLDISABLEVERTEXATTRIBARRAYPROC glDisableVertexAttribArray_EXT;
+extern PFNGLUNIFORM4FPROC glUniform4f_EXT;
+extern PFNGLVERTEXATTRIBDIVISORPROC glVertexAttribDivisor_EXT;
+extern PFNGLDRAWARRAYSINSTANCEDPROC glDrawArraysInstanced_EXT;
+extern PFNGLBUFFERSUBDATAARBPROC glBufferSubDataARB_EXT;
+extern PFNGLVERTEXATTRIB1FPROC glVertexAttrib1f_EXT;
+extern PFNGLMAPBUFFERRANGEPROC glMapBufferRange_EXT;
+extern PFNGLUNMAPBUFFERPROC glUnmapBuffer_EXT;
+extern PFNGLFLUSHMAPPEDBUFFERRANGEPROC glFlushMappedBufferRange_EXT;
+extern PFNGLBUFFERSTORAGEPROC glBufferStorage_EXT;
+extern PFNGLFENCESYNCPROC glFenceSync_EXT;
+extern PFNGLCLIENTWAITSYNCPROC glClientWaitSync_EXT;
+extern PFNGLDELETESYNCPROC glDeleteSync_EXT;
+extern PFNGLGENVERTEXARRAYSPROC glGenVertexArrays_EXT;
+extern PFNGLBINDVERTEXARRAYPROC glBindVertexArray_EXT;
+extern PFNGLDELETEVERTEXARRAYSPROC glDeleteVertexArrays_EXT;
+extern PFNGLUNIFORMMATRIX4FVPROC glUniformMatrix4fv_EXT;
+extern PFNGLVERTEXATTRIB4FPROC glVertexAttrib4f_EXT;
+extern PFNGLACTIVETEXTUREPROC glActiveTexture_EXT;
 #else
-#define glCreateProgram_EXT glCreateProgramEXT
-#define glDeleteProgram_EXT glDeleteProgramEXT
-#define glIsProgram_EXT glIsProgramEXT
-#define glCreateShader_EXT glCreateShaderEXT
-#define glDeleteShader_EXT glDeleteShaderEXT
-#define glShaderSource_EXT glShaderSourceEXT
-#define glCompileShader_EXT glCompileShaderEXT
-#define glAttachShader_EXT glAttachShaderEXT
-#define glDetachShader_EXT glDetachShaderEXT
-#define glGetAttachedShaders_EXT glGetAttachedShadersEXT
-#define glLinkProgram_EXT glLinkProgramEXT
-#define glUseProgram_EXT glUseProgramEXT
-#define glGetShaderInfoLog_EXT glGetShaderInfoLogEXT
-#define glGetProgramInfoLog_EXT glGetProgramInfoLogEXT
-#define glGetUniformLocation_EXT glGetUniformLocationEXT
-#define glUniform1f_EXT glUniform1fEXT
-#define glUniform1i_EXT glUniform1iEXT
-#define glUniform2fv_EXT glUniform2fvEXT
-#define glUniform3fv_EXT glUniform3fvEXT
-#define glGenerateMipmap_EXT glGenerateMipmapEXT
-#define glGenFramebuffers_EXT glGenFramebuffersEXT
-#define glDeleteFramebuffers_EXT glDeleteFramebuffersEXT
-#define glBindFramebuffer_EXT glBindFramebufferEXT
-#define glGenRenderbuffers_EXT glGenRenderbuffersEXT
-#define glDeleteRenderbuffers_EXT glDeleteRenderbuffersEXT
-#define glBindRenderbuffer_EXT glBindRenderbufferEXT
-#define glRenderbufferStorage_EXT glRenderbufferStorageEXT
-#define glFramebufferRenderbuffer_EXT glFramebufferRenderbufferEXT
-#define glFramebufferTexture2D_EXT glFramebufferTexture2DEXT
-#define glCheckFramebufferStatus_EXT glCheckFramebufferStatusEXT
-#define glGenBuffersARB_EXT glGenBuffersARBEXT
-#define glBindBufferARB_EXT glBindBufferARBEXT
-#define glBufferDataARB_EXT glBufferDataARBEXT
-#define glDeleteBuffersARB_EXT glDeleteBuffersARBEXT
+#define glCreateProgram_EXT glCreateProgram
+#define glDeleteProgram_EXT glDeleteProgram
+#define glIsProgram_EXT glIsProgram
+#define glCreateShader_EXT glCreateShader
+#define glDeleteShader_EXT glDeleteShader
+#define glShaderSource_EXT glShaderSource
+#define glCompileShader_EXT glCompileShader
+#define glAttachShader_EXT glAttachShader
+#define glDetachShader_EXT glDetachShader
+#define glGetAttachedShaders_EXT glGetAttachedShaders
+#define glLinkProgram_EXT glLinkProgram
+#define glUseProgram_EXT glUseProgram
+#define glGetShaderInfoLog_EXT glGetShaderInfoLog
+#define glGetProgramInfoLog_EXT glGetProgramInfoLog
+#define glGetUniformLocation_EXT glGetUniformLocation
+#define glUniform1f_EXT glUniform1f
+#define glUniform1i_EXT glUniform1i
+#define glUniform2fv_EXT glUniform2fv
+#define glUniform3fv_EXT glUniform3fv
+#define glGenerateMipmap_EXT glGenerateMipmap
+#define glGenFramebuffers_EXT glGenFramebuffers
+#define glDeleteFramebuffers_EXT glDeleteFramebuffers
+#define glBindFramebuffer_EXT glBindFramebuffer
+#define glGenRenderbuffers_EXT glGenRenderbuffers
+#define glDeleteRenderbuffers_EXT glDeleteRenderbuffers
+#define glBindRenderbuffer_EXT glBindRenderbuffer
+#define glRenderbufferStorage_EXT glRenderbufferStorage
+#define glFramebufferRenderbuffer_EXT glFramebufferRenderbuffer
+#define glFramebufferTexture2D_EXT glFramebufferTexture2D
+#define glCheckFramebufferStatus_EXT glCheckFramebufferStatus
+#define glGenBuffersARB_EXT glGenBuffersARB
+#define glBindBufferARB_EXT glBindBufferARB
+#define glBufferDataARB_EXT glBufferDataARB
+#define glDeleteBuffersARB_EXT glDeleteBuffersARB
+#define glGetShaderiv_EXT glGetShaderiv
+#define glGetProgramiv_EXT glGetProgramiv
+#define glGetAttribLocation_EXT glGetAttribLocation
+#define glVertexAttribPointer_EXT glVertexAttribPointer
+#define glEnableVertexAttribArray_EXT glEnableVertexAttribArray
+#define glDisableVertexAttribArray_EXT glDisableVertexAttribArray
+#define glUniform4f_EXT glUniform4f
+#define glVertexAttribDivisor_EXT glVertexAttribDivisor
+#define glDrawArraysInstanced_EXT glDrawArraysInstanced
+#define glBufferSubDataARB_EXT glBufferSubDataARB
+#define glVertexAttrib1f_EXT glVertexAttrib1f
+#define glMapBufferRange_EXT glMapBufferRange
+#define glUnmapBuffer_EXT glUnmapBuffer
+#define glFlushMappedBufferRange_EXT glFlushMappedBufferRange
+#define glBufferStorage_EXT glBufferStorage
+#define glFenceSync_EXT glFenceSync
+#define glClientWaitSync_EXT glClientWaitSync
+#define glDeleteSync_EXT glDeleteSync
+#define glGenVertexArrays_EXT glGenVertexArrays
+#define glBindVertexArray_EXT glBindVertexArray
+#define glDeleteVertexArrays_EXT glDeleteVertexArrays
+#define glUniformMatrix4fv_EXT glUniformMatrix4fv
+#define glVertexAttrib4f_EXT glVertexAttrib4f
+#define glActiveTexture_EXT glActiveTexture
 #endif
 
 extern uint32_t NUMBER_BYTES_PER_VERTICE_2D;
@@ -324,6 +380,64 @@ void blit_fbo(int fbo);
 void blit_fbo_outer(int fbo);
 void blit_fbo_bind(int fbo);
 void blit_fbo_unbind(void);
+void blit_fbo_composite(int fbo, bool inverted);
+void blit_fbo_composite_over(int under, int over, bool inverted);
+void blit_fbo_need(int fbo);
+uint8_t gl_bench_composite(tokensp, void *context);
+
+GLuint gl_program_new(const char *name, const char *vs, const char *fs);
+bool gl_version_at_least(int major, int minor);
+
+//
+// Core profile rendering, asked for with --gl-core. With gl_core set the
+// blit batches draw through a few shaders and vertex array objects, the 2D
+// projection is a uniform, and inversion is done in the composite shader;
+// nothing fixed function is called.
+//
+extern bool gl_core;
+extern bool gl_core_requested;
+
+enum {
+    GL_CORE_UV_XY_RGBA,
+    GL_CORE_UV_XYZ_RGBA,
+    GL_CORE_XY_RGBA,
+    GL_CORE_XY,
+    GL_CORE_LAYOUT_MAX,
+};
+
+bool gl_core_init(void);
+void gl_core_fini(void);
+void gl_core_ortho(float left, float right, float bottom, float top,
+                   float near, float far);
+void gl_core_enter_2_5d(float scale);
+void gl_core_leave_2_5d(void);
+const float *gl_core_projection(void);
+void gl_core_draw(GLenum mode, int layout, const char *base, GLsizei n,
+                  GLuint tex);
+void gl_core_draw_xy(GLenum mode, const float *xy, GLsizei n);
+void gl_core_composite(GLuint tex, GLuint over, bool inverted);
+
+//
+// Where blit batches are written. Client arrays are our memory, copied by
+// the driver on each draw. Orphan maps each batch's range of a buffer
+// object unsynchronised, respecifying the buffer when the range wraps.
+// Persistent maps a three section ring once and fences each section
+// before writing it again. Falls back in that order as the context allows.
+//
+enum {
+    GL_STREAM_CLIENT,
+    GL_STREAM_ORPHAN,
+    GL_STREAM_PERSISTENT,
+    GL_STREAM_MAX,
+};
+
+extern int gl_stream_mode;
+
+void gl_stream_select(int mode);
+bool gl_stream_parse(const char *name);
+const char *gl_stream_name(int mode);
+uint8_t gl_stream_set(tokensp, void *context);
+uint8_t gl_bench_blit(tokensp, void *context);
 
 extern float *gl_array_buf;
 extern float *gl_array_buf_end;
@@ -335,7 +449,9 @@ static inline void glcolor (color s)
 {
     gl_last_color = s;
 
-    glColor4ub(s.r, s.g, s.b, s.a);
+    if (!gl_core) {
+        glColor4ub(s.r, s.g, s.b, s.a);
+    }
 }
 
 /*
@@ -606,6 +722,57 @@ void blit_colored (int tex,
             ((double)color_br.a) / 255.0);
 }
 
+//
+// As above, with the one colour for every corner, already made 0..1.
+//
+static inline
+void blit_colored (int tex,
+                   float texMinX,
+                   float texMinY,
+                   float texMaxX,
+                   float texMaxY,
+                   float left,
+                   float top,
+                   float right,
+                   float bottom,
+                   const float *rgba)
+{
+    uint8_t first;
+
+    if (unlikely(!buf_tex)) {
+        blit_init();
+        first = true;
+    } else if (unlikely(buf_tex != tex)) {
+        blit_flush();
+        first = true;
+    } else {
+        first = false;
+    }
+
+    buf_tex = tex;
+
+    float r = rgba[0];
+    float g = rgba[1];
+    float b = rgba[2];
+    float a = rgba[3];
+
+    gl_push(&bufp,
+            bufp_end,
+            first,
+            texMinX,
+            texMinY,
+            texMaxX,
+            texMaxY,
+            left,
+            top,
+            right,
+            bottom,
+            r, g, b, a,
+            r, g, b, a,
+            r, g, b, a,
+            r, g, b, a);
+}
+
 static inline
 void blit (int tex, float left, float top, float right, float bottom)
 {
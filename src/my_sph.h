@@ -0,0 +1,117 @@
+//
+// Copyright goblinhack@gmail.com
+// See the README file for license info.
+//
+
+#pragma once
+#ifndef _MY_SPH_H_
+#define _MY_SPH_H_
+
+#include "my_game.h"
+
+namespace Constants
+{
+    const int   NUMBER_PARTICLES = 50;
+    const float BOUNCE        = 1.0;
+    const float TIMESTEP      = 0.0001;
+    const float REST_DENSITY  = 10000;
+    const float STIFFNESS     = 1.44e+09;
+    const float VISCOCITY     = 1.44e+09;
+    const float REPULSION     = 800000;
+    const float GRAVITY       = 3e+07;
+    const float PARTICLE_MASS = 2.46914e+07;
+    const float KERNEL_RANGE  = TILE_WIDTH;
+
+    //
+    // Adaptive timestep: fractions of the velocity (CFL), acceleration,
+    // sound speed and viscous diffusion limits, and the range dt may move
+    // in.
+    //
+    const float CFL_VELOCITY  = 0.4;
+    const float CFL_ACOUSTIC  = 0.4;
+    const float CFL_FORCE     = 0.25;
+    const float CFL_VISCOUS   = 0.125;
+    const float TIMESTEP_MIN  = 0.00001;
+    const float TIMESTEP_MAX  = 0.001;
+}
+
+//
+// Size of the simulated area in pixels
+//
+extern float GL_WIDTH;
+extern float GL_HEIGHT;
+
+//
+// Timestep range for the adaptive controller; when it is off every step
+// is TIMESTEP.
+//
+extern bool sph_dt_adaptive;
+extern float sph_dt_min;
+extern float sph_dt_max;
+
+uint8_t sph_dt_set(tokensp, void *context);
+
+//
+// How the force based solvers advance particles each step.
+//
+enum {
+    SPH_INTEGRATOR_EULER,
+    SPH_INTEGRATOR_LEAPFROG,
+    SPH_INTEGRATOR_VERLET,
+    SPH_INTEGRATOR_MAX,
+};
+
+extern int sph_integrator;
+
+//
+// By name, or -1 if there is no such integrator.
+//
+int sph_integrator_find(const char *name);
+const char *sph_integrator_name(int integrator);
+uint8_t sph_integrator_set(tokensp, void *context);
+
+#define FOR_ALL_PARTICLES(p) \
+    auto pidx = 0; \
+    auto p = getptr(game->particles, 0); \
+    auto eop = getptr(game->particles, PARTICLE_MAX - 1); \
+    for (pidx = 0; p != eop; p++, pidx++) { \
+        if (!p->in_use) { \
+            continue; \
+        } \
+
+#define FOR_ALL_PARTICLES_END() }
+
+//
+// sph_brush.cpp
+//
+enum {
+    SPH_BRUSH_PUSH,
+    SPH_BRUSH_PULL,
+    SPH_BRUSH_VORTEX,
+    SPH_BRUSH_DRAIN,
+    SPH_BRUSH_EMIT,
+    SPH_BRUSH_MAX,
+};
+
+void sph_brush_down(uint32_t button);
+void sph_brush_up(void);
+void sph_brush_tick(void);
+bool sph_brush_near(const fpoint &at, float r);
+uint8_t sph_brush_set(tokensp, void *context);
+
+//
+// sph_sleep.cpp
+//
+// Resting fluid is put to sleep a kernel sized cell at a time and skipped
+// by the force and integration passes of the solvers that support it;
+// activity in a neighbouring cell, or the brush, wakes it. Active is the
+// fraction of particles awake after the last step.
+//
+extern bool sph_sleep_enabled;
+extern float sph_sleep_active;
+
+void sph_sleep_update(void);
+void sph_sleep_wake(const fpoint &at, float radius);
+uint8_t sph_sleep_set(tokensp, void *context);
+
+#endif
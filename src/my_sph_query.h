@@ -0,0 +1,83 @@
+//
+// Copyright goblinhack@gmail.com
+// See the README file for license info.
+//
+
+#pragma once
+#ifndef _MY_SPH_QUERY_H_
+#define _MY_SPH_QUERY_H_
+
+#include "my_sph.h"
+
+//
+// A run of particle indices. Points into storage owned by whoever ran the
+// query and is only valid until the next query on that object.
+//
+class ParticleSpan {
+public:
+    ParticleSpan (void) {}
+    ParticleSpan (const uint16_t *b, const uint16_t *e) : b(b), e(e) {}
+
+    const uint16_t *begin (void) const { return (b); }
+    const uint16_t *end (void) const { return (e); }
+    size_t size (void) const { return (e - b); }
+    bool empty (void) const { return (b == e); }
+    uint16_t operator[] (size_t i) const { return (b[i]); }
+
+private:
+    const uint16_t *b {};
+    const uint16_t *e {};
+};
+
+//
+// Results for many probes at once, stored back to back in the order the
+// probes were resolved. Use at(i) to get the hits for probe i.
+//
+#define PARTICLE_BATCH_MAX_PROBES 256
+
+class ParticleBatch {
+public:
+    ParticleSpan at (int probe) const {
+        auto b = indices.data() + start[probe];
+        return (ParticleSpan(b, b + count[probe]));
+    }
+
+    int probes {};
+
+    //
+    // Set if the shared index store ran out; later probes are short.
+    //
+    bool truncated {};
+
+    std::array<uint32_t, PARTICLE_BATCH_MAX_PROBES> start {};
+    std::array<uint32_t, PARTICLE_BATCH_MAX_PROBES> count {};
+    std::array<uint16_t, PARTICLE_MAX * 4> indices {};
+};
+
+//
+// Spatial queries over the particle grid. Each object owns a fixed result
+// buffer so queries never allocate; keep one per consumer (or per thread)
+// and reuse it.
+//
+class ParticleQuery {
+public:
+    ParticleSpan radius(fpoint at, float r);
+    ParticleSpan aabb(fpoint tl, fpoint br);
+    ParticleSpan nearest(fpoint at, int k, float max_r);
+
+    void radius_batch(const fpoint *at, int n, float r, ParticleBatch *out);
+    void aabb_batch(const fpoint *tl, const fpoint *br, int n,
+                    ParticleBatch *out);
+
+private:
+    template<typename F> void batch(int n, const fpoint *key,
+                                    ParticleBatch *out, F query);
+
+    std::array<uint16_t, PARTICLE_MAX> result;
+    std::array<float, PARTICLE_MAX> dist2;
+    std::array<uint16_t, PARTICLE_BATCH_MAX_PROBES> order;
+};
+
+uint8_t sph_bench_query(tokensp, void *context);
+
+#endif
@@ -0,0 +1,52 @@
+//
+// Copyright goblinhack@gmail.com
+// See the README file for license info.
+//
+
+#pragma once
+#ifndef _MY_SPH_RENDER_H_
+#define _MY_SPH_RENDER_H_
+
+#include "my_sph.h"
+
+//
+// How particles are drawn into FBO_MAP. Sprites go through the tile
+// batcher, six vertices of uv, xy and rgba floats each. Instanced uploads
+// each particle's position, 8 bytes, plus its size only while sizes differ,
+// and draws every particle as an instance of one quad with a single call.
+// Without instancing this falls back to sprites. Parallel builds the same
+// vertices as sprites on the thread pool, each chunk of particles into its
+// own slice of one buffer, and draws them with a single call. Density
+// splats the particles into a coarse field on the thread pool, uploads it
+// as one texture and shades it over the whole map in one draw, so costs
+// what the map's size does rather than the particle count.
+//
+enum {
+    SPH_RENDER_SPRITES,
+    SPH_RENDER_INSTANCED,
+    SPH_RENDER_PARALLEL,
+    SPH_RENDER_DENSITY,
+    SPH_RENDER_MAX,
+};
+
+extern int sph_render_mode;
+
+//
+// From this many particles they are drawn as density whatever the mode,
+// until they drop below the second count; 0 never switches. The gap
+// keeps a count hovering at the first from flipping the look each frame.
+//
+#define SPH_RENDER_DENSITY_FROM  4000
+#define SPH_RENDER_DENSITY_UNTIL 3500
+
+extern int sph_render_density_from;
+extern int sph_render_density_until;
+
+void sph_render(void);
+bool sph_render_parse(const char *name);
+const char *sph_render_name(int mode);
+uint8_t sph_render_set(tokensp, void *context);
+uint8_t sph_render_density_set(tokensp, void *context);
+uint8_t sph_bench_render(tokensp, void *context);
+
+#endif
@@ -0,0 +1,55 @@
+//
+// Copyright goblinhack@gmail.com
+// See the README file for license info.
+//
+
+#pragma once
+#ifndef _MY_SPH_SDF_H_
+#define _MY_SPH_SDF_H_
+
+#include "my_sph.h"
+
+//
+// Static obstacles, from an image mask stretched over the window. Kept as
+// a signed distance field in pixels, positive in free space and negative
+// inside obstacles, with the outward normal stored beside each distance
+// so one bilinear fetch gives both.
+//
+extern bool sph_sdf_loaded;
+extern std::string sph_sdf_file;
+
+bool sph_sdf_load(const std::string &file);
+void sph_sdf_render(void);
+
+//
+// True if this point is inside an obstacle.
+//
+bool sph_sdf_inside(const fpoint &at);
+
+//
+// Signed distance to the nearest obstacle surface, and its outward normal.
+//
+float sph_sdf_distance(const fpoint &at, fpoint *normal);
+
+//
+// Push a point out of any obstacle it is in, and if a velocity is given
+// turn back this fraction of it off the surface, as the solver does at
+// the walls.
+//
+void sph_sdf_push(fpoint &at, fpoint *velocity, float bounce);
+
+//
+// Called for every particle move. With no obstacles loaded this is one
+// test of a global.
+//
+static inline void sph_sdf_collide (fpoint &at, fpoint *velocity,
+                                    float bounce)
+{
+    if (likely(!sph_sdf_loaded)) {
+        return;
+    }
+
+    sph_sdf_push(at, velocity, bounce);
+}
+
+#endif
@@ -0,0 +1,557 @@
+//
+// Copyright goblinhack@gmail.com
+// See the README file for license info.
+//
+
+#pragma once
+#ifndef _MY_SPH_SOLVER_H_
+#define _MY_SPH_SOLVER_H_
+
+#include "my_sph.h"
+#include "my_sph_query.h"
+#include "my_sph_sort.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#ifndef M_PI
+#define M_PI    3.14159265358979323846f
+#endif
+
+static const int GL_BORDER = 100;
+static const float NEB_RADIUS = 8;
+
+//
+// Particle spacing the incompressible solvers settle at. REST_DENSITY is
+// tuned for the weakly compressible solver, where it is barely more than
+// a lone particle's own density; they take rest density from a lattice at
+// this spacing instead.
+//
+static const float REST_SPACING = Constants::KERNEL_RANGE / 2;
+
+//
+// Periodic boundaries. A periodic axis has no walls: the space between
+// where they were wraps, so a particle leaving one side comes back in at
+// the other. Only the integrator wraps positions. Neighbour searches wrap
+// cells instead, by also searching around a particle's image on the far
+// side when it is near the seam, so no particle is ever copied. Pair
+// separations across the seam are taken to the nearest image.
+//
+extern bool sph_periodic_x;
+extern bool sph_periodic_y;
+
+bool sph_periodic_parse(const char *axes);
+uint8_t sph_periodic_set(tokensp, void *context);
+
+static inline float sph_periodic_period_x (void)
+{
+    return (GL_WIDTH - GL_BORDER * 2);
+}
+
+static inline float sph_periodic_period_y (void)
+{
+    return (GL_HEIGHT - GL_BORDER * 2);
+}
+
+static inline fpoint sph_periodic_delta (fpoint d)
+{
+    if (likely(!sph_periodic_x && !sph_periodic_y)) {
+        return (d);
+    }
+
+    if (sph_periodic_x) {
+        float w = sph_periodic_period_x();
+        if (d.x > w / 2) {
+            d.x -= w;
+        } else if (d.x < -w / 2) {
+            d.x += w;
+        }
+    }
+
+    if (sph_periodic_y) {
+        float h = sph_periodic_period_y();
+        if (d.y > h / 2) {
+            d.y -= h;
+        } else if (d.y < -h / 2) {
+            d.y += h;
+        }
+    }
+
+    return (d);
+}
+
+//
+// Where this point and its images within reach of it would be searched
+// from; the point itself is always first. Returns how many, up to 4.
+//
+static inline int sph_periodic_images (const fpoint &at, float reach,
+                                       fpoint *image)
+{
+    image[0] = at;
+    if (likely(!sph_periodic_x && !sph_periodic_y)) {
+        return (1);
+    }
+
+    float sx = 0, sy = 0;
+
+    if (sph_periodic_x) {
+        if (at.x - GL_BORDER < reach) {
+            sx = sph_periodic_period_x();
+        } else if (GL_WIDTH - GL_BORDER - at.x < reach) {
+            sx = -sph_periodic_period_x();
+        }
+    }
+
+    if (sph_periodic_y) {
+        if (at.y - GL_BORDER < reach) {
+            sy = sph_periodic_period_y();
+        } else if (GL_HEIGHT - GL_BORDER - at.y < reach) {
+            sy = -sph_periodic_period_y();
+        }
+    }
+
+    int n = 1;
+    if (sx != 0) {
+        image[n++] = at + fpoint(sx, 0);
+    }
+    if (sy != 0) {
+        image[n++] = at + fpoint(0, sy);
+    }
+    if ((sx != 0) && (sy != 0)) {
+        image[n++] = at + fpoint(sx, sy);
+    }
+    return (n);
+}
+
+//
+// Move a point that has left through a periodic side back in at the other.
+//
+static inline fpoint sph_periodic_wrap (fpoint at)
+{
+    if (likely(!sph_periodic_x && !sph_periodic_y)) {
+        return (at);
+    }
+
+    if (sph_periodic_x) {
+        float w = sph_periodic_period_x();
+        if (at.x < GL_BORDER) {
+            at.x += w;
+        } else if (at.x >= GL_WIDTH - GL_BORDER) {
+            at.x -= w;
+        }
+    }
+
+    if (sph_periodic_y) {
+        float h = sph_periodic_period_y();
+        if (at.y < GL_BORDER) {
+            at.y += h;
+        } else if (at.y >= GL_HEIGHT - GL_BORDER) {
+            at.y -= h;
+        }
+    }
+
+    return (at);
+}
+
+//
+// Keep a point inside the walls, wrapping it on periodic axes.
+//
+static inline fpoint sph_wall_clamp (fpoint at)
+{
+    at = sph_periodic_wrap(at);
+    at.x = std::min(std::max(at.x, (float) GL_BORDER), GL_WIDTH - GL_BORDER);
+    at.y = std::min(std::max(at.y, (float) GL_BORDER), GL_HEIGHT - GL_BORDER);
+    return (at);
+}
+
+//
+// Runs of candidate neighbour ids around a point, for one grid level. The
+// slot grid gives one run per column of cells, empty slots and all. The
+// sorted list gives one run per row of cells for every level at once, with
+// each particle's slot grid cell alongside, and candidates are kept to the
+// same box of cells the slot grid would have walked, so both backends find
+// the same neighbours.
+//
+#define SPH_NEB_RUNS_MAX 32
+
+typedef struct {
+    int n;
+    const uint16_t *ids[SPH_NEB_RUNS_MAX];
+    const SphSortCell *cells[SPH_NEB_RUNS_MAX];
+    int len[SPH_NEB_RUNS_MAX];
+    spoint box_at[PARTICLE_LEVELS];
+    int box_r[PARTICLE_LEVELS];
+} SphNebRuns;
+
+//
+// Each grid level is searched as far as the largest particles it can hold
+// could reach, in that level's cells, so a standard particle walks the
+// same cells whatever else is in the fluid.
+//
+static inline int sph_neb_box (const Particle *p, int lvl)
+{
+    int r = NEB_RADIUS * (p->h + Constants::KERNEL_RANGE * (1 << lvl)) /
+            (2 * Constants::KERNEL_RANGE * (1 << lvl));
+    return (std::min(r, (SPH_NEB_RUNS_MAX - 1) / 2));
+}
+
+static inline void sph_neb_runs (const Particle *p, const fpoint &at,
+                                 int lvl, SphNebRuns *runs)
+{
+    runs->n = 0;
+
+    if (sph_search == SPH_SEARCH_SORT) {
+        if (lvl) {
+            return;
+        }
+
+        fpoint cell = grid_cell_size();
+        fpoint reach(0, 0);
+        for (auto l = 0; l < PARTICLE_LEVELS; l++) {
+            runs->box_at[l] = point_to_grid(at, l);
+            runs->box_r[l] = sph_neb_box(p, l);
+            if (l && (sph_sort_h_max <= Constants::KERNEL_RANGE)) {
+                continue;
+            }
+            float cells = (runs->box_r[l] + 1) * (1 << l);
+            reach.x = std::max(reach.x, cells * cell.x);
+            reach.y = std::max(reach.y, cells * cell.y);
+        }
+
+        int x0 = sph_sort_cell_x(at.x - reach.x);
+        int x1 = sph_sort_cell_x(at.x + reach.x);
+        int y0 = sph_sort_cell_y(at.y - reach.y);
+        int y1 = std::min(sph_sort_cell_y(at.y + reach.y),
+                          y0 + SPH_NEB_RUNS_MAX - 1);
+
+        for (auto y = y0; y <= y1; y++) {
+            uint32_t len;
+            auto b = sph_sort_row(y, x0, x1, &len);
+            runs->ids[runs->n] = sph_sort_ids.data() + b;
+            runs->cells[runs->n] = sph_sort_cells.data() + b;
+            runs->len[runs->n] = len;
+            runs->n++;
+        }
+        return;
+    }
+
+    if (lvl && !game->num_coarse_particles) {
+        return;
+    }
+
+    auto sp = point_to_grid(at, lvl);
+    int r = sph_neb_box(p, lvl);
+
+    for (int ox = sp.x - r; ox <= sp.x + r; ox++) {
+        runs->ids[runs->n] = game->particle_ids_at(lvl, ox, sp.y - r);
+        runs->cells[runs->n] = nullptr;
+        runs->len[runs->n] = (2 * r + 1) * PARTICLE_SLOTS;
+        runs->n++;
+    }
+}
+
+static inline bool sph_neb_in_box (const SphNebRuns *runs,
+                                   const SphSortCell &c)
+{
+    auto &at = runs->box_at[c.level];
+    int r = runs->box_r[c.level];
+    return ((abs(c.x - at.x) <= r) && (abs(c.y - at.y) <= r));
+}
+
+//
+// Pairs interact over the mean of their smoothing lengths, hpq. d is the
+// separation to the nearest image of q.
+//
+#define FOR_ALL_NEBS(p, q) \
+    fpoint neb_image[4]; \
+    int neb_images = sph_periodic_images(p->at, \
+                                         p->h + Constants::KERNEL_RANGE, \
+                                         neb_image); \
+    SphNebRuns neb_runs; \
+    for (int img = 0; img < neb_images; img++) { \
+    for (int lvl = 0; lvl < PARTICLE_LEVELS; lvl++) { \
+        sph_neb_runs(p, neb_image[img], lvl, &neb_runs); \
+        for (int neb_run = 0; neb_run < neb_runs.n; neb_run++) { \
+            auto neb_ids = neb_runs.ids[neb_run]; \
+            auto neb_cells = neb_runs.cells[neb_run]; \
+            for (int neb_i = 0; neb_i < neb_runs.len[neb_run]; neb_i++) { \
+                auto qidx = neb_ids[neb_i]; \
+                if (likely(!qidx)) { \
+                    continue; \
+                } \
+ \
+                auto q = getptr(game->particles, qidx); \
+                if (neb_cells && \
+                    (!sph_neb_in_box(&neb_runs, neb_cells[neb_i]) || \
+                     !q->in_use)) { \
+                    continue; \
+                } \
+ \
+                fpoint d = neb_image[img] - q->at; \
+                float dist = d.x * d.x + d.y * d.y; \
+                float hpq = 0.5f * (p->h + q->h); \
+                if (dist > hpq * hpq) { \
+                    continue; \
+                } \
+
+#define FOR_ALL_NEBS_END() } } } }
+
+// Poly6 Kernel
+static inline float sph_kernel (fpoint x, float h)
+{
+    float r2 = x.x * x.x + x.y * x.y;
+    float h2 = h * h;
+
+    if (r2 < 0 || r2 > h2) return 0.0f;
+
+    return 315.0f / (64.0f * M_PI * pow(h, 9)) * pow(h2 - r2, 3);
+}
+
+// Gradient of Poly6 Kernel
+static inline fpoint sph_grad_kernel_poly6 (fpoint x, float h)
+{
+    float r2 = x.x * x.x + x.y * x.y;
+    float h2 = h * h;
+
+    if (r2 > h2) return fpoint(0.0f, 0.0f);
+
+    return x * (-6.0f * 315.0f / (64.0f * M_PI * pow(h, 9)) * pow(h2 - r2, 2));
+}
+
+// Gradient of Spiky Kernel
+static inline fpoint sph_grad_kernel (fpoint x, float h)
+{
+    float r = sqrt(x.x * x.x + x.y * x.y);
+    if (r == 0.0f) return fpoint(0.0f, 0.0f);
+
+    float t1 = -45.0f / (M_PI * pow(h, 6));
+    fpoint t2 = x / r;
+    float t3 = pow(h - r, 2);
+
+    return t2 * t1 * t3;
+}
+
+// Laplacian of Viscosity Kernel
+static inline float sph_laplace_kernel (fpoint x, float h)
+{
+    float r = sqrt(x.x * x.x + x.y * x.y);
+    return 45.0f / (M_PI * pow(h, 6)) * (h - r);
+}
+
+//
+// The kernels above carry their 3D normalisation, so in the plane the
+// weight a particle spreads falls off as 1/h. These scale that back to a
+// standard particle's, so merging or splitting particles keeps the mass
+// seen by their neighbours; the derivatives take the same factor. At
+// KERNEL_RANGE they are the plain kernels.
+//
+static inline float sph_kernel_h (fpoint x, float h)
+{
+    return (sph_kernel(x, h) * (h / Constants::KERNEL_RANGE));
+}
+
+static inline fpoint sph_grad_kernel_h (fpoint x, float h)
+{
+    return (sph_grad_kernel(x, h) * (h / Constants::KERNEL_RANGE));
+}
+
+static inline float sph_laplace_kernel_h (fpoint x, float h)
+{
+    return (sph_laplace_kernel(x, h) * (h / Constants::KERNEL_RANGE));
+}
+
+//
+// Neighbours of every particle within a radius, found once from the grid
+// and kept in one flat list so iterative solvers can revisit them cheaply.
+//
+class SPHNeighbours {
+public:
+    void find(float radius);
+
+    ParticleQuery query;
+    std::array<uint32_t, PARTICLE_MAX> start {};
+    std::array<uint32_t, PARTICLE_MAX> count {};
+    std::vector<uint16_t> list;
+};
+
+#define FOR_ALL_CACHED_NEBS(nebs, pidx, qidx) \
+    auto neb_end = (nebs).start[pidx] + (nebs).count[pidx]; \
+    for (auto n = (nebs).start[pidx]; n < neb_end; n++) { \
+        auto qidx = (nebs).list[n]; \
+
+#define FOR_ALL_CACHED_NEBS_END() }
+
+//
+// Density of a particle in a square lattice of the given spacing, and the
+// gradient sums needed to scale a pressure or constraint solve for it.
+//
+float sph_lattice_density(float spacing, float *grad_sum2, float *grad2_sum);
+
+//
+// Static boundary samples along the walls and obstacle surfaces (Akinci
+// et al.). They never move, so their summed kernel contributions are
+// baked once into a lookup grid and the fluid passes fetch those rather
+// than visit the samples. The pressure response mirrors the fluid
+// particle's own pressure onto the wall.
+//
+typedef struct {
+    float density;
+    fpoint grad;
+    fpoint grad_poly6;
+} SphBoundarySample;
+
+extern bool sph_boundary_enabled;
+
+//
+// The samples are scaled so a particle resting on a flat wall is at the
+// given rest density; build again for a solver that settles at another.
+//
+void sph_boundary_build(float rest_density);
+void sph_boundary_update(float rest_density);
+SphBoundarySample sph_boundary_sample(const fpoint &at);
+uint8_t sph_boundary_set(tokensp, void *context);
+
+//
+// Adaptive resolution for the weakly compressible solver. Particles deep
+// in the fluid merge in pairs into heavier ones with a longer smoothing
+// length, and split again near the free surface or the mouse; mass,
+// centre of mass and momentum are kept either way.
+//
+extern bool sph_adapt_enabled;
+
+void sph_adapt_update(void);
+uint8_t sph_adapt_set(tokensp, void *context);
+
+//
+// One split and merge pass now; returns how many particles changed.
+//
+int sph_adapt_pass(void);
+
+static inline bool sph_boundary_lookup (const fpoint &at,
+                                        SphBoundarySample *out)
+{
+    if (likely(!sph_boundary_enabled)) {
+        return (false);
+    }
+
+    *out = sph_boundary_sample(at);
+    return (true);
+}
+
+//
+// Common interface for the pressure solvers. Each owns how forces are
+// found; they share the particle grid, kernels, integration and walls.
+//
+class SPHSolver {
+public:
+    virtual ~SPHSolver (void) {}
+
+    virtual const char *name(void) const = 0;
+    virtual float choose_dt(void);
+    virtual void update(float dt) = 0;
+
+    //
+    // One update, counted into the totals below.
+    //
+    void step(float dt);
+
+    //
+    // Initial particles; solvers with a rest spacing lay them out on it.
+    //
+    virtual void seed(void);
+
+    //
+    // Pressure iterations and worst relative density error of the last
+    // step; iterative solvers fill these in.
+    //
+    int iterations {};
+    float density_error {};
+
+    //
+    // Substeps the last step was split into; 1 for solvers that do not.
+    //
+    int substeps { 1 };
+
+    //
+    // Density the fluid rests at, as measured with the standard kernel;
+    // the boundary samples are scaled to it.
+    //
+    float wall_density { Constants::REST_DENSITY };
+
+    //
+    // Steps taken and time simulated since the solver was made.
+    //
+    uint64_t steps {};
+    double sim_time {};
+
+protected:
+    float limit_dt(float v2, float a2);
+    void seed_lattice(float spacing);
+    void integrationStep(float dt);
+
+    //
+    // Largest squared velocity and acceleration seen by the last
+    // integration step; these drive the next choice of dt.
+    //
+    float max_v2 {};
+    float max_a2 {};
+    bool have_limits {};
+
+    //
+    // Speed pressure waves travel at, for solvers where pressure comes from
+    // an equation of state; 0 for the incompressible ones.
+    //
+    float sound_speed {};
+
+    //
+    // Fraction of the velocity into a wall that is turned back off it.
+    //
+    float bounce { Constants::BOUNCE };
+
+    //
+    // Last step taken; the symplectic integrators finish its velocity
+    // update at the start of the next.
+    //
+    float dt_prev {};
+
+    //
+    // Set by solvers that keep particle sleep state current; the shared
+    // integration step then leaves sleeping particles where they are.
+    //
+    bool sleeps {};
+};
+
+//
+// Solver picked at startup; one of the names below.
+//
+extern std::string sph_solver_name;
+
+//
+// Position based fluids: constraint iterations per substep, fewest
+// substeps per step, and the largest step it will take.
+//
+extern int sph_pbf_iterations;
+extern int sph_pbf_substeps;
+extern float sph_pbf_dt;
+
+SPHSolver *sph_solver_new_wcsph(void);
+SPHSolver *sph_solver_new_pcisph(void);
+SPHSolver *sph_solver_new_pbf(void);
+SPHSolver *sph_solver_new_flip(void);
+
+//
+// By name, or nullptr if there is no such solver.
+//
+SPHSolver *sph_solver_new(const std::string &name);
+
+//
+// The solver running the game's fluid, once sph_init has made it.
+//
+SPHSolver *sph_solver_current(void);
+
+uint8_t sph_bench_solvers(tokensp, void *context);
+uint8_t sph_bench_adapt(tokensp, void *context);
+uint8_t sph_bench_sleep(tokensp, void *context);
+
+#endif
@@ -0,0 +1,142 @@
+//
+// Copyright goblinhack@gmail.com
+// See the README file for license info.
+//
+
+#pragma once
+#ifndef _MY_SPH_SORT_H_
+#define _MY_SPH_SORT_H_
+
+#include "my_sph.h"
+
+#include <algorithm>
+#include <vector>
+
+//
+// Neighbour search backends. The slot grid is kept up to date as each
+// particle moves. The sorted backend leaves it alone and instead, once a
+// step, sorts every particle by a cell key and notes where each cell's run
+// of particles starts. Keys number the cells along rows, so a row of
+// neighbouring cells is one contiguous run.
+//
+enum {
+    SPH_SEARCH_SLOTS,
+    SPH_SEARCH_SORT,
+    SPH_SEARCH_MAX,
+};
+
+extern int sph_search;
+
+//
+// Also move the particles themselves into sorted order at the start of a
+// weakly compressible step, so neighbours sit together in memory. No other
+// solver holds per particle state across that point.
+//
+extern bool sph_sort_permute;
+
+//
+// Set whenever a particle is added, removed or moved; the list is only
+// rebuilt when asked for and this is set.
+//
+extern bool sph_sort_dirty;
+
+//
+// Each sorted particle's slot grid cell, in the coordinates of the level it
+// would be attached to, so searches can keep to the same cells the slot
+// grid would have walked.
+//
+typedef struct {
+    int16_t x;
+    int16_t y;
+    uint8_t level;
+} SphSortCell;
+
+extern std::vector<uint16_t> sph_sort_ids;
+extern std::vector<SphSortCell> sph_sort_cells;
+extern std::vector<uint32_t> sph_sort_cell_start;
+extern int sph_sort_cells_w;
+extern int sph_sort_cells_h;
+extern float sph_sort_cell;
+
+//
+// Longest smoothing length of any sorted particle.
+//
+extern float sph_sort_h_max;
+
+//
+// Time the last build took, in microseconds.
+//
+extern double sph_sort_build_us;
+
+void sph_sort_build(bool permute);
+
+static inline void sph_sort_update (bool permute)
+{
+    if ((sph_search != SPH_SEARCH_SORT) || !sph_sort_dirty) {
+        return;
+    }
+
+    sph_sort_build(permute);
+}
+
+static inline int sph_sort_cell_x (float x)
+{
+    return (std::min(std::max((int) (x / sph_sort_cell), 0),
+                     sph_sort_cells_w - 1));
+}
+
+static inline int sph_sort_cell_y (float y)
+{
+    return (std::min(std::max((int) (y / sph_sort_cell), 0),
+                     sph_sort_cells_h - 1));
+}
+
+//
+// Where the particles in cells x0 to x1 of row y start in the sorted list,
+// and how many there are.
+//
+static inline uint32_t sph_sort_row (int y, int x0, int x1, uint32_t *len)
+{
+    auto row = sph_sort_cell_start.data() + y * sph_sort_cells_w;
+    *len = row[x1 + 1] - row[x0];
+    return (row[x0]);
+}
+
+//
+// Call fn(idx) for every sorted particle in cells touching the box. The
+// list may be a step old, so particles added since are missed and removed
+// ones skipped here.
+//
+template<typename F>
+static inline void sph_sort_walk (fpoint tl, fpoint br, F fn)
+{
+    if (sph_sort_cell_start.empty()) {
+        return;
+    }
+
+    int x0 = sph_sort_cell_x(tl.x), x1 = sph_sort_cell_x(br.x);
+    int y0 = sph_sort_cell_y(tl.y), y1 = sph_sort_cell_y(br.y);
+
+    for (auto y = y0; y <= y1; y++) {
+        uint32_t len;
+        auto b = sph_sort_row(y, x0, x1, &len);
+        for (auto i = b; i < b + len; i++) {
+            auto idx = sph_sort_ids[i];
+            if (unlikely(!getptr(game->particles, idx)->in_use)) {
+                continue;
+            }
+            fn(idx);
+        }
+    }
+}
+
+//
+// Switching back to the slot grid rebuilds it from scratch.
+//
+void sph_search_select(int search);
+bool sph_search_parse(const char *name);
+const char *sph_search_name(int search);
+uint8_t sph_search_set(tokensp, void *context);
+uint8_t sph_bench_search(tokensp, void *context);
+
+#endif
@@ -0,0 +1,36 @@
+//
+// Copyright goblinhack@gmail.com
+// See the README file for license info.
+//
+
+#pragma once
+#ifndef _MY_SPH_STATS_H_
+#define _MY_SPH_STATS_H_
+
+#include "my_sph.h"
+
+//
+// Diagnostics are sampled every this many solver steps; 0 is off.
+//
+extern int sph_stats_every;
+extern std::string sph_stats_file;
+
+void sph_stats_sample(uint64_t step, double sim_time, float dt);
+void sph_stats_set_every(int every);
+uint8_t sph_stats_set(tokensp, void *context);
+
+//
+// Called after every solver step with the solver's own step count and
+// simulated time. When disabled this is one test of a global so it can
+// stay in the hot loop.
+//
+static inline void sph_stats_tick (uint64_t step, double sim_time, float dt)
+{
+    if (likely(!sph_stats_every)) {
+        return;
+    }
+
+    sph_stats_sample(step, sim_time, dt);
+}
+
+#endif
@@ -9,6 +9,7 @@
 
 #include <SDL.h>
 #include <memory>
+#include <vector>
 
 typedef class Tex * Texp;
 
@@ -16,6 +17,8 @@ uint8_t tex_init(void);
 void tex_fini(void);
 void tex_free(Texp tex);
 Texp tex_load(std::string file, std::string name, int mode);
+bool tex_load_mask(std::string file, std::vector<uint8_t> &mask,
+                   int32_t *w, int32_t *h);
 Texp tex_find(std::string name);
 Texp tex_from_surface(SDL_Surface *surface,
                       std::string file,
@@ -0,0 +1,61 @@
+//
+// Copyright goblinhack@gmail.com
+// See the README file for license info.
+//
+
+#pragma once
+#ifndef _MY_THREAD_POOL_H_
+#define _MY_THREAD_POOL_H_
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//
+// A fixed set of worker threads for splitting loops over the particle
+// arrays. The calling thread always takes a share of the work, so a pool
+// of size 1 has no worker threads at all and just runs inline.
+//
+class ThreadPool {
+public:
+    typedef std::function<void(int begin, int end, int chunk)> range_fn;
+
+    ThreadPool(int size);
+    ~ThreadPool();
+
+    //
+    // Number of chunks parallel_for splits work into. Use this to size any
+    // per-chunk partial results.
+    //
+    int size (void) const { return (threads.size() + 1); }
+
+    //
+    // Split [0, n) into size() contiguous chunks and call fn on each.
+    // Returns once every chunk is done. Not reentrant.
+    //
+    void parallel_for(int n, const range_fn &fn);
+
+private:
+    void worker(int chunk);
+    void run_chunk(int chunk);
+
+    std::vector<std::thread> threads;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable done;
+
+    const range_fn *job {};
+    int job_n {};
+    int pending {};
+    unsigned generation {};
+    bool quit {};
+};
+
+//
+// Shared pool sized to the machine; created on first use.
+//
+ThreadPool *thread_pool(void);
+
+#endif
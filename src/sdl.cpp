@@ -272,6 +272,14 @@ uint8_t sdl_init (void)
         }
     }
 
+    if (gl_core_requested) {
+        LOG("INIT: SDL_GL_CONTEXT_PROFILE_CORE 3.3");
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
+        SDL_GL_SetAttribute(SDL_GL_CONTEXT_PROFILE_MASK,
+                            SDL_GL_CONTEXT_PROFILE_CORE);
+    }
+
     LOG("INIT: SDL_CreateWindow");
     window = SDL_CreateWindow("sph_sdl",
                               SDL_WINDOWPOS_CENTERED,
@@ -305,6 +313,24 @@ uint8_t sdl_init (void)
 
     context = SDL_GL_CreateContext(window);
 
+    if (gl_core_requested) {
+        if (context) {
+            gl_core = true;
+        } else {
+            //
+            // Not every driver will give us a core context; carry on with
+            // what it will give us.
+            //
+            CON("INIT: No OpenGL 3.3 core profile (%s), using compatibility",
+                SDL_GetError());
+            SDL_ClearError();
+            SDL_GL_ResetAttributes();
+            SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
+            SDL_GL_SetAttribute(SDL_GL_ACCELERATED_VISUAL, 1);
+            context = SDL_GL_CreateContext(window);
+        }
+    }
+
     if (!context) {
         SDL_MSG_BOX("SDL_GL_CreateContext failed %s", SDL_GetError());
         SDL_ClearError();
@@ -323,7 +349,7 @@ uint8_t sdl_init (void)
     SDL_Delay(400); // avoids white flash on startup!
     glClear(GL_COLOR_BUFFER_BIT |
             GL_DEPTH_BUFFER_BIT |
-            GL_ACCUM_BUFFER_BIT |
+            (gl_core ? 0 : GL_ACCUM_BUFFER_BIT) |
             GL_STENCIL_BUFFER_BIT);
 
     config_gfx_update();
@@ -1008,7 +1034,9 @@ void sdl_loop (void)
     sdl_mouse_center();
     SDL_SetEventFilter(sdl_filter_events, 0);
 
-    glEnable(GL_TEXTURE_2D);
+    if (!gl_core) {
+        glEnable(GL_TEXTURE_2D);
+    }
 
     //
     // Wait for events
@@ -1113,27 +1141,7 @@ void sdl_loop (void)
             wid_display_all();
         }
 
-        blit_fbo_bind(FBO_FINAL);
-        glClear(GL_COLOR_BUFFER_BIT);
-        glcolor(WHITE);
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_COLOR);
-        glBlendFunc(GL_ONE, GL_ZERO);
-        blit_fbo_outer(FBO_MAP);
-
-        glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-        blit_fbo_outer(FBO_WID);
-        blit_fbo_unbind();
-
-        glBlendFunc(GL_ONE, GL_ZERO);
-        if (game->config.gfx_inverted) {
-            glLogicOp(GL_COPY_INVERTED);
-            glEnable(GL_COLOR_LOGIC_OP);
-        }
-        blit_fbo_outer(FBO_FINAL);
-        if (game->config.gfx_inverted) {
-            glLogicOp(GL_COPY);
-            glDisable(GL_COLOR_LOGIC_OP);
-        }
+        blit_fbo_composite_over(FBO_MAP, FBO_WID, game->config.gfx_inverted);
 
         //
         // FPS counter.
@@ -1229,18 +1237,12 @@ static void sdl_screenshot_ (void)
 
 void sdl_flush_display (void)
 {
-    glEnable(GL_TEXTURE_2D);
+    if (!gl_core) {
+        glEnable(GL_TEXTURE_2D);
+    }
     gl_enter_2d_mode();
     wid_display_all();
-    if (game->config.gfx_inverted) {
-        glLogicOp(GL_COPY_INVERTED);
-        glEnable(GL_COLOR_LOGIC_OP);
-    }
-    blit_fbo(FBO_WID);
-    if (game->config.gfx_inverted) {
-        glLogicOp(GL_COPY);
-        glDisable(GL_COLOR_LOGIC_OP);
-    }
+    blit_fbo_composite(FBO_WID, game->config.gfx_inverted);
     SDL_GL_SwapWindow(window);
 }
 
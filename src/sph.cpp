@@ -1,20 +1,23 @@
 #include "my_game.h"
 #include "my_main.h"
+#include "my_sph_solver.h"
+#include "my_sph_render.h"
+#include "my_sph_sdf.h"
+#include "my_sph_stats.h"
+#include "my_thread_pool.h"
 #include "my_gl.h"
 #include "my_tile.h"
 #include "my_point.h"
 
 #include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <cmath>
+#include <memory>
 #include <vector>
 
 using namespace std;
 
-#ifndef M_PI
-#define M_PI    3.14159265358979323846f
-#endif
-
 typedef struct {
 public:
     float left;   ///< Left coordinate of the rectangle
@@ -23,27 +26,34 @@ public:
     float height; ///< Height of the rectangle
 } FloatRect;
 
-static float GL_WIDTH;
-static float GL_HEIGHT;
+float GL_WIDTH;
+float GL_HEIGHT;
+
+bool sph_dt_adaptive = true;
+float sph_dt_min = Constants::TIMESTEP_MIN;
+float sph_dt_max = Constants::TIMESTEP_MAX;
+int sph_integrator = SPH_INTEGRATOR_EULER;
+bool sph_periodic_x;
+bool sph_periodic_y;
+
+static const char *sph_integrator_names[] = {
+    "euler", "leapfrog", "verlet",
+};
 
-static const int GL_BORDER = 100;
 static const int GRID_BORDER = 50;
-static const float NEB_RADIUS = 8;
 
-namespace Constants
+std::string sph_solver_name = "wcsph";
+
+using namespace Constants;
+
+//
+// PBF takes velocity from how far particles were moved and FLIP from its
+// grid, so neither steps with the integrator.
+//
+static bool sph_solver_integrates (void)
 {
-    const int   NUMBER_PARTICLES = 50;
-    const float BOUNCE        = 1.0;
-    const float TIMESTEP      = 0.0001;
-    const float REST_DENSITY  = 10000;
-    const float STIFFNESS     = 1.44e+09;
-    const float VISCOCITY     = 1.44e+09;
-    const float REPULSION     = 800000;
-    const float GRAVITY       = 3e+07;
-    const float PARTICLE_MASS = 2.46914e+07;
-    const float KERNEL_RANGE  = TILE_WIDTH;
+    return ((sph_solver_name != "pbf") && (sph_solver_name != "flip"));
 }
-using namespace Constants;
 
 typedef std::vector<int> Cell;
 
@@ -65,11 +75,31 @@ spoint point_to_grid (const fpoint &p)
                   ((p.y / GL_HEIGHT) * (PARTICLES_HEIGHT - (GRID_BORDER * 2))) + GRID_BORDER);
 }
 
+spoint point_to_grid (const fpoint &p, int level)
+{
+    auto sp = point_to_grid(p);
+    return spoint(sp.x >> level, sp.y >> level);
+}
+
+//
+// Size in pixels of a level 0 grid cell.
+//
+fpoint grid_cell_size (void)
+{
+    return fpoint(GL_WIDTH / (PARTICLES_WIDTH - (GRID_BORDER * 2)),
+                  GL_HEIGHT / (PARTICLES_HEIGHT - (GRID_BORDER * 2)));
+}
+
 spoint particle_to_grid (const Particle *p)
 {
     return point_to_grid(p->at);
 }
 
+int particle_grid_level (const Particle *p)
+{
+    return (p->h > KERNEL_RANGE) ? 1 : 0;
+}
+
 Particle* Game::new_particle (const fpoint &at)
 {
     static uint32_t next_idx;
@@ -79,7 +109,12 @@ Particle* Game::new_particle (const fpoint &at)
     do {
         p++;
         next_idx++;
-        if (unlikely(p > eop)) {
+
+        //
+        // The last slot is where FOR_ALL_PARTICLES stops, so a particle
+        // put there would never be updated.
+        //
+        if (unlikely(p >= eop)) {
             p = getptr(particles, 0);
             next_idx = 0;
             continue;
@@ -90,10 +125,14 @@ Particle* Game::new_particle (const fpoint &at)
         }
 
         p->at = at;
+        p->sleep_at = at;
         p->density = 0;
         p->force = fpoint(0, 0);
+        p->accel = fpoint(0, 0);
         p->in_use = true;
+        p->asleep = false;
         p->mass = Constants::PARTICLE_MASS;
+        p->h = Constants::KERNEL_RANGE;
         p->pressure = 0;
         p->velocity = fpoint(0, 0);
         num_particles++;
@@ -105,6 +144,8 @@ Particle* Game::new_particle (const fpoint &at)
         //s->velocity.y *= scale;
 
         attach_particle(p);
+        sph_sleep_wake(at, 0);
+        sph_sort_dirty = true;
 
         return (p);
     } while (tries--);
@@ -121,17 +162,33 @@ void Game::free_particle (Particle *p)
     }
     s->in_use = false;
     num_particles--;
+    sph_sort_dirty = true;
 }
 
+//
+// The sorted search backend finds particles without the grid, which is
+// left alone while it is in use.
+//
 void Game::attach_particle (Particle *p)
 {
+    if (sph_search == SPH_SEARCH_SORT) {
+        return;
+    }
+
     auto sp = particle_to_grid(p);
+    auto level = particle_grid_level(p);
     p->attach_at = sp;
+    p->attach_level = level;
+
+    auto slots = particle_ids_at(level, sp.x >> level, sp.y >> level);
     for (auto slot = 0; slot < PARTICLE_SLOTS; slot++) {
-        auto idp = &getref(all_particle_ids_at, sp.x, sp.y, slot);
+        auto idp = &slots[slot];
         if (!*idp) {
             auto idx = p - getptr(particles, 0);
             *idp = idx;
+            if (level) {
+                num_coarse_particles++;
+            }
             return;
         }
     }
@@ -141,12 +198,22 @@ void Game::attach_particle (Particle *p)
 
 void Game::detach_particle (Particle *p)
 {
+    if (sph_search == SPH_SEARCH_SORT) {
+        return;
+    }
+
     auto sp = p->attach_at;
+    auto level = p->attach_level;
     auto idx = p - getptr(particles, 0);
+
+    auto slots = particle_ids_at(level, sp.x >> level, sp.y >> level);
     for (auto slot = 0; slot < PARTICLE_SLOTS; slot++) {
-        auto idp = &getref(all_particle_ids_at, sp.x, sp.y, slot);
+        auto idp = &slots[slot];
         if (*idp == idx) {
             *idp = 0;
+            if (level) {
+                num_coarse_particles--;
+            }
             return;
         }
     }
@@ -155,8 +222,15 @@ void Game::detach_particle (Particle *p)
 
 void Game::move_particle (Particle *p, fpoint to)
 {
+    if (sph_search == SPH_SEARCH_SORT) {
+        p->at = to;
+        sph_sort_dirty = true;
+        return;
+    }
+
     auto new_at = point_to_grid(to);
-    if (p->attach_at == new_at) {
+    if ((p->attach_at == new_at) &&
+        (p->attach_level == particle_grid_level(p))) {
         p->at = to;
         return;
     }
@@ -166,190 +240,211 @@ void Game::move_particle (Particle *p, fpoint to)
     attach_particle(p);
 }
 
-#define FOR_ALL_PARTICLES(p) \
-    auto pidx = 0; \
-    auto p = getptr(game->particles, 0); \
-    auto eop = getptr(game->particles, PARTICLE_MAX - 1); \
-    for (pidx = 0; p != eop; p++, pidx++) { \
-        if (!p->in_use) { \
-            continue; \
-        } \
-
-#define FOR_ALL_PARTICLES_END() }
-
-#define FOR_ALL_NEBS(p, q) \
-    auto sp = particle_to_grid(p); \
-    for (int ox = sp.x - NEB_RADIUS; ox <= sp.x + NEB_RADIUS; ox++) { \
-        for (int oy = sp.y - NEB_RADIUS; oy <= sp.y + NEB_RADIUS; oy++) { \
-            for (int slot = 0; slot < PARTICLE_SLOTS; slot++) { \
-                auto qidx = get(game->all_particle_ids_at, ox, oy, slot); \
- \
-                auto q = getptr(game->particles, qidx); \
-                if (likely(!qidx)) { \
-                    continue; \
-                } \
- \
-                fpoint d = p->at - q->at; \
-                float dist = d.x * d.x + d.y * d.y; \
-                if (dist > KERNEL_RANGE * KERNEL_RANGE) { \
-                    continue; \
-                } \
-
-#define FOR_ALL_NEBS_END() } } }
-
-class SPHSolver {
+//
+// Weakly compressible SPH; pressure comes straight from density through
+// a stiff equation of state.
+//
+class WCSPHSolver : public SPHSolver {
 public:
-    SPHSolver();
+    WCSPHSolver (void)
+    {
+        sleeps = true;
+        sound_speed = sqrt(STIFFNESS);
+    }
+
+    const char *name (void) const { return ("wcsph"); }
     void update(float dt);
-    void render(void);
-    void repulsionForce(fpoint at);
-    void attractionForce(fpoint at);
 private:
-    float kernel(fpoint x, float h);
-    fpoint gradKernel(fpoint x, float h);
-    float laplaceKernel(fpoint x, float h);
     void calculateDensity();
     void calculateForceDensity();
-    void integrationStep(float dt);
 };
 
 static SPHSolver *sph;
 
-SPHSolver::SPHSolver()
+void SPHSolver::seed (void)
 {
-    MINICON("Grid with %d x %d", PARTICLES_WIDTH, PARTICLES_HEIGHT);
-
     for (auto i = 0; i < NUMBER_PARTICLES; i++) {
         int x = random_range(GL_BORDER * 2, GL_WIDTH / 2 - GL_BORDER * 4);
         for (auto j = 0; j < NUMBER_PARTICLES; j++) {
-            game->new_particle(fpoint(x++,
-                                      random_range(GL_BORDER * 2, GL_BORDER * 3)));
+            fpoint at(x++, random_range(GL_BORDER * 2, GL_BORDER * 3));
+            if (sph_sdf_inside(at)) {
+                continue;
+            }
+            game->new_particle(at);
         }
     }
-
-    MINICON("%d particles", game->num_particles);
-
 }
 
-void SPHSolver::render (void)
+//
+// Start at rest on a lattice; the default seeding is far denser than the
+// incompressible solvers' rest density and would start with an explosion.
+//
+void SPHSolver::seed_lattice (float spacing)
 {
-    static auto tile = tile_find_mand("ball");
-    static const fpoint sprite_size(TILE_WIDTH / 2, TILE_HEIGHT / 2);
-
-    blit_fbo_bind(FBO_MAP);
-    glClearColor(0, 0, 0, 0);
-    glClear(GL_COLOR_BUFFER_BIT);
-    glBlendFunc(GL_ONE, GL_ZERO);
-    glcolorfast(WHITE);
-
-    blit_init();
-
-    FOR_ALL_PARTICLES(p) {
-        p->force = fpoint(0.0f, 0.0f);
-        fpoint at = p->at;
-        tile_blit(tile, at - sprite_size, at + sprite_size);
-    } FOR_ALL_PARTICLES_END()
-
-    blit_flush();
+    for (auto i = 0; i < NUMBER_PARTICLES; i++) {
+        for (auto j = 0; j < NUMBER_PARTICLES; j++) {
+            fpoint at(GL_BORDER * 2 + i * spacing,
+                      GL_BORDER + spacing + j * spacing);
+            if ((at.x > GL_WIDTH - GL_BORDER) ||
+                (at.y > GL_HEIGHT - GL_BORDER) ||
+                sph_sdf_inside(at)) {
+                continue;
+            }
+            game->new_particle(at);
+        }
+    }
 }
 
-void SPHSolver::repulsionForce(fpoint at)
+float sph_lattice_density (float spacing, float *grad_sum2, float *grad2_sum)
 {
-    for (auto p : game->particles) {
-        fpoint x = p.at - at;
-        float dist2 = x.x * x.x + x.y * x.y;
-        if (dist2 < KERNEL_RANGE * 3) {
-            p.force += x * REPULSION * p.density;
+    float h = KERNEL_RANGE;
+    int n = ceil(h / spacing);
+    float density = 0.0f;
+    fpoint gradSum(0.0f, 0.0f);
+    float grad2 = 0.0f;
+
+    for (auto x = -n; x <= n; x++) {
+        for (auto y = -n; y <= n; y++) {
+            fpoint r(x * spacing, y * spacing);
+            density += PARTICLE_MASS * sph_kernel(r, h);
+
+            fpoint g = sph_grad_kernel(r, h);
+            gradSum += g;
+            grad2 += g.x * g.x + g.y * g.y;
         }
     }
+
+    *grad_sum2 = gradSum.x * gradSum.x + gradSum.y * gradSum.y;
+    *grad2_sum = grad2;
+
+    return (density);
 }
 
-void SPHSolver::attractionForce (fpoint at)
+void SPHNeighbours::find (float radius)
 {
-    FOR_ALL_PARTICLES(p) {
-        fpoint x = at - p->at;
+    sph_sort_update(false);
 
-        float dist2 = x.x * x.x + x.y * x.y;
-        if (dist2 < KERNEL_RANGE * 3) {
-            p->force += x * REPULSION * p->density;
-        }
+    list.clear();
+    count.fill(0);
+
+    FOR_ALL_PARTICLES(p) {
+        auto found = query.radius(p->at, radius);
+        start[pidx] = list.size();
+        count[pidx] = found.size();
+        list.insert(list.end(), found.begin(), found.end());
     } FOR_ALL_PARTICLES_END()
 }
 
-void SPHSolver::update(float dt)
+//
+// Pick the largest dt that keeps particles from crossing more than a
+// fraction of the kernel per step (CFL), keeps pressure waves from doing
+// the same, keeps the force response stable, and keeps viscous diffusion
+// explicit-stable.
+//
+float SPHSolver::limit_dt (float v2, float a2)
 {
-    calculateDensity();
-    calculateForceDensity();
-    integrationStep(dt);
-}
+    if (!sph_dt_adaptive || !have_limits) {
+        return (TIMESTEP);
+    }
 
-// Poly6 Kernel
-float SPHSolver::kernel(fpoint x, float h)
-{
-    float r2 = x.x * x.x + x.y * x.y;
-    float h2 = h * h;
+    float h = KERNEL_RANGE;
+    float dt = sph_dt_max;
 
-    if (r2 < 0 || r2 > h2) return 0.0f;
+    if (v2 > 0) {
+        dt = std::min(dt, CFL_VELOCITY * h / sqrt(v2));
+    }
 
-    return 315.0f / (64.0f * M_PI * pow(h, 9)) * pow(h2 - r2, 3);
-}
+    if (sound_speed > 0) {
+        dt = std::min(dt, CFL_ACOUSTIC * h / (sound_speed + sqrt(v2)));
+    }
 
-// Gradient of Spiky Kernel
-fpoint SPHSolver::gradKernel(fpoint x, float h)
-{
-    float r = sqrt(x.x * x.x + x.y * x.y);
-    if (r == 0.0f) return fpoint(0.0f, 0.0f);
+    if (a2 > 0) {
+        dt = std::min(dt, CFL_FORCE * sqrt(h / sqrt(a2)));
+    }
 
-    float t1 = -45.0f / (M_PI * pow(h, 6));
-    fpoint t2 = x / r;
-    float t3 = pow(h - r, 2);
+    float nu = VISCOCITY / REST_DENSITY;
+    dt = std::min(dt, CFL_VISCOUS * h * h / nu);
+
+    return (std::max(dt, sph_dt_min));
+}
 
+float SPHSolver::choose_dt (void)
+{
+    return (limit_dt(max_v2, max_a2));
+}
 
-    return t2 * t1 * t3;
+void SPHSolver::step (float dt)
+{
+    update(dt);
+    steps++;
+    sim_time += dt;
 }
 
-// Laplacian of Viscosity Kernel
-float SPHSolver::laplaceKernel(fpoint x, float h)
+void WCSPHSolver::update(float dt)
 {
-    float r = sqrt(x.x * x.x + x.y * x.y);
-    return 45.0f / (M_PI * pow(h, 6)) * (h - r);
+    sph_adapt_update();
+    sph_sleep_update();
+    sph_sort_update(sph_sort_permute);
+    calculateDensity();
+    sph_brush_tick();
+    calculateForceDensity();
+    integrationStep(dt);
 }
 
-void SPHSolver::calculateDensity()
+void WCSPHSolver::calculateDensity()
 {
     FOR_ALL_PARTICLES(p) {
+        if (p->asleep) {
+            continue;
+        }
+
         float densitySum = 0.0f;
         FOR_ALL_NEBS(p, q) {
-            fpoint x = p->at - q->at;
-            densitySum += q->mass * kernel(x, KERNEL_RANGE);
+            fpoint x = d;
+            densitySum += q->mass * sph_kernel_h(x, hpq);
         } FOR_ALL_NEBS_END()
 
+        SphBoundarySample b;
+        if (sph_boundary_lookup(p->at, &b)) {
+            densitySum += b.density;
+        }
+
         p->density = densitySum;
         p->pressure = std::max(STIFFNESS * (p->density - REST_DENSITY), 0.0f);
     } FOR_ALL_PARTICLES_END()
 }
 
-void SPHSolver::calculateForceDensity()
+void WCSPHSolver::calculateForceDensity()
 {
     FOR_ALL_PARTICLES(p) {
+        if (p->asleep) {
+            continue;
+        }
+
         fpoint fPressure = fpoint(0.0f, 0.0f);
         fpoint fViscosity = fpoint(0.0f, 0.0f);
         fpoint fGravity = fpoint(0.0f, 0.0f);
         FOR_ALL_NEBS(p, q) {
-            fpoint x = p->at - q->at;
+            fpoint x = d;
 
             // Pressure force density
             fPressure += q->mass *
                          (p->pressure + q->pressure) /
                          (2.0f * q->density) *
-                         gradKernel(x, KERNEL_RANGE);
+                         sph_grad_kernel_h(x, hpq);
 
             // Viscosity force density
             fViscosity += q->mass *
                           (q->velocity - p->velocity) /
-                          q->density * laplaceKernel(x, KERNEL_RANGE);
+                          q->density * sph_laplace_kernel_h(x, hpq);
         } FOR_ALL_NEBS_END()
 
+        // Wall pressure, mirroring this particle's own
+        SphBoundarySample b;
+        if (sph_boundary_lookup(p->at, &b)) {
+            fPressure += (p->pressure / p->density) * b.grad;
+        }
+
         // Gravitational force density
         fGravity = p->density * fpoint(0, GRAVITY);
 
@@ -361,34 +456,88 @@ void SPHSolver::calculateForceDensity()
     } FOR_ALL_PARTICLES_END()
 }
 
+//
+// Forces are only found once per step, at the start, so the two
+// symplectic schemes are written with each step finishing the previous
+// step's velocity update before starting its own:
+//
+// leapfrog (kick-drift-kick): the closing half kick of the last step and
+// the opening half kick of this one use the same acceleration, so are
+// done together; velocity is kept at the half step.
+//
+// velocity Verlet: velocity is completed with the mean of the last and
+// this acceleration, then position moves with the full second order term.
+//
+// Either way every particle gets one position write, with the walls
+// already applied, and one grid update.
+//
 void SPHSolver::integrationStep(float dt)
 {
+    float v2max = 0;
+    float a2max = 0;
+
     FOR_ALL_PARTICLES(p) {
-        p->velocity += dt * p->force / p->density;
-        fpoint new_at = p->at + dt * p->velocity;
-        game->move_particle(p, new_at);
+        if (sleeps && p->asleep) {
+            continue;
+        }
+
+        fpoint accel = p->force / p->density;
+        fpoint new_at;
+
+        switch (sph_integrator) {
+        case SPH_INTEGRATOR_LEAPFROG:
+            p->velocity += (0.5f * (dt_prev + dt)) * accel;
+            new_at = p->at + dt * p->velocity;
+            break;
+
+        case SPH_INTEGRATOR_VERLET:
+            p->velocity += (0.5f * dt_prev) * (p->accel + accel);
+            new_at = p->at + dt * p->velocity + (0.5f * dt * dt) * accel;
+            break;
+
+        default:
+            p->velocity += dt * accel;
+            new_at = p->at + dt * p->velocity;
+            break;
+        }
+
+        p->accel = accel;
+
+        a2max = std::max(a2max, accel.x * accel.x + accel.y * accel.y);
+        v2max = std::max(v2max, p->velocity.x * p->velocity.x +
+                                p->velocity.y * p->velocity.y);
+
+        //
+        // Clamp to the walls before moving; a fast particle would otherwise
+        // be attached to a grid cell off the edge of the grid. Periodic
+        // axes wrap instead, and never reach the walls.
+        //
+        sph_sdf_collide(new_at, &p->velocity, bounce);
+        new_at = sph_periodic_wrap(new_at);
 
         if (new_at.x < GL_BORDER) {
             new_at.x = GL_BORDER;
-            p->velocity.x = -BOUNCE * p->velocity.x;
-            game->move_particle(p, new_at);
+            p->velocity.x = -bounce * p->velocity.x;
         } else if (new_at.x > GL_WIDTH - GL_BORDER) {
             new_at.x = GL_WIDTH - GL_BORDER;
-            p->velocity.x = -BOUNCE * p->velocity.x;
-            game->move_particle(p, new_at);
+            p->velocity.x = -bounce * p->velocity.x;
         }
 
         if (new_at.y < GL_BORDER) {
             new_at.y = GL_BORDER;
-            p->velocity.y = -BOUNCE * p->velocity.y;
-            game->move_particle(p, new_at);
+            p->velocity.y = -bounce * p->velocity.y;
         } else if (new_at.y > GL_HEIGHT - GL_BORDER) {
             new_at.y = GL_HEIGHT - GL_BORDER;
-            p->velocity.y = -BOUNCE * p->velocity.y;
-            game->move_particle(p, new_at);
+            p->velocity.y = -bounce * p->velocity.y;
         }
 
+        game->move_particle(p, new_at);
     } FOR_ALL_PARTICLES_END()
+
+    max_v2 = v2max;
+    max_a2 = a2max;
+    have_limits = true;
+    dt_prev = dt;
 }
 #if 0
     for (auto p = particles.begin(); p != particles.end(); p++, i++) {
@@ -426,12 +575,21 @@ void sph_display (void)
     if (!sph) {
         DIE("no sph");
     }
-    sph->update(TIMESTEP);
-    sph->render();
+    float dt = sph->choose_dt();
+
+    sph->step(dt);
+    sph_stats_tick(sph->steps, sph->sim_time, dt);
+    sph_render();
+
+    DBG("step %s dt %g iterations %d density error %.3f%% active %.1f%%",
+        sph->name(), dt, sph->iterations, sph->density_error * 100.0,
+        sph_sleep_active * 100.0);
 
     static int tick;
     if (tick++ >= 100) {
-        MINICON("%d particles", game->num_particles);
+        MINICON("%s: %d particles, dt %g, simulated %.3fs, %.0f%% active",
+                sph->name(), game->num_particles, dt, sph->sim_time,
+                sph_sleep_active * 100.0);
         int x = random_range(GL_BORDER * 2, GL_WIDTH - GL_BORDER * 4);
         while (tick > 0) {
             tick--;
@@ -450,5 +608,591 @@ void sph_init (void)
     if (sph) {
         delete sph;
     }
-    sph = new SPHSolver();
+
+    sph = sph_solver_new(sph_solver_name);
+    if (!sph) {
+        ERR("unknown solver %s, using wcsph", sph_solver_name.c_str());
+        sph_solver_name = "wcsph";
+        sph = sph_solver_new_wcsph();
+    }
+
+    if (!sph_solver_integrates() && (sph_integrator != SPH_INTEGRATOR_EULER)) {
+        ERR("%s has its own time stepping, ignoring integrator %s",
+            sph_solver_name.c_str(), sph_integrator_name(sph_integrator));
+        sph_integrator = SPH_INTEGRATOR_EULER;
+    }
+
+    if (sph_boundary_enabled) {
+        sph_boundary_update(sph->wall_density);
+    }
+
+    MINICON("Grid with %d x %d", PARTICLES_WIDTH, PARTICLES_HEIGHT);
+
+    if (!sph_sdf_file.empty()) {
+        sph_sdf_load(sph_sdf_file);
+    }
+
+    sph->seed();
+    MINICON("%d particles", game->num_particles);
+}
+
+SPHSolver *sph_solver_new_wcsph (void)
+{
+    return (new WCSPHSolver());
+}
+
+SPHSolver *sph_solver_new (const std::string &name)
+{
+    if (name == "wcsph") {
+        return (sph_solver_new_wcsph());
+    }
+    if (name == "pcisph") {
+        return (sph_solver_new_pcisph());
+    }
+    if (name == "pbf") {
+        return (sph_solver_new_pbf());
+    }
+    if (name == "flip") {
+        return (sph_solver_new_flip());
+    }
+    return (nullptr);
+}
+
+SPHSolver *sph_solver_current (void)
+{
+    return (sph);
+}
+
+//
+// Copy of the particles and their grids, so a benchmark can start the
+// simulation from the same place more than once and put it back after.
+//
+class SphSnapshot {
+public:
+    SphSnapshot (void) :
+        particles(std::make_unique<decltype(game->particles)>(
+                                            game->particles)),
+        grid(std::make_unique<decltype(game->all_particle_ids_at)>(
+                                            game->all_particle_ids_at)),
+        coarse(std::make_unique<decltype(game->coarse_particle_ids_at)>(
+                                            game->coarse_particle_ids_at)),
+        num_particles(game->num_particles),
+        num_coarse_particles(game->num_coarse_particles) {}
+
+    void restore (void)
+    {
+        game->particles = *particles;
+        game->all_particle_ids_at = *grid;
+        game->coarse_particle_ids_at = *coarse;
+        game->num_particles = num_particles;
+        game->num_coarse_particles = num_coarse_particles;
+        sph_sort_dirty = true;
+    }
+
+    std::unique_ptr<decltype(game->particles)> particles;
+    std::unique_ptr<decltype(game->all_particle_ids_at)> grid;
+    std::unique_ptr<decltype(game->coarse_particle_ids_at)> coarse;
+    int num_particles;
+    int num_coarse_particles;
+};
+
+//
+// Runs every solver from the same particles for the same simulated time and
+// compares their cost and how compressed each left the fluid. Compression
+// is measured against the lattice rest density for all of them, so the
+// weakly compressible solver is judged on the same terms. The running
+// simulation is put back afterwards.
+//
+#define BENCH_SOLVER_MAX_STEPS 100000
+
+uint8_t sph_bench_solvers (tokens_t *tokens, void *context)
+{_
+    static const char *names[] = { "wcsph", "pcisph", "pbf", "flip" };
+    char *s = tokens->args[2];
+    float sim_ms = 2;
+
+    if (s && (*s != '\0')) {
+        sim_ms = strtof(s, 0);
+    }
+
+    SphSnapshot snapshot;
+    auto num_particles = game->num_particles;
+
+    float unused1, unused2;
+    float rest = sph_lattice_density(REST_SPACING, &unused1, &unused2);
+
+    CON("bench solvers: %d particles, %.1f ms simulated",
+        num_particles, sim_ms);
+
+    for (auto name : names) {
+        snapshot.restore();
+
+        std::unique_ptr<SPHSolver> solver(sph_solver_new(name));
+        if (sph_boundary_enabled) {
+            sph_boundary_update(solver->wall_density);
+        }
+
+        double t = 0;
+        int steps = 0;
+        long iterations = 0;
+        long substeps = 0;
+        float worst = 0;
+
+        auto start = std::chrono::steady_clock::now();
+        while ((t * 1000.0 < sim_ms) && (steps < BENCH_SOLVER_MAX_STEPS)) {
+            float dt = solver->choose_dt();
+            solver->update(dt);
+            FOR_ALL_PARTICLES(p) {
+                p->force = fpoint(0.0f, 0.0f);
+            } FOR_ALL_PARTICLES_END()
+
+            t += dt;
+            steps++;
+            iterations += solver->iterations;
+            substeps += solver->substeps;
+            worst = std::max(worst, solver->density_error);
+        }
+        auto d = std::chrono::steady_clock::now() - start;
+        double wall_ms = std::chrono::duration<double, std::milli>(d).count();
+
+        double compression = 0;
+        float max_compression = 0;
+        int n = 0;
+        FOR_ALL_PARTICLES(p) {
+            float c = std::max(p->density / rest - 1.0f, 0.0f);
+            compression += c;
+            max_compression = std::max(max_compression, c);
+            n++;
+        } FOR_ALL_PARTICLES_END()
+
+        CON("  %-6s: %6d steps %9.1f ms wall, %7.4f sim/wall, "
+            "%5.1f iterations/step, solver error %.2f%%",
+            name, steps, wall_ms, t * 1000.0 / wall_ms,
+            steps ? (float) iterations / steps : 0.0f, worst * 100.0);
+        CON("          %d particles left, compression mean %.2f%% max %.2f%%",
+            game->num_particles, n ? compression * 100.0 / n : 0.0,
+            max_compression * 100.0);
+        //
+        // A step split into substeps only costs less than fixed steps if
+        // the substeps are longer, so both are reported.
+        //
+        CON("          mean step %.3g s, %.1fx the fixed step; "
+            "%.1f substeps each of %.1fx",
+            steps ? t / steps : 0.0, steps ? t / steps / TIMESTEP : 0.0,
+            steps ? (float) substeps / steps : 0.0f,
+            substeps ? t / substeps / TIMESTEP : 0.0);
+    }
+
+    snapshot.restore();
+
+    if (sph_boundary_enabled && sph) {
+        sph_boundary_update(sph->wall_density);
+    }
+
+    return (true);
+}
+
+//
+// A strongly non-uniform scene: a deep tank at about the spacing the weakly
+// compressible solver settles at, under a sparse spray.
+//
+#define BENCH_ADAPT_TANK  4000
+#define BENCH_ADAPT_SPRAY 500
+
+static void bench_adapt_scene (void)
+{
+    FOR_ALL_PARTICLES(p) {
+        game->detach_particle(p);
+        game->free_particle(p);
+    } FOR_ALL_PARTICLES_END()
+
+    const float spacing = KERNEL_RANGE / 3;
+    int n = 0;
+
+    for (float y = GL_HEIGHT - GL_BORDER; n < BENCH_ADAPT_TANK; y -= spacing) {
+        for (float x = GL_BORDER; x <= GL_WIDTH - GL_BORDER; x += spacing) {
+            if (n++ >= BENCH_ADAPT_TANK) {
+                break;
+            }
+            game->new_particle(fpoint(x, y));
+        }
+    }
+
+    for (auto i = 0; i < BENCH_ADAPT_SPRAY; i++) {
+        game->new_particle(fpoint(random_range(GL_BORDER, GL_WIDTH - GL_BORDER),
+                                  random_range(GL_BORDER * 2,
+                                               GL_HEIGHT / 2)));
+    }
+}
+
+//
+// One pass over every neighbour pair, as the density pass makes.
+//
+static double bench_neighbour_pass (long *pairs)
+{
+    auto start = std::chrono::steady_clock::now();
+    long n = 0;
+
+    FOR_ALL_PARTICLES(p) {
+        FOR_ALL_NEBS(p, q) {
+            n++;
+        } FOR_ALL_NEBS_END()
+    } FOR_ALL_PARTICLES_END()
+
+    *pairs = n;
+
+    auto d = std::chrono::steady_clock::now() - start;
+    return (std::chrono::duration<double, std::micro>(d).count());
+}
+
+//
+// Runs the weakly compressible solver on the scene above for the same
+// simulated time with all standard particles, then with the deep tank
+// merged, and compares neighbour search and step cost. The running
+// simulation is put back afterwards.
+//
+uint8_t sph_bench_adapt (tokens_t *tokens, void *context)
+{_
+    char *s = tokens->args[2];
+    float sim_ms = 2;
+
+    if (s && (*s != '\0')) {
+        sim_ms = strtof(s, 0);
+    }
+
+    SphSnapshot snapshot;
+    auto adapt = sph_adapt_enabled;
+
+    CON("bench adapt: %d particle tank under %d of spray, %.1f ms simulated",
+        BENCH_ADAPT_TANK, BENCH_ADAPT_SPRAY, sim_ms);
+
+    for (auto on : { false, true }) {
+        bench_adapt_scene();
+
+        sph_adapt_enabled = on;
+        if (on) {
+            while (sph_adapt_pass()) { }
+        }
+
+        long pairs;
+        double search_us = bench_neighbour_pass(&pairs);
+        int particles = game->num_particles;
+        int coarse = game->num_coarse_particles;
+
+        std::unique_ptr<SPHSolver> solver(sph_solver_new_wcsph());
+        double t = 0;
+        int steps = 0;
+
+        auto start = std::chrono::steady_clock::now();
+        while ((t * 1000.0 < sim_ms) && (steps < BENCH_SOLVER_MAX_STEPS)) {
+            float dt = solver->choose_dt();
+            solver->update(dt);
+            FOR_ALL_PARTICLES(p) {
+                p->force = fpoint(0.0f, 0.0f);
+            } FOR_ALL_PARTICLES_END()
+
+            t += dt;
+            steps++;
+        }
+        auto d = std::chrono::steady_clock::now() - start;
+        double wall_ms = std::chrono::duration<double, std::milli>(d).count();
+
+        CON("  adapt %-3s: %4d particles, %4d coarse, neighbour pass "
+            "%8.1f us, %5.1f neighbours each",
+            on ? "on" : "off", particles, coarse, search_us,
+            particles ? (float) pairs / particles : 0.0f);
+        CON("             %6d steps %9.1f ms wall, %7.4f sim/wall",
+            steps, wall_ms, t * 1000.0 / wall_ms);
+    }
+
+    sph_adapt_enabled = adapt;
+    snapshot.restore();
+
+    return (true);
+}
+
+//
+// Runs the weakly compressible solver on the fluid as it is, for the same
+// simulated time with sleeping off and on, and compares step cost and how
+// much of the fluid was still awake at the end. Sleeping only pays once
+// the fluid has come to rest, so let the pool settle first. The running
+// simulation is put back afterwards.
+//
+uint8_t sph_bench_sleep (tokens_t *tokens, void *context)
+{_
+    char *s = tokens->args[2];
+    float sim_ms = 50;
+
+    if (s && (*s != '\0')) {
+        sim_ms = strtof(s, 0);
+    }
+
+    SphSnapshot snapshot;
+    auto sleep = sph_sleep_enabled;
+
+    CON("bench sleep: %d particles, %.1f ms simulated",
+        game->num_particles, sim_ms);
+
+    for (auto on : { false, true }) {
+        snapshot.restore();
+        sph_sleep_enabled = on;
+        sph_sleep_wake(fpoint(GL_WIDTH / 2, GL_HEIGHT / 2),
+                       GL_WIDTH + GL_HEIGHT);
+
+        std::unique_ptr<SPHSolver> solver(sph_solver_new_wcsph());
+        double t = 0;
+        int steps = 0;
+
+        auto start = std::chrono::steady_clock::now();
+        while ((t * 1000.0 < sim_ms) && (steps < BENCH_SOLVER_MAX_STEPS)) {
+            float dt = solver->choose_dt();
+            solver->update(dt);
+            FOR_ALL_PARTICLES(p) {
+                p->force = fpoint(0.0f, 0.0f);
+            } FOR_ALL_PARTICLES_END()
+
+            t += dt;
+            steps++;
+        }
+        auto d = std::chrono::steady_clock::now() - start;
+        double wall_ms = std::chrono::duration<double, std::milli>(d).count();
+
+        CON("  sleep %-3s: %4d particles, %6d steps %9.1f ms wall, "
+            "%7.4f sim/wall, %5.1f%% awake at the end",
+            on ? "on" : "off", game->num_particles, steps, wall_ms,
+            t * 1000.0 / wall_ms, sph_sleep_active * 100.0);
+    }
+
+    //
+    // Start every cell's count again, so nothing the bench saw calm is put
+    // to sleep in the simulation put back.
+    //
+    sph_sleep_wake(fpoint(GL_WIDTH / 2, GL_HEIGHT / 2), GL_WIDTH + GL_HEIGHT);
+    sph_sleep_enabled = sleep;
+    snapshot.restore();
+
+    return (true);
+}
+
+//
+// Runs the weakly compressible solver from the same particles for the same
+// simulated time with each neighbour search backend, and compares one
+// neighbour pass, the sort and the whole step. Both backends should find
+// the same pairs. The running simulation is put back afterwards.
+//
+uint8_t sph_bench_search (tokens_t *tokens, void *context)
+{_
+    static const struct {
+        const char *name;
+        int search;
+        bool permute;
+    } backends[] = {
+        { "slots",   SPH_SEARCH_SLOTS, false },
+        { "sort",    SPH_SEARCH_SORT,  false },
+        { "permute", SPH_SEARCH_SORT,  true  },
+    };
+
+    char *s = tokens->args[2];
+    float sim_ms = 2;
+
+    if (s && (*s != '\0')) {
+        sim_ms = strtof(s, 0);
+    }
+
+    auto search = sph_search;
+    auto permute = sph_sort_permute;
+
+    //
+    // The snapshot must hold a grid that matches its particles.
+    //
+    sph_search_select(SPH_SEARCH_SLOTS);
+    SphSnapshot snapshot;
+
+    CON("bench search: %d particles, %.1f ms simulated, %d threads",
+        game->num_particles, sim_ms, thread_pool()->size());
+
+    for (auto &b : backends) {
+        sph_search_select(SPH_SEARCH_SLOTS);
+        snapshot.restore();
+        sph_search_select(b.search);
+        sph_sort_permute = b.permute;
+        sph_sort_update(b.permute);
+
+        long pairs;
+        double search_us = bench_neighbour_pass(&pairs);
+
+        std::unique_ptr<SPHSolver> solver(sph_solver_new_wcsph());
+        double t = 0;
+        double sort_us = 0;
+        int steps = 0;
+
+        auto start = std::chrono::steady_clock::now();
+        while ((t * 1000.0 < sim_ms) && (steps < BENCH_SOLVER_MAX_STEPS)) {
+            float dt = solver->choose_dt();
+            solver->update(dt);
+            FOR_ALL_PARTICLES(p) {
+                p->force = fpoint(0.0f, 0.0f);
+            } FOR_ALL_PARTICLES_END()
+
+            if (b.search == SPH_SEARCH_SORT) {
+                sort_us += sph_sort_build_us;
+            }
+
+            t += dt;
+            steps++;
+        }
+        auto d = std::chrono::steady_clock::now() - start;
+        double wall_ms = std::chrono::duration<double, std::milli>(d).count();
+
+        CON("  %-7s: neighbour pass %8.1f us, %ld pairs, sort %6.1f us/step",
+            b.name, search_us, pairs, steps ? sort_us / steps : 0.0);
+        CON("           %6d steps %9.1f ms wall, %7.4f sim/wall",
+            steps, wall_ms, t * 1000.0 / wall_ms);
+    }
+
+    sph_search_select(SPH_SEARCH_SLOTS);
+    snapshot.restore();
+    sph_search_select(search);
+    sph_sort_permute = permute;
+
+    return (true);
+}
+
+int sph_integrator_find (const char *name)
+{
+    for (auto i = 0; i < SPH_INTEGRATOR_MAX; i++) {
+        if (!strcasecmp(name, sph_integrator_names[i])) {
+            return (i);
+        }
+    }
+    return (-1);
+}
+
+const char *sph_integrator_name (int integrator)
+{
+    if ((integrator < 0) || (integrator >= SPH_INTEGRATOR_MAX)) {
+        return ("?");
+    }
+    return (sph_integrator_names[integrator]);
+}
+
+//
+// User has entered a command, run it
+//
+uint8_t sph_integrator_set (tokens_t *tokens, void *context)
+{_
+    char *s = tokens->args[2];
+
+    if (!s || (*s == '\0')) {
+        CON("integrator %s", sph_integrator_name(sph_integrator));
+        return (true);
+    }
+
+    auto i = sph_integrator_find(s);
+    if (i < 0) {
+        CON("unknown integrator %s; try euler leapfrog or verlet", s);
+        return (false);
+    }
+
+    if (!sph_solver_integrates()) {
+        CON("%s has its own time stepping; integrator not changed",
+            sph_solver_name.c_str());
+        return (false);
+    }
+
+    sph_integrator = i;
+    CON("integrator %s", sph_integrator_name(sph_integrator));
+    return (true);
+}
+
+//
+// User has entered a command, run it
+//
+uint8_t sph_dt_set (tokens_t *tokens, void *context)
+{_
+    char *s = tokens->args[2];
+
+    if (!s || (*s == '\0') || !strcasecmp(s, "adaptive")) {
+        sph_dt_adaptive = true;
+        CON("adaptive timestep, %g to %g", sph_dt_min, sph_dt_max);
+        return (true);
+    }
+
+    if (!strcasecmp(s, "fixed")) {
+        sph_dt_adaptive = false;
+        CON("fixed timestep %g", TIMESTEP);
+        return (true);
+    }
+
+    CON("unknown timestep mode %s; try adaptive or fixed", s);
+    return (false);
+}
+
+//
+// Axes as a string of x and y; "none" or nothing for walls all round.
+// Returns false, changing nothing, on anything else.
+//
+bool sph_periodic_parse (const char *axes)
+{
+    bool x = false, y = false;
+
+    if (strcasecmp(axes, "none")) {
+        for (auto c = axes; *c; c++) {
+            if ((*c == 'x') || (*c == 'X')) {
+                x = true;
+            } else if ((*c == 'y') || (*c == 'Y')) {
+                y = true;
+            } else {
+                return (false);
+            }
+        }
+    }
+
+    sph_periodic_x = x;
+    sph_periodic_y = y;
+    return (true);
+}
+
+static const char *sph_periodic_name (void)
+{
+    if (sph_periodic_x && sph_periodic_y) {
+        return ("xy");
+    }
+    if (sph_periodic_x) {
+        return ("x");
+    }
+    if (sph_periodic_y) {
+        return ("y");
+    }
+    return ("none");
+}
+
+//
+// User has entered a command, run it
+//
+uint8_t sph_periodic_set (tokens_t *tokens, void *context)
+{_
+    char *s = tokens->args[2];
+
+    if (!s || (*s == '\0')) {
+        CON("periodic %s", sph_periodic_name());
+        return (true);
+    }
+
+    if (!sph_periodic_parse(s)) {
+        CON("unknown periodic axes %s; try x y xy or none", s);
+        return (false);
+    }
+
+    if (sph_boundary_enabled) {
+        sph_boundary_build(sph ? sph->wall_density : REST_DENSITY);
+    }
+
+    CON("periodic %s", sph_periodic_name());
+
+    if (sph_solver_name == "flip") {
+        CON("flip keeps its walls; periodic axes apply to the sph solvers");
+    }
+
+    return (true);
 }
@@ -0,0 +1,303 @@
+//
+// Copyright goblinhack@gmail.com
+// See the README file for license info.
+//
+
+#include "my_game.h"
+#include "my_sph_solver.h"
+#include "my_sph_sdf.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace Constants;
+
+bool sph_adapt_enabled;
+
+//
+// Particles come in masses of 1, 2 and 4 standard particles. Each level up
+// must be this many more cells of fluid below the surface layer, the cells
+// next to air, which stays at standard particles. The coarse particle
+// grid holds smoothing lengths up to twice standard, so mass 4.
+//
+static const int ADAPT_LEVELS = 2;
+static const int ADAPT_DEPTH  = 2;
+
+//
+// Resolution is kept fine this close to the mouse.
+//
+static const float ADAPT_CURSOR_RADIUS = KERNEL_RANGE * 4;
+
+//
+// Steps between passes; particles only change level this often, so a
+// region on the boundary does not split and merge every step.
+//
+static const int ADAPT_EVERY = 10;
+
+//
+// Kernel sized cells, each holding how many cells it is from air, up to
+// the depth the heaviest level needs; the surface layer is at 1.
+//
+static const int ADAPT_DEPTH_MAX = ADAPT_DEPTH * ADAPT_LEVELS + 1;
+
+static std::vector<uint8_t> depth;
+static std::vector<uint8_t> depth_next;
+static int cells_w;
+static int cells_h;
+
+static inline int adapt_cell (const fpoint &at)
+{
+    int x = std::min(std::max((int) (at.x / KERNEL_RANGE), 0), cells_w - 1);
+    int y = std::min(std::max((int) (at.y / KERNEL_RANGE), 0), cells_h - 1);
+    return (y * cells_w + x);
+}
+
+//
+// Cells of fluid between this point and the surface layer; -1 in air or
+// near the mouse.
+//
+static inline int adapt_depth_at (const fpoint &at)
+{
+    return (depth[adapt_cell(at)] - 1);
+}
+
+static inline int adapt_level (const Particle *p)
+{
+    return ((int) round(log2(p->mass / PARTICLE_MASS)));
+}
+
+//
+// Fluid keeps the same density at any level, so the area a particle
+// covers, and its smoothing length squared, grows with its mass.
+//
+static inline float adapt_h (float mass)
+{
+    return (KERNEL_RANGE * sqrt(mass / PARTICLE_MASS));
+}
+
+static inline fpoint adapt_clamp (fpoint at)
+{
+    sph_sdf_collide(at, nullptr, 0.0f);
+    return (sph_wall_clamp(at));
+}
+
+//
+// Air is an empty cell inside the walls and clear of obstacles; the walls
+// themselves count as fluid so the floor of a pool is deep. Depth is then
+// grown out from the air, and from the mouse, one ring per pass.
+//
+static void adapt_depth (void)
+{
+    cells_w = GL_WIDTH / KERNEL_RANGE + 1;
+    cells_h = GL_HEIGHT / KERNEL_RANGE + 1;
+
+    depth.assign(cells_w * cells_h, ADAPT_DEPTH_MAX);
+    depth_next.resize(cells_w * cells_h);
+
+    std::vector<uint8_t> occupied(cells_w * cells_h, 0);
+    FOR_ALL_PARTICLES(p) {
+        occupied[adapt_cell(p->at)] = 1;
+    } FOR_ALL_PARTICLES_END()
+
+    for (auto y = 0; y < cells_h; y++) {
+        for (auto x = 0; x < cells_w; x++) {
+            fpoint at((x + 0.5f) * KERNEL_RANGE, (y + 0.5f) * KERNEL_RANGE);
+            auto c = y * cells_w + x;
+
+            bool inside = (at.x >= GL_BORDER) &&
+                          (at.x <= GL_WIDTH - GL_BORDER) &&
+                          (at.y >= GL_BORDER) &&
+                          (at.y <= GL_HEIGHT - GL_BORDER);
+
+            if ((inside && !occupied[c] && !sph_sdf_inside(at)) ||
+                sph_brush_near(at, ADAPT_CURSOR_RADIUS)) {
+                depth[c] = 0;
+            }
+        }
+    }
+
+    for (auto pass = 0; pass < ADAPT_DEPTH_MAX; pass++) {
+        for (auto y = 0; y < cells_h; y++) {
+            for (auto x = 0; x < cells_w; x++) {
+                int d = depth[y * cells_w + x];
+                for (auto oy = std::max(y - 1, 0);
+                     oy <= std::min(y + 1, cells_h - 1); oy++) {
+                    for (auto ox = std::max(x - 1, 0);
+                         ox <= std::min(x + 1, cells_w - 1); ox++) {
+                        d = std::min(d, depth[oy * cells_w + ox] + 1);
+                    }
+                }
+                depth_next[y * cells_w + x] = d;
+            }
+        }
+        depth.swap(depth_next);
+    }
+}
+
+//
+// Heavy particles too near the surface split in two, side by side at the
+// lighter level's rest spacing. Both halves keep the velocity, so mass,
+// centre of mass and momentum are unchanged. A particle only splits once
+// it is a cell shallower than where it may merge.
+//
+static int adapt_split (void)
+{
+    int split = 0;
+
+    FOR_ALL_PARTICLES(p) {
+        int level = adapt_level(p);
+        if (!level) {
+            continue;
+        }
+
+        if (adapt_depth_at(p->at) + 1 >= ADAPT_DEPTH * level) {
+            continue;
+        }
+
+        float m = p->mass / 2;
+        float h = adapt_h(m);
+
+        //
+        // Alternate the axis so a split region does not grow a grain.
+        //
+        fpoint off = (pidx & 1) ? fpoint(h / 4, 0) : fpoint(0, h / 4);
+
+        auto c = game->new_particle(adapt_clamp(p->at + off));
+        if (!c || !c->in_use) {
+            continue;
+        }
+
+        c->mass = m;
+        c->h = h;
+        game->move_particle(c, c->at);
+        c->velocity = p->velocity;
+        c->accel = p->accel;
+        c->density = p->density;
+        c->pressure = p->pressure;
+
+        p->mass = m;
+        p->h = h;
+        p->asleep = false;
+        game->move_particle(p, adapt_clamp(p->at - off));
+
+        split++;
+    } FOR_ALL_PARTICLES_END()
+
+    return (split);
+}
+
+//
+// Deep particles merge with their nearest neighbour of the same mass into
+// one at their centre of mass, carrying their summed momentum.
+//
+static int adapt_merge (void)
+{
+    static ParticleQuery q;
+    int merged = 0;
+
+    FOR_ALL_PARTICLES(p) {
+        int level = adapt_level(p);
+        if (level >= ADAPT_LEVELS) {
+            continue;
+        }
+
+        if (adapt_depth_at(p->at) < ADAPT_DEPTH * (level + 1)) {
+            continue;
+        }
+
+        Particle *o = nullptr;
+        float best = p->h * p->h;
+
+        for (auto qidx : q.radius(p->at, p->h)) {
+            if (qidx == pidx) {
+                continue;
+            }
+
+            auto c = getptr(game->particles, qidx);
+            if (adapt_level(c) != level) {
+                continue;
+            }
+
+            fpoint d = sph_periodic_delta(c->at - p->at);
+            float d2 = d.x * d.x + d.y * d.y;
+            if (d2 < best) {
+                best = d2;
+                o = c;
+            }
+        }
+
+        if (!o) {
+            continue;
+        }
+
+        float m = p->mass + o->mass;
+        fpoint at = sph_wall_clamp(p->at + sph_periodic_delta(o->at - p->at) *
+                                           (o->mass / m));
+
+        p->velocity = (p->velocity * p->mass + o->velocity * o->mass) / m;
+        p->accel = (p->accel * p->mass + o->accel * o->mass) / m;
+        p->mass = m;
+        p->h = adapt_h(m);
+        p->asleep = false;
+
+        game->detach_particle(o);
+        game->free_particle(o);
+        game->move_particle(p, at);
+        sph_sleep_wake(at, 0);
+
+        merged++;
+    } FOR_ALL_PARTICLES_END()
+
+    return (merged);
+}
+
+int sph_adapt_pass (void)
+{
+    sph_sort_update(false);
+    adapt_depth();
+
+    auto split = adapt_split();
+    auto merged = adapt_merge();
+
+    DBG("adapt: %d split, %d merged, %d particles, %d coarse",
+        split, merged, game->num_particles, game->num_coarse_particles);
+
+    return (split + merged);
+}
+
+//
+// Called at the start of a step, before densities.
+//
+void sph_adapt_update (void)
+{
+    if (!sph_adapt_enabled) {
+        return;
+    }
+
+    static int tick;
+    if (tick++ % ADAPT_EVERY) {
+        return;
+    }
+
+    sph_adapt_pass();
+}
+
+//
+// User has entered a command, run it
+//
+uint8_t sph_adapt_set (tokens_t *tokens, void *context)
+{_
+    char *s = tokens->args[2];
+
+    if (!s || (*s == '\0') || (*s == '1')) {
+        sph_adapt_enabled = true;
+        CON("adaptive resolution on, up to %d standard particles each",
+            1 << ADAPT_LEVELS);
+    } else {
+        sph_adapt_enabled = false;
+        CON("adaptive resolution off; merged particles stay merged");
+    }
+
+    return (true);
+}
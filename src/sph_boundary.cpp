@@ -0,0 +1,343 @@
+//
+// Copyright goblinhack@gmail.com
+// See the README file for license info.
+//
+
+#include "my_game.h"
+#include "my_sph_solver.h"
+#include "my_sph_sdf.h"
+#include "my_thread_pool.h"
+
+#include <algorithm>
+#include <vector>
+
+using namespace Constants;
+
+bool sph_boundary_enabled;
+
+//
+// Spacing of the boundary samples along a wall, and of the lookup grid
+// their contributions are baked into.
+//
+static const float BOUNDARY_SPACING = REST_SPACING / 2;
+static const float BOUNDARY_LOOKUP  = 2;
+
+//
+// Boundary samples, binned in kernel sized cells.
+//
+static std::vector<fpoint> boundary;
+static std::vector<float> boundary_volume;
+
+//
+// Samples near a periodic seam are repeated past the other side, so the
+// bake sees them across it; each repeat points back at its original.
+//
+static size_t boundary_real;
+static std::vector<uint32_t> boundary_ghost_of;
+static std::vector<std::vector<uint32_t>> boundary_bins;
+static int bins_w;
+static int bins_h;
+
+static std::vector<SphBoundarySample> lookup;
+static int lookup_w;
+static int lookup_h;
+static bool built;
+static float built_rest;
+static bool built_periodic_x;
+static bool built_periodic_y;
+
+static void boundary_add (const fpoint &at)
+{
+    if ((at.x < GL_BORDER) || (at.x > GL_WIDTH - GL_BORDER) ||
+        (at.y < GL_BORDER) || (at.y > GL_HEIGHT - GL_BORDER)) {
+        return;
+    }
+    boundary.push_back(at);
+}
+
+static void boundary_ghost (uint32_t i, const fpoint &shift)
+{
+    boundary.push_back(boundary[i] + shift);
+    boundary_ghost_of.push_back(i);
+}
+
+//
+// Repeat samples within a kernel of a periodic seam on its far side.
+//
+static void boundary_ghosts (void)
+{
+    boundary_real = boundary.size();
+    boundary_ghost_of.clear();
+
+    float w = sph_periodic_period_x();
+    float h = sph_periodic_period_y();
+
+    for (uint32_t i = 0; i < boundary_real; i++) {
+        fpoint at = boundary[i];
+        float sx = 0, sy = 0;
+
+        if (sph_periodic_x) {
+            if (at.x - GL_BORDER < KERNEL_RANGE) {
+                sx = w;
+            } else if (GL_WIDTH - GL_BORDER - at.x <= KERNEL_RANGE) {
+                sx = -w;
+            }
+        }
+
+        if (sph_periodic_y) {
+            if (at.y - GL_BORDER < KERNEL_RANGE) {
+                sy = h;
+            } else if (GL_HEIGHT - GL_BORDER - at.y <= KERNEL_RANGE) {
+                sy = -h;
+            }
+        }
+
+        if (sx != 0) {
+            boundary_ghost(i, fpoint(sx, 0));
+        }
+        if (sy != 0) {
+            boundary_ghost(i, fpoint(0, sy));
+        }
+        if ((sx != 0) && (sy != 0)) {
+            boundary_ghost(i, fpoint(sx, sy));
+        }
+    }
+}
+
+//
+// One row of samples along each wall, and along the surface of any
+// obstacles. Periodic axes have no walls.
+//
+static void boundary_sample (void)
+{
+    boundary.clear();
+
+    float l = GL_BORDER, r = GL_WIDTH - GL_BORDER;
+    float t = GL_BORDER, b = GL_HEIGHT - GL_BORDER;
+
+    //
+    // Across a periodic x the two ends of a wall are the same place.
+    //
+    float re = sph_periodic_x ? r - BOUNDARY_SPACING / 2 : r;
+
+    if (!sph_periodic_y) {
+        for (float x = l; x <= re; x += BOUNDARY_SPACING) {
+            boundary_add(fpoint(x, t));
+            boundary_add(fpoint(x, b));
+        }
+    }
+    if (!sph_periodic_x) {
+        for (float y = t + BOUNDARY_SPACING; y < b; y += BOUNDARY_SPACING) {
+            boundary_add(fpoint(l, y));
+            boundary_add(fpoint(r, y));
+        }
+    }
+
+    if (sph_sdf_loaded) {
+        for (float y = t; y <= b; y += BOUNDARY_SPACING) {
+            for (float x = l; x <= r; x += BOUNDARY_SPACING) {
+                fpoint n;
+                float d = sph_sdf_distance(fpoint(x, y), &n);
+                if (fabs(d) < BOUNDARY_SPACING / 2) {
+                    boundary_add(fpoint(x, y) - n * d);
+                }
+            }
+        }
+    }
+
+    boundary_ghosts();
+}
+
+static void boundary_bin (void)
+{
+    bins_w = GL_WIDTH / KERNEL_RANGE + 1;
+    bins_h = GL_HEIGHT / KERNEL_RANGE + 1;
+
+    boundary_bins.assign(bins_w * bins_h, std::vector<uint32_t>());
+
+    for (size_t i = 0; i < boundary.size(); i++) {
+        int x = boundary[i].x / KERNEL_RANGE;
+        int y = boundary[i].y / KERNEL_RANGE;
+        boundary_bins[y * bins_w + x].push_back(i);
+    }
+}
+
+#define FOR_ALL_BOUNDARY_NEAR(at, bidx) \
+    { \
+        int bx_ = (at).x / KERNEL_RANGE; \
+        int by_ = (at).y / KERNEL_RANGE; \
+        for (auto y_ = std::max(by_ - 1, 0); \
+             y_ <= std::min(by_ + 1, bins_h - 1); y_++) { \
+            for (auto x_ = std::max(bx_ - 1, 0); \
+                 x_ <= std::min(bx_ + 1, bins_w - 1); x_++) { \
+                for (auto bidx : boundary_bins[y_ * bins_w + x_]) {
+
+#define FOR_ALL_BOUNDARY_NEAR_END() } } } }
+
+//
+// Spacing of the lattice that is at this density. Density only falls as
+// the lattice spreads, until a particle no longer reaches its neighbours
+// and is left with its own.
+//
+static float boundary_rest_spacing (float rest)
+{
+    float unused1, unused2;
+    float lo = REST_SPACING / 4, hi = KERNEL_RANGE;
+
+    for (auto i = 0; i < 20; i++) {
+        float mid = (lo + hi) / 2;
+        if (sph_lattice_density(mid, &unused1, &unused2) > rest) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return (hi);
+}
+
+//
+// Each sample stands in for as much fluid as would fill the space around
+// it, so samples packed closer (corners, curves) each count for less. The
+// total is scaled so a particle resting on a flat wall, in fluid at the
+// spacing that gives the solver's rest density, is at that density: the
+// wall makes up only what the missing half of its neighbourhood would
+// have added.
+//
+static void boundary_volumes (float rest)
+{
+    float spacing = boundary_rest_spacing(rest);
+
+    float h = KERNEL_RANGE;
+    int n = ceil(h / spacing);
+    float half = 0;
+    for (auto x = -n; x <= n; x++) {
+        for (auto y = 0; y <= n; y++) {
+            half += PARTICLE_MASS *
+                    sph_kernel(fpoint(x * spacing, y * spacing), h);
+        }
+    }
+    float scale = std::max(rest - half, 0.0f);
+
+    boundary_volume.resize(boundary.size());
+
+    for (size_t i = 0; i < boundary.size(); i++) {
+        float sum = 0;
+        FOR_ALL_BOUNDARY_NEAR(boundary[i], j) {
+            sum += sph_kernel(boundary[i] - boundary[j], h);
+        } FOR_ALL_BOUNDARY_NEAR_END()
+
+        boundary_volume[i] = (sum > 0) ? scale / sum : 0;
+    }
+
+    for (size_t i = boundary_real; i < boundary.size(); i++) {
+        auto of = boundary_ghost_of[i - boundary_real];
+        boundary_volume[i] = boundary_volume[of];
+    }
+}
+
+//
+// Sum every sample's contribution at each lookup node, once.
+//
+static void boundary_bake (void)
+{
+    lookup_w = GL_WIDTH / BOUNDARY_LOOKUP + 2;
+    lookup_h = GL_HEIGHT / BOUNDARY_LOOKUP + 2;
+    lookup.assign(lookup_w * lookup_h, SphBoundarySample {});
+
+    thread_pool()->parallel_for(lookup_h, [](int begin, int end, int chunk) {
+        for (auto j = begin; j < end; j++) {
+            for (auto i = 0; i < lookup_w; i++) {
+                fpoint at(i * BOUNDARY_LOOKUP, j * BOUNDARY_LOOKUP);
+                auto &s = lookup[j * lookup_w + i];
+
+                FOR_ALL_BOUNDARY_NEAR(at, b) {
+                    fpoint x = at - boundary[b];
+                    if (x.x * x.x + x.y * x.y > KERNEL_RANGE * KERNEL_RANGE) {
+                        continue;
+                    }
+
+                    float v = boundary_volume[b];
+                    s.density += v * sph_kernel(x, KERNEL_RANGE);
+                    s.grad += v * sph_grad_kernel(x, KERNEL_RANGE);
+                    s.grad_poly6 += v * sph_grad_kernel_poly6(x, KERNEL_RANGE);
+                } FOR_ALL_BOUNDARY_NEAR_END()
+            }
+        }
+    });
+}
+
+void sph_boundary_build (float rest_density)
+{
+    boundary_sample();
+    boundary_bin();
+    boundary_volumes(rest_density);
+    boundary_bake();
+
+    built = true;
+    built_rest = rest_density;
+    built_periodic_x = sph_periodic_x;
+    built_periodic_y = sph_periodic_y;
+
+    LOG("boundary: %d samples, %d repeated, %d x %d lookup, rest density %g",
+        (int) boundary_real, (int) (boundary.size() - boundary_real),
+        lookup_w, lookup_h, rest_density);
+}
+
+//
+// Build only if what the samples were built for has changed.
+//
+void sph_boundary_update (float rest_density)
+{
+    if (!built || (built_rest != rest_density) ||
+        (built_periodic_x != sph_periodic_x) ||
+        (built_periodic_y != sph_periodic_y)) {
+        sph_boundary_build(rest_density);
+    }
+}
+
+SphBoundarySample sph_boundary_sample (const fpoint &at)
+{
+    float gx = at.x / BOUNDARY_LOOKUP;
+    float gy = at.y / BOUNDARY_LOOKUP;
+    int i = std::min(std::max((int) gx, 0), lookup_w - 2);
+    int j = std::min(std::max((int) gy, 0), lookup_h - 2);
+    float fx = std::min(std::max(gx - i, 0.0f), 1.0f);
+    float fy = std::min(std::max(gy - j, 0.0f), 1.0f);
+
+    const auto &a = lookup[j * lookup_w + i];
+    const auto &b = lookup[j * lookup_w + i + 1];
+    const auto &c = lookup[(j + 1) * lookup_w + i];
+    const auto &d = lookup[(j + 1) * lookup_w + i + 1];
+
+    float wa = (1 - fx) * (1 - fy), wb = fx * (1 - fy);
+    float wc = (1 - fx) * fy, wd = fx * fy;
+
+    SphBoundarySample s;
+    s.density = a.density * wa + b.density * wb +
+                c.density * wc + d.density * wd;
+    s.grad = a.grad * wa + b.grad * wb + c.grad * wc + d.grad * wd;
+    s.grad_poly6 = a.grad_poly6 * wa + b.grad_poly6 * wb +
+                   c.grad_poly6 * wc + d.grad_poly6 * wd;
+    return (s);
+}
+
+//
+// User has entered a command, run it
+//
+uint8_t sph_boundary_set (tokens_t *tokens, void *context)
+{_
+    char *s = tokens->args[2];
+
+    if (!s || (*s == '\0') || (*s == '1')) {
+        auto solver = sph_solver_current();
+        sph_boundary_update(solver ? solver->wall_density : REST_DENSITY);
+        sph_boundary_enabled = true;
+        CON("boundary particles on, %d samples", (int) boundary_real);
+    } else {
+        sph_boundary_enabled = false;
+        CON("boundary particles off");
+    }
+
+    return (true);
+}
@@ -0,0 +1,188 @@
+//
+// Copyright goblinhack@gmail.com
+// See the README file for license info.
+//
+
+#include "my_game.h"
+#include "my_sph_query.h"
+#include "my_sph_solver.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace Constants;
+
+//
+// Brush size in pixels and strength as an acceleration; the solver works
+// in force density so this is scaled by the particle density when applied.
+//
+static const float BRUSH_RADIUS        = KERNEL_RANGE * 3;
+static const float BRUSH_ACCEL         = GRAVITY * 3;
+static const int   BRUSH_EMIT_PER_TICK = 4;
+
+static const char *brush_names[SPH_BRUSH_MAX] = {
+    "push",
+    "pull",
+    "vortex",
+    "drain",
+    "emit",
+};
+
+static int brush_mode = SPH_BRUSH_PUSH;
+static int brush_active = SPH_BRUSH_MAX;
+
+//
+// Mouse is in window pixels, the simulation is in zoomed pixels.
+//
+static fpoint sph_brush_at (void)
+{
+    return (fpoint((float)mouse_x / game->config.scale_pix_width,
+                   (float)mouse_y / game->config.scale_pix_height));
+}
+
+//
+// True if the mouse is within r of this point.
+//
+bool sph_brush_near (const fpoint &at, float r)
+{
+    fpoint d = sph_brush_at() - at;
+    return (d.x * d.x + d.y * d.y <= r * r);
+}
+
+void sph_brush_down (uint32_t button)
+{_
+    //
+    // Right button does the opposite of the selected brush where there is
+    // such a thing; useful for quickly undoing a push.
+    //
+    if (button == SDL_BUTTON_RIGHT) {
+        switch (brush_mode) {
+            case SPH_BRUSH_PUSH:  brush_active = SPH_BRUSH_PULL;  return;
+            case SPH_BRUSH_PULL:  brush_active = SPH_BRUSH_PUSH;  return;
+            case SPH_BRUSH_EMIT:  brush_active = SPH_BRUSH_DRAIN; return;
+            case SPH_BRUSH_DRAIN: brush_active = SPH_BRUSH_EMIT;  return;
+        }
+    }
+
+    brush_active = brush_mode;
+}
+
+void sph_brush_up (void)
+{_
+    brush_active = SPH_BRUSH_MAX;
+}
+
+static void sph_brush_emit (fpoint at)
+{
+    for (auto i = 0; i < BRUSH_EMIT_PER_TICK; i++) {
+        float angle = ((float) random_range(0, 360)) * (M_PI / 180.0);
+        float dist = ((float) random_range(0, 100)) * (BRUSH_RADIUS / 100.0);
+        fpoint p(at.x + cos(angle) * dist, at.y + sin(angle) * dist);
+
+        if (game->is_oob(p)) {
+            continue;
+        }
+
+        auto np = game->new_particle(p);
+        if (!np) {
+            return;
+        }
+
+        //
+        // This step's densities are already done; give the newcomer a
+        // sane one so the force pass does not divide by zero.
+        //
+        np->density = REST_DENSITY;
+    }
+}
+
+//
+// Called once per solver step, after densities are known and before the
+// force pass, so any force added here is integrated this step.
+//
+void sph_brush_tick (void)
+{
+    if (brush_active == SPH_BRUSH_MAX) {
+        return;
+    }
+
+    //
+    // We can miss the mouse up if a widget eats it.
+    //
+    if (!mouse_down) {
+        brush_active = SPH_BRUSH_MAX;
+        return;
+    }
+
+    auto at = sph_brush_at();
+    sph_sleep_wake(at, BRUSH_RADIUS);
+
+    if (brush_active == SPH_BRUSH_EMIT) {
+        sph_brush_emit(at);
+        return;
+    }
+
+    static ParticleQuery q;
+
+    sph_sort_update(false);
+
+    for (auto idx : q.radius(at, BRUSH_RADIUS)) {
+        auto p = getptr(game->particles, idx);
+        fpoint d = sph_periodic_delta(p->at - at);
+        float dist = sqrt(d.x * d.x + d.y * d.y);
+        if (dist == 0.0f) {
+            continue;
+        }
+
+        //
+        // Cells were woken above, but this step's sleepers were already
+        // chosen.
+        //
+        p->asleep = false;
+
+        float falloff = 1.0f - dist / BRUSH_RADIUS;
+        fpoint dir = d / dist;
+        float f = BRUSH_ACCEL * falloff * p->density;
+
+        switch (brush_active) {
+            case SPH_BRUSH_PUSH:
+                p->force += dir * f;
+                break;
+            case SPH_BRUSH_PULL:
+                p->force -= dir * f;
+                break;
+            case SPH_BRUSH_VORTEX:
+                p->force += fpoint(-dir.y, dir.x) * f;
+                break;
+            case SPH_BRUSH_DRAIN:
+                game->detach_particle(p);
+                game->free_particle(p);
+                break;
+        }
+    }
+}
+
+//
+// User has entered a command, run it
+//
+uint8_t sph_brush_set (tokens_t *tokens, void *context)
+{_
+    char *s = tokens->args[2];
+
+    if (!s || (*s == '\0')) {
+        brush_mode = SPH_BRUSH_PUSH;
+        CON("brush set to %s (default)", brush_names[brush_mode]);
+        return (true);
+    }
+
+    for (auto i = 0; i < SPH_BRUSH_MAX; i++) {
+        if (!strcasecmp(s, brush_names[i])) {
+            brush_mode = i;
+            CON("brush set to %s", brush_names[brush_mode]);
+            return (true);
+        }
+    }
+
+    CON("unknown brush %s; try push, pull, vortex, drain or emit", s);
+    return (false);
+}
@@ -0,0 +1,887 @@
+//
+// Copyright goblinhack@gmail.com
+// See the README file for license info.
+//
+
+#include "my_game.h"
+#include "my_sph_solver.h"
+#include "my_sph_sdf.h"
+#include "my_thread_pool.h"
+
+#include <algorithm>
+#include <vector>
+
+using namespace Constants;
+
+//
+// Grid cell size; with particles at the rest spacing this holds four.
+//
+static const float FLIP_CELL          = KERNEL_RANGE;
+static const float FLIP_PER_CELL      = (FLIP_CELL / REST_SPACING) *
+                                        (FLIP_CELL / REST_SPACING);
+
+//
+// How much of the grid velocity change particles keep (FLIP) rather than
+// taking the grid velocity outright (PIC). Pure FLIP is noisy; pure PIC
+// is viscous.
+//
+static const float FLIP_RATIO         = 0.95;
+
+//
+// Fraction of a cell a particle may cross per step, and how far past the
+// force based solvers' largest step this solver may go.
+//
+static const float FLIP_CFL           = 1.0;
+static const float FLIP_DT_SCALE      = 10.0;
+
+//
+// Fraction of any overfilling of a cell to push back out each step.
+// Particles drift together over time under FLIP; without this they pile
+// up until the grid slots overflow.
+//
+static const float FLIP_DRIFT         = 0.5;
+
+//
+// Pressure solve: stop when the largest residual is this fraction of the
+// largest divergence.
+//
+static const float FLIP_TOLERANCE     = 1e-4;
+static const int   FLIP_MAX_ITERATIONS = 200;
+
+//
+// Multigrid preconditioner: damped Jacobi sweeps either side of each
+// coarse correction, more on the coarsest level, which is never coarser
+// than this.
+//
+static const int   FLIP_SMOOTH        = 2;
+static const int   FLIP_COARSE_SMOOTH = 30;
+static const int   FLIP_COARSE_MIN    = 4;
+static const float FLIP_JACOBI        = 2.0 / 3.0;
+
+//
+// Grids smaller than this are not worth waking the thread pool for.
+//
+static const int   FLIP_PARALLEL_MIN  = 1024;
+
+enum {
+    FLIP_SOLID,
+    FLIP_AIR,
+    FLIP_FLUID,
+};
+
+//
+// One level of the multigrid hierarchy for the pressure Poisson equation.
+// Level 0 is the simulation grid.
+//
+typedef struct {
+    int w, h;
+    std::vector<uint8_t> type;
+    std::vector<uint8_t> diag;
+    std::vector<float> x;
+    std::vector<float> b;
+    std::vector<float> r;
+} FLIPLevel;
+
+//
+// One per pool chunk; aligned so chunks do not share cache lines.
+//
+typedef struct alignas(64) {
+    double sum;
+    float max;
+} FLIPPartial;
+
+//
+// Hybrid particle/grid solver. Particle velocities are scattered onto a
+// staggered MAC grid, made divergence free there with a multigrid
+// preconditioned conjugate gradient solve, and the change gathered back
+// to the particles. The cost is in the grid, not in particle pairs, so it
+// scales to far more particles than the SPH solvers.
+//
+class FLIPSolver : public SPHSolver {
+public:
+    FLIPSolver(void);
+    const char *name (void) const { return ("flip"); }
+    float choose_dt(void);
+    void update(float dt);
+    void seed(void);
+
+private:
+    void resize(void);
+    void bin(void);
+    void scatter(void);
+    void extrapolate(std::vector<float> &vel, std::vector<uint8_t> &valid,
+                     int w, int h);
+    void classify(void);
+    void coarsen(void);
+    void solve(float dt);
+    void project(void);
+    void gather(float dt);
+
+    void apply(FLIPLevel &l, const std::vector<float> &in,
+               std::vector<float> &out);
+    void smooth(FLIPLevel &l, int sweeps);
+    void vcycle(size_t level);
+    double dot(const std::vector<float> &a, const std::vector<float> &b);
+    float max_abs(const std::vector<float> &a);
+
+    template <class F> void rows(int n, int cells, F fn);
+
+    //
+    // Cells across and down, and the top left of the grid.
+    //
+    int nx {};
+    int ny {};
+    fpoint origin;
+
+    //
+    // Face velocities: u on vertical faces, (nx + 1) x ny; v on horizontal
+    // faces, nx x (ny + 1). The old copies are from before the pressure
+    // solve, for the FLIP update.
+    //
+    std::vector<float> u, v;
+    std::vector<float> u_old, v_old;
+    std::vector<uint8_t> u_valid, v_valid;
+    std::vector<uint8_t> valid_next;
+    std::vector<float> vel_next;
+
+    //
+    // Particles sorted by cell.
+    //
+    std::vector<uint32_t> cell_start;
+    std::vector<uint16_t> cell_list;
+
+    std::vector<FLIPLevel> levels;
+
+    //
+    // Conjugate gradient vectors over level 0.
+    //
+    std::vector<float> pressure, residual, z, search, q;
+
+    std::vector<FLIPPartial> partials;
+
+    std::array<fpoint, PARTICLE_MAX> new_at {};
+
+    float rest_density {};
+};
+
+FLIPSolver::FLIPSolver (void)
+{
+    float unused1, unused2;
+    rest_density = sph_lattice_density(REST_SPACING, &unused1, &unused2);
+    wall_density = rest_density;
+
+    LOG("flip: %.0f px cells, rest density %g", FLIP_CELL, rest_density);
+}
+
+void FLIPSolver::seed (void)
+{
+    seed_lattice(REST_SPACING);
+}
+
+float FLIPSolver::choose_dt (void)
+{
+    if (!sph_dt_adaptive) {
+        return (TIMESTEP);
+    }
+
+    float dt = sph_dt_max * FLIP_DT_SCALE;
+
+    if (have_limits && (max_v2 > 0)) {
+        dt = std::min(dt, FLIP_CFL * FLIP_CELL / (float) sqrt(max_v2));
+    }
+
+    dt = std::min(dt, (float) sqrt(FLIP_CFL * FLIP_CELL / GRAVITY));
+
+    return (std::max(dt, sph_dt_min));
+}
+
+//
+// Run fn over [0, n) rows, across the pool if the grid is big enough.
+//
+template <class F> void FLIPSolver::rows (int n, int cells, F fn)
+{
+    if (cells < FLIP_PARALLEL_MIN) {
+        fn(0, n, 0);
+        return;
+    }
+
+    thread_pool()->parallel_for(n, fn);
+}
+
+//
+// The grid covers the area inside the walls; redone if the window changed.
+//
+void FLIPSolver::resize (void)
+{
+    int w = (GL_WIDTH - GL_BORDER * 2) / FLIP_CELL;
+    int h = (GL_HEIGHT - GL_BORDER * 2) / FLIP_CELL;
+
+    w = std::max(w, 1);
+    h = std::max(h, 1);
+
+    if ((w == nx) && (h == ny)) {
+        return;
+    }
+
+    nx = w;
+    ny = h;
+    origin = fpoint(GL_BORDER, GL_BORDER);
+
+    u.assign((nx + 1) * ny, 0);
+    v.assign(nx * (ny + 1), 0);
+    u_old = u;
+    v_old = v;
+    u_valid.assign(u.size(), 0);
+    v_valid.assign(v.size(), 0);
+    cell_start.assign(nx * ny + 1, 0);
+
+    levels.clear();
+    int lw = nx, lh = ny;
+    for (;;) {
+        FLIPLevel l;
+        l.w = lw;
+        l.h = lh;
+        l.type.assign(lw * lh, FLIP_AIR);
+        l.diag.assign(lw * lh, 0);
+        l.x.assign(lw * lh, 0);
+        l.b.assign(lw * lh, 0);
+        l.r.assign(lw * lh, 0);
+        levels.push_back(l);
+
+        if ((lw <= FLIP_COARSE_MIN) || (lh <= FLIP_COARSE_MIN)) {
+            break;
+        }
+        lw = (lw + 1) / 2;
+        lh = (lh + 1) / 2;
+    }
+
+    pressure.assign(nx * ny, 0);
+    residual = pressure;
+    z = pressure;
+    search = pressure;
+    q = pressure;
+
+    partials.resize(thread_pool()->size());
+
+    LOG("flip: %d x %d grid, %d multigrid levels", nx, ny,
+        (int) levels.size());
+}
+
+//
+// Counting sort of particles into cells; also takes each particle's
+// density from how full its cell is, which is what the brush and stats
+// go by.
+//
+void FLIPSolver::bin (void)
+{
+    std::fill(cell_start.begin(), cell_start.end(), 0);
+    cell_list.resize(game->num_particles + 1);
+
+    auto cell_of = [&](const fpoint &at) {
+        int i = (at.x - origin.x) / FLIP_CELL;
+        int j = (at.y - origin.y) / FLIP_CELL;
+        i = std::min(std::max(i, 0), nx - 1);
+        j = std::min(std::max(j, 0), ny - 1);
+        return (j * nx + i);
+    };
+
+    {
+        FOR_ALL_PARTICLES(p) {
+            cell_start[cell_of(p->at) + 1]++;
+        } FOR_ALL_PARTICLES_END()
+    }
+
+    for (auto c = 0; c < nx * ny; c++) {
+        cell_start[c + 1] += cell_start[c];
+    }
+
+    std::vector<uint32_t> next(cell_start.begin(), cell_start.end() - 1);
+
+    {
+        FOR_ALL_PARTICLES(p) {
+            auto c = cell_of(p->at);
+            cell_list[next[c]++] = pidx;
+            p->density = rest_density *
+                         (cell_start[c + 1] - cell_start[c]) / FLIP_PER_CELL;
+        } FOR_ALL_PARTICLES_END()
+    }
+}
+
+//
+// Particle to grid. Each face gathers from the particles in the cells
+// around it, so rows of faces can be filled in parallel without any two
+// threads writing the same face.
+//
+void FLIPSolver::scatter (void)
+{
+    auto face = [&](std::vector<float> &vel, std::vector<uint8_t> &valid,
+                    int w, int h, fpoint offset, bool is_u) {
+        rows(h, w * h, [&](int begin, int end, int chunk) {
+            for (auto j = begin; j < end; j++) {
+                for (auto i = 0; i < w; i++) {
+                    fpoint f = origin + fpoint(i + offset.x, j + offset.y) *
+                                        FLIP_CELL;
+                    int ci = (f.x - origin.x) / FLIP_CELL;
+                    int cj = (f.y - origin.y) / FLIP_CELL;
+                    float sum = 0, weight = 0;
+
+                    for (auto y = cj - 1; y <= cj + 1; y++) {
+                        if ((y < 0) || (y >= ny)) {
+                            continue;
+                        }
+                        for (auto x = ci - 1; x <= ci + 1; x++) {
+                            if ((x < 0) || (x >= nx)) {
+                                continue;
+                            }
+                            auto c = y * nx + x;
+                            for (auto n = cell_start[c];
+                                 n < cell_start[c + 1]; n++) {
+                                auto p = getptr(game->particles, cell_list[n]);
+                                float wx = 1.0f - fabs(p->at.x - f.x) /
+                                                  FLIP_CELL;
+                                float wy = 1.0f - fabs(p->at.y - f.y) /
+                                                  FLIP_CELL;
+                                if ((wx <= 0) || (wy <= 0)) {
+                                    continue;
+                                }
+                                sum += wx * wy *
+                                       (is_u ? p->velocity.x : p->velocity.y);
+                                weight += wx * wy;
+                            }
+                        }
+                    }
+
+                    auto idx = j * w + i;
+                    if (weight > 0) {
+                        vel[idx] = sum / weight;
+                        valid[idx] = true;
+                    } else {
+                        vel[idx] = 0;
+                        valid[idx] = false;
+                    }
+                }
+            }
+        });
+    };
+
+    face(u, u_valid, nx + 1, ny, fpoint(0, 0.5), true);
+    face(v, v_valid, nx, ny + 1, fpoint(0.5, 0), false);
+
+    extrapolate(u, u_valid, nx + 1, ny);
+    extrapolate(v, v_valid, nx, ny + 1);
+
+    //
+    // Walls.
+    //
+    for (auto j = 0; j < ny; j++) {
+        u[j * (nx + 1)] = 0;
+        u[j * (nx + 1) + nx] = 0;
+    }
+    for (auto i = 0; i < nx; i++) {
+        v[i] = 0;
+        v[ny * nx + i] = 0;
+    }
+
+    u_old = u;
+    v_old = v;
+}
+
+//
+// Faces no particle reached take the mean of their valid neighbours, for
+// two layers, so particles near the surface gather something sensible.
+//
+void FLIPSolver::extrapolate (std::vector<float> &vel,
+                              std::vector<uint8_t> &valid, int w, int h)
+{
+    for (auto layer = 0; layer < 2; layer++) {
+        vel_next = vel;
+        valid_next = valid;
+
+        rows(h, w * h, [&](int begin, int end, int chunk) {
+            for (auto j = begin; j < end; j++) {
+                for (auto i = 0; i < w; i++) {
+                    auto idx = j * w + i;
+                    if (valid[idx]) {
+                        continue;
+                    }
+
+                    float sum = 0;
+                    int n = 0;
+                    if ((i > 0) && valid[idx - 1]) { sum += vel[idx - 1]; n++; }
+                    if ((i < w - 1) && valid[idx + 1]) { sum += vel[idx + 1]; n++; }
+                    if ((j > 0) && valid[idx - w]) { sum += vel[idx - w]; n++; }
+                    if ((j < h - 1) && valid[idx + w]) { sum += vel[idx + w]; n++; }
+
+                    if (n) {
+                        vel_next[idx] = sum / n;
+                        valid_next[idx] = true;
+                    }
+                }
+            }
+        });
+
+        vel.swap(vel_next);
+        valid.swap(valid_next);
+    }
+}
+
+//
+// Cells with particles are fluid, the rest air; outside the grid and
+// cells whose centre is inside an obstacle are wall, and no flow crosses
+// the faces of those.
+//
+void FLIPSolver::classify (void)
+{
+    auto &l = levels[0];
+
+    for (auto c = 0; c < nx * ny; c++) {
+        l.type[c] = (cell_start[c + 1] > cell_start[c]) ? FLIP_FLUID : FLIP_AIR;
+    }
+
+    if (!sph_sdf_loaded) {
+        return;
+    }
+
+    for (auto j = 0; j < ny; j++) {
+        for (auto i = 0; i < nx; i++) {
+            fpoint at = origin + fpoint((i + 0.5f) * FLIP_CELL,
+                                        (j + 0.5f) * FLIP_CELL);
+            if (!sph_sdf_inside(at)) {
+                continue;
+            }
+
+            l.type[j * nx + i] = FLIP_SOLID;
+            u[j * (nx + 1) + i] = 0;
+            u[j * (nx + 1) + i + 1] = 0;
+            v[j * nx + i] = 0;
+            v[(j + 1) * nx + i] = 0;
+        }
+    }
+}
+
+//
+// A coarse cell is air if any of its children are, so the free surface
+// survives coarsening; otherwise fluid if any child is.
+//
+void FLIPSolver::coarsen (void)
+{
+    for (size_t n = 0; n < levels.size(); n++) {
+        auto &l = levels[n];
+
+        if (n) {
+            auto &f = levels[n - 1];
+            for (auto j = 0; j < l.h; j++) {
+                for (auto i = 0; i < l.w; i++) {
+                    bool air = false, fluid = false;
+                    for (auto y = j * 2; y < std::min(j * 2 + 2, f.h); y++) {
+                        for (auto x = i * 2; x < std::min(i * 2 + 2, f.w); x++) {
+                            auto t = f.type[y * f.w + x];
+                            air |= (t == FLIP_AIR);
+                            fluid |= (t == FLIP_FLUID);
+                        }
+                    }
+                    l.type[j * l.w + i] = air ? FLIP_AIR :
+                                          fluid ? FLIP_FLUID : FLIP_SOLID;
+                }
+            }
+        }
+
+        //
+        // Walls take no part in the stencil.
+        //
+        for (auto j = 0; j < l.h; j++) {
+            for (auto i = 0; i < l.w; i++) {
+                uint8_t d = 0;
+                d += (i > 0) && (l.type[j * l.w + i - 1] != FLIP_SOLID);
+                d += (i < l.w - 1) && (l.type[j * l.w + i + 1] != FLIP_SOLID);
+                d += (j > 0) && (l.type[(j - 1) * l.w + i] != FLIP_SOLID);
+                d += (j < l.h - 1) && (l.type[(j + 1) * l.w + i] != FLIP_SOLID);
+                l.diag[j * l.w + i] = d;
+            }
+        }
+    }
+}
+
+//
+// The pressure Laplacian over fluid cells: air neighbours are zero
+// pressure, walls are left out.
+//
+void FLIPSolver::apply (FLIPLevel &l, const std::vector<float> &in,
+                        std::vector<float> &out)
+{
+    rows(l.h, l.w * l.h, [&](int begin, int end, int chunk) {
+        for (auto j = begin; j < end; j++) {
+            for (auto i = 0; i < l.w; i++) {
+                auto idx = j * l.w + i;
+                if (l.type[idx] != FLIP_FLUID) {
+                    out[idx] = 0;
+                    continue;
+                }
+
+                float s = l.diag[idx] * in[idx];
+                if ((i > 0) && (l.type[idx - 1] == FLIP_FLUID)) {
+                    s -= in[idx - 1];
+                }
+                if ((i < l.w - 1) && (l.type[idx + 1] == FLIP_FLUID)) {
+                    s -= in[idx + 1];
+                }
+                if ((j > 0) && (l.type[idx - l.w] == FLIP_FLUID)) {
+                    s -= in[idx - l.w];
+                }
+                if ((j < l.h - 1) && (l.type[idx + l.w] == FLIP_FLUID)) {
+                    s -= in[idx + l.w];
+                }
+                out[idx] = s;
+            }
+        }
+    });
+}
+
+void FLIPSolver::smooth (FLIPLevel &l, int sweeps)
+{
+    for (auto s = 0; s < sweeps; s++) {
+        apply(l, l.x, l.r);
+
+        rows(l.h, l.w * l.h, [&](int begin, int end, int chunk) {
+            for (auto idx = begin * l.w; idx < end * l.w; idx++) {
+                if ((l.type[idx] == FLIP_FLUID) && l.diag[idx]) {
+                    l.x[idx] += FLIP_JACOBI * (l.b[idx] - l.r[idx]) /
+                                l.diag[idx];
+                }
+            }
+        });
+    }
+}
+
+//
+// One V-cycle from zero, approximately solving level x from level b.
+// Smoothing is the same either side of the coarse correction and the
+// transfers are transposes of each other, so this stays symmetric and
+// can precondition conjugate gradient.
+//
+void FLIPSolver::vcycle (size_t level)
+{
+    auto &l = levels[level];
+
+    std::fill(l.x.begin(), l.x.end(), 0);
+
+    if (level == levels.size() - 1) {
+        smooth(l, FLIP_COARSE_SMOOTH);
+        return;
+    }
+
+    smooth(l, FLIP_SMOOTH);
+
+    apply(l, l.x, l.r);
+    auto &c = levels[level + 1];
+
+    //
+    // Restrict by summing children. With piecewise constant transfers the
+    // coarse operator is twice the coarse Laplacian, hence the half.
+    //
+    for (auto j = 0; j < c.h; j++) {
+        for (auto i = 0; i < c.w; i++) {
+            float s = 0;
+            if (c.type[j * c.w + i] == FLIP_FLUID) {
+                for (auto y = j * 2; y < std::min(j * 2 + 2, l.h); y++) {
+                    for (auto x = i * 2; x < std::min(i * 2 + 2, l.w); x++) {
+                        auto idx = y * l.w + x;
+                        if (l.type[idx] == FLIP_FLUID) {
+                            s += l.b[idx] - l.r[idx];
+                        }
+                    }
+                }
+            }
+            c.b[j * c.w + i] = 0.5f * s;
+        }
+    }
+
+    vcycle(level + 1);
+
+    rows(l.h, l.w * l.h, [&](int begin, int end, int chunk) {
+        for (auto j = begin; j < end; j++) {
+            for (auto i = 0; i < l.w; i++) {
+                auto idx = j * l.w + i;
+                if (l.type[idx] == FLIP_FLUID) {
+                    l.x[idx] += c.x[(j / 2) * c.w + i / 2];
+                }
+            }
+        }
+    });
+
+    smooth(l, FLIP_SMOOTH);
+}
+
+double FLIPSolver::dot (const std::vector<float> &a,
+                        const std::vector<float> &b)
+{
+    std::fill(partials.begin(), partials.end(), FLIPPartial {});
+
+    rows(ny, nx * ny, [&](int begin, int end, int chunk) {
+        double s = 0;
+        for (auto idx = begin * nx; idx < end * nx; idx++) {
+            s += a[idx] * b[idx];
+        }
+        partials[chunk].sum = s;
+    });
+
+    double s = 0;
+    for (const auto &p : partials) {
+        s += p.sum;
+    }
+    return (s);
+}
+
+float FLIPSolver::max_abs (const std::vector<float> &a)
+{
+    std::fill(partials.begin(), partials.end(), FLIPPartial {});
+
+    rows(ny, nx * ny, [&](int begin, int end, int chunk) {
+        float m = 0;
+        for (auto idx = begin * nx; idx < end * nx; idx++) {
+            m = std::max(m, (float) fabs(a[idx]));
+        }
+        partials[chunk].max = m;
+    });
+
+    float m = 0;
+    for (const auto &p : partials) {
+        m = std::max(m, p.max);
+    }
+    return (m);
+}
+
+//
+// Pressure, scaled to be in velocity units, that makes the grid velocity
+// divergence free apart from pushing overfull cells back out.
+//
+void FLIPSolver::solve (float dt)
+{
+    auto &l = levels[0];
+    float worst = 0;
+
+    for (auto j = 0; j < ny; j++) {
+        for (auto i = 0; i < nx; i++) {
+            auto idx = j * nx + i;
+            pressure[idx] = 0;
+
+            if (l.type[idx] != FLIP_FLUID) {
+                residual[idx] = 0;
+                continue;
+            }
+
+            float div = u[j * (nx + 1) + i + 1] - u[j * (nx + 1) + i] +
+                        v[(j + 1) * nx + i] - v[j * nx + i];
+
+            float fill = (cell_start[idx + 1] - cell_start[idx]) /
+                         FLIP_PER_CELL - 1.0f;
+            fill = std::min(std::max(fill, 0.0f), 1.0f);
+            worst = std::max(worst, fill);
+
+            residual[idx] = FLIP_DRIFT * fill * FLIP_CELL / dt - div;
+        }
+    }
+
+    density_error = worst;
+    iterations = 0;
+
+    float tolerance = FLIP_TOLERANCE * max_abs(residual);
+    if (tolerance <= 0) {
+        return;
+    }
+
+    l.b = residual;
+    vcycle(0);
+    z = l.x;
+    search = z;
+
+    double rho = dot(residual, z);
+
+    while (iterations < FLIP_MAX_ITERATIONS) {
+        iterations++;
+
+        apply(l, search, q);
+        double sq = dot(search, q);
+        if (sq <= 0) {
+            break;
+        }
+
+        float alpha = rho / sq;
+        rows(ny, nx * ny, [&](int begin, int end, int chunk) {
+            for (auto idx = begin * nx; idx < end * nx; idx++) {
+                pressure[idx] += alpha * search[idx];
+                residual[idx] -= alpha * q[idx];
+            }
+        });
+
+        if (max_abs(residual) <= tolerance) {
+            break;
+        }
+
+        l.b = residual;
+        vcycle(0);
+        z = l.x;
+
+        double rho_new = dot(residual, z);
+        float beta = rho_new / rho;
+        rho = rho_new;
+
+        rows(ny, nx * ny, [&](int begin, int end, int chunk) {
+            for (auto idx = begin * nx; idx < end * nx; idx++) {
+                search[idx] = z[idx] + beta * search[idx];
+            }
+        });
+    }
+}
+
+//
+// Subtract the pressure gradient from every face that touches fluid and
+// no wall.
+//
+static inline bool flip_open (uint8_t a, uint8_t b)
+{
+    return (((a == FLIP_FLUID) || (b == FLIP_FLUID)) &&
+            (a != FLIP_SOLID) && (b != FLIP_SOLID));
+}
+
+void FLIPSolver::project (void)
+{
+    auto &type = levels[0].type;
+
+    rows(ny, nx * ny, [&](int begin, int end, int chunk) {
+        for (auto j = begin; j < end; j++) {
+            for (auto i = 1; i < nx; i++) {
+                auto a = j * nx + i - 1, b = j * nx + i;
+                if (flip_open(type[a], type[b])) {
+                    u[j * (nx + 1) + i] -= pressure[b] - pressure[a];
+                }
+            }
+            if (j == 0) {
+                continue;
+            }
+            for (auto i = 0; i < nx; i++) {
+                auto a = (j - 1) * nx + i, b = j * nx + i;
+                if (flip_open(type[a], type[b])) {
+                    v[j * nx + i] -= pressure[b] - pressure[a];
+                }
+            }
+        }
+    });
+}
+
+//
+// Bilinear sample of a face grid at a point.
+//
+static inline float flip_sample (const std::vector<float> &vel, int w, int h,
+                                 fpoint at, fpoint offset)
+{
+    float gx = at.x / FLIP_CELL - offset.x;
+    float gy = at.y / FLIP_CELL - offset.y;
+    int i = std::min(std::max((int) floor(gx), 0), w - 2);
+    int j = std::min(std::max((int) floor(gy), 0), h - 2);
+    float fx = std::min(std::max(gx - i, 0.0f), 1.0f);
+    float fy = std::min(std::max(gy - j, 0.0f), 1.0f);
+
+    auto idx = j * w + i;
+    return ((vel[idx] * (1 - fx) + vel[idx + 1] * fx) * (1 - fy) +
+            (vel[idx + w] * (1 - fx) + vel[idx + w + 1] * fx) * fy);
+}
+
+//
+// Grid to particle, then move particles with the grid velocity. Positions
+// are worked out in parallel; the particle grid is updated after, as
+// attaching is not thread safe.
+//
+void FLIPSolver::gather (float dt)
+{
+    float lo_x = origin.x, hi_x = origin.x + nx * FLIP_CELL - 0.01f;
+    float lo_y = origin.y, hi_y = origin.y + ny * FLIP_CELL - 0.01f;
+
+    std::fill(partials.begin(), partials.end(), FLIPPartial {});
+
+    thread_pool()->parallel_for(PARTICLE_MAX,
+                                [&](int begin, int end, int chunk) {
+        float v2max = 0;
+
+        for (auto pidx = begin; pidx < end; pidx++) {
+            auto p = getptr(game->particles, pidx);
+            if (!p->in_use) {
+                continue;
+            }
+
+            fpoint at = p->at - origin;
+            fpoint pic(flip_sample(u, nx + 1, ny, at, fpoint(0, 0.5)),
+                       flip_sample(v, nx, ny + 1, at, fpoint(0.5, 0)));
+            fpoint old(flip_sample(u_old, nx + 1, ny, at, fpoint(0, 0.5)),
+                       flip_sample(v_old, nx, ny + 1, at, fpoint(0.5, 0)));
+
+            fpoint flip = p->velocity + pic - old;
+            p->velocity = pic * (1.0f - FLIP_RATIO) + flip * FLIP_RATIO;
+
+            fpoint to = p->at + pic * dt;
+            sph_sdf_collide(to, &p->velocity, bounce);
+            if (to.x < lo_x) {
+                to.x = lo_x;
+                p->velocity.x = std::max(p->velocity.x, 0.0f);
+            } else if (to.x > hi_x) {
+                to.x = hi_x;
+                p->velocity.x = std::min(p->velocity.x, 0.0f);
+            }
+            if (to.y < lo_y) {
+                to.y = lo_y;
+                p->velocity.y = std::max(p->velocity.y, 0.0f);
+            } else if (to.y > hi_y) {
+                to.y = hi_y;
+                p->velocity.y = std::min(p->velocity.y, 0.0f);
+            }
+            new_at[pidx] = to;
+
+            v2max = std::max(v2max, p->velocity.x * p->velocity.x +
+                                    p->velocity.y * p->velocity.y);
+        }
+
+        partials[chunk].max = v2max;
+    });
+
+    max_v2 = 0;
+    for (const auto &p : partials) {
+        max_v2 = std::max(max_v2, p.max);
+    }
+    have_limits = true;
+
+    FOR_ALL_PARTICLES(p) {
+        game->move_particle(p, new_at[pidx]);
+    } FOR_ALL_PARTICLES_END()
+}
+
+void FLIPSolver::update (float dt)
+{
+    resize();
+
+    //
+    // The brush may drain or emit particles, so it goes before they are
+    // binned; its forces are scaled by last step's cell densities.
+    //
+    sph_brush_tick();
+    bin();
+
+    FOR_ALL_PARTICLES(p) {
+        fpoint accel(0, GRAVITY);
+        if (p->density > 0) {
+            accel += p->force / p->density;
+        }
+        p->velocity += dt * accel;
+    } FOR_ALL_PARTICLES_END()
+
+    scatter();
+    classify();
+    coarsen();
+    solve(dt);
+    project();
+    gather(dt);
+}
+
+SPHSolver *sph_solver_new_flip (void)
+{
+    return (new FLIPSolver());
+}
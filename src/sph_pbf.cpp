@@ -0,0 +1,383 @@
+//
+// Copyright goblinhack@gmail.com
+// See the README file for license info.
+//
+
+#include "my_game.h"
+#include "my_sph_solver.h"
+#include "my_sph_sdf.h"
+
+#include <algorithm>
+
+using namespace Constants;
+
+int sph_pbf_iterations = 30;
+int sph_pbf_substeps = 2;
+float sph_pbf_dt = TIMESTEP * 10;
+
+//
+// Softens the constraint solve, as a fraction of the denominator for a
+// full neighbourhood at rest. Keeps sparse particles from being flung.
+//
+static const float PBF_RELAXATION = 0.1;
+
+//
+// XSPH velocity smoothing; stands in for viscosity and is stable at any
+// timestep.
+//
+static const float PBF_XSPH = 0.05;
+
+//
+// Pairs closer than this are treated as this far apart. The constraint
+// gradient vanishes as particles meet, so particles stacked in a corner
+// would otherwise never be separated.
+//
+static const float PBF_MIN_SEPARATION = REST_SPACING / 10;
+
+//
+// Fraction of the kernel a particle may cross per substep. Past a fifth
+// the Jacobi iterations no longer undo each substep's compression and the
+// fluid is thrown about.
+//
+static const float PBF_CFL = 0.2;
+
+//
+// Position based fluids (Macklin and Mueller). Each substep predicts
+// positions from velocity, then projects them back onto constant density
+// with a few Jacobi iterations, and takes the velocity from how far each
+// particle actually moved. Nothing here is stiff, so it stays stable at
+// timesteps far past what the force based solvers can take.
+//
+class PBFSolver : public SPHSolver {
+public:
+    PBFSolver(void);
+    const char *name (void) const { return ("pbf"); }
+    float choose_dt(void);
+    void update(float dt);
+    void seed(void);
+
+private:
+    float substep_limit(void);
+    void predict(float dt);
+    float calculateLambda(void);
+    float calculateDelta(void);
+    void refind(void);
+    void updateVelocity(float dt);
+
+    SPHNeighbours nebs;
+
+    //
+    // Per particle scratch, indexed like game->particles.
+    //
+    std::array<fpoint, PARTICLE_MAX> prev_at {};
+    std::array<fpoint, PARTICLE_MAX> pred_at {};
+    std::array<float, PARTICLE_MAX> lambda {};
+    std::array<fpoint, PARTICLE_MAX> delta_at {};
+
+    float rest_density {};
+    float relaxation {};
+};
+
+PBFSolver::PBFSolver (void)
+{
+    float unused1, unused2;
+    rest_density = sph_lattice_density(REST_SPACING, &unused1, &unused2);
+    wall_density = rest_density;
+
+    //
+    // The constraint gradient must match the kernel density is measured
+    // with; the spiky gradient the force solvers use overstates how much
+    // close pairs contribute and the projection then fails to converge.
+    //
+    float h = KERNEL_RANGE;
+    int n = ceil(h / REST_SPACING);
+    float scale = PARTICLE_MASS / rest_density;
+    float grad2 = 0.0f;
+
+    for (auto x = -n; x <= n; x++) {
+        for (auto y = -n; y <= n; y++) {
+            fpoint r(x * REST_SPACING, y * REST_SPACING);
+            fpoint g = sph_grad_kernel_poly6(r, h) * scale;
+            grad2 += g.x * g.x + g.y * g.y;
+        }
+    }
+
+    relaxation = PBF_RELAXATION * grad2;
+
+    LOG("pbf: rest density %g at spacing %g", rest_density, REST_SPACING);
+}
+
+void PBFSolver::seed (void)
+{
+    seed_lattice(REST_SPACING);
+}
+
+//
+// The constraints are solved implicitly so neither stiffness nor viscosity
+// limit the step; the substeps it is split into are limited instead, see
+// below.
+//
+float PBFSolver::choose_dt (void)
+{
+    if (!sph_dt_adaptive) {
+        return (TIMESTEP);
+    }
+
+    return (std::max(std::min(sph_pbf_dt, sph_dt_max), sph_dt_min));
+}
+
+//
+// Longest substep that keeps the projection converging: each particle
+// may move only a small part of the kernel from where the last one left
+// it, or a few Jacobi iterations cannot undo the compression:
+//
+//   |v| dt + g dt^2 <= CFL h
+//
+float PBFSolver::substep_limit (void)
+{
+    float v = have_limits ? sqrt(max_v2) : 0.0f;
+    float reach = PBF_CFL * KERNEL_RANGE;
+
+    return ((2.0f * reach) /
+            (v + (float) sqrt(v * v + 4.0f * GRAVITY * reach)));
+}
+
+static inline fpoint pbf_clamp (fpoint at)
+{
+    sph_sdf_collide(at, nullptr, 0.0f);
+    return (sph_wall_clamp(at));
+}
+
+//
+// Stacked pairs are split along a direction that is opposite for the other
+// particle of the pair.
+//
+static inline fpoint pbf_separation (fpoint x, int pidx, int qidx)
+{
+    const float min = PBF_MIN_SEPARATION;
+    if (likely((x.x * x.x + x.y * x.y >= min * min) || (pidx == qidx))) {
+        return (x);
+    }
+
+    fpoint d(pidx < qidx ? -min : min, (pidx ^ qidx) & 1 ? -min : min);
+    if (pidx > qidx) {
+        d.y = -d.y;
+    }
+    return (d * 0.7071f);
+}
+
+//
+// Apply gravity and any brush force, then move every particle to where it
+// would be with no constraints. The grid follows so the neighbour search
+// below sees the predicted layout.
+//
+void PBFSolver::predict (float dt)
+{
+    FOR_ALL_PARTICLES(p) {
+        fpoint accel(0, GRAVITY);
+        if (p->density > 0) {
+            accel += p->force / p->density;
+        }
+
+        p->velocity += dt * accel;
+
+        prev_at[pidx] = p->at;
+        game->move_particle(p, pbf_clamp(p->at + dt * p->velocity));
+        pred_at[pidx] = p->at;
+    } FOR_ALL_PARTICLES_END()
+}
+
+//
+// Constraint C = density / rest - 1, only when compressed. Returns the
+// worst relative compression.
+//
+float PBFSolver::calculateLambda (void)
+{
+    float scale = PARTICLE_MASS / rest_density;
+    float worst = 0.0f;
+
+    FOR_ALL_PARTICLES(p) {
+        float densitySum = 0.0f;
+        fpoint gradSum(0.0f, 0.0f);
+        float grad2 = 0.0f;
+
+        FOR_ALL_CACHED_NEBS(nebs, pidx, qidx) {
+            fpoint x = sph_periodic_delta(pred_at[pidx] -
+                                          pred_at[qidx]);
+            densitySum += PARTICLE_MASS * sph_kernel(x, KERNEL_RANGE);
+
+            fpoint g = sph_grad_kernel_poly6(pbf_separation(x, pidx, qidx),
+                                             KERNEL_RANGE) * scale;
+            gradSum += g;
+            grad2 += g.x * g.x + g.y * g.y;
+        } FOR_ALL_CACHED_NEBS_END()
+
+        //
+        // The walls add density and steepen the constraint, but cannot be
+        // moved, so add nothing to the sum over movable neighbours.
+        //
+        SphBoundarySample b;
+        if (sph_boundary_lookup(pred_at[pidx], &b)) {
+            densitySum += b.density;
+            gradSum += b.grad_poly6 * (1.0f / rest_density);
+        }
+
+        p->density = densitySum;
+
+        float c = std::max(densitySum / rest_density - 1.0f, 0.0f);
+        float denom = gradSum.x * gradSum.x + gradSum.y * gradSum.y + grad2;
+        lambda[pidx] = -c / (denom + relaxation);
+
+        worst = std::max(worst, c);
+    } FOR_ALL_PARTICLES_END()
+
+    return (worst);
+}
+
+//
+// Jacobi update: every correction is worked out from the same positions,
+// then all are applied. Returns the furthest any particle now is from
+// where its neighbours were found, squared.
+//
+float PBFSolver::calculateDelta (void)
+{
+    float scale = PARTICLE_MASS / rest_density;
+
+    FOR_ALL_PARTICLES(p) {
+        fpoint d(0.0f, 0.0f);
+
+        FOR_ALL_CACHED_NEBS(nebs, pidx, qidx) {
+            fpoint x = sph_periodic_delta(pred_at[pidx] -
+                                          pred_at[qidx]);
+            x = pbf_separation(x, pidx, qidx);
+            d += (lambda[pidx] + lambda[qidx]) *
+                 sph_grad_kernel_poly6(x, KERNEL_RANGE);
+        } FOR_ALL_CACHED_NEBS_END()
+
+        delta_at[pidx] = d * scale;
+
+        SphBoundarySample b;
+        if (sph_boundary_lookup(pred_at[pidx], &b)) {
+            delta_at[pidx] += lambda[pidx] * b.grad_poly6 *
+                              (1.0f / rest_density);
+        }
+    } FOR_ALL_PARTICLES_END()
+
+    float drift = 0.0f;
+
+    {
+        FOR_ALL_PARTICLES(p) {
+            pred_at[pidx] = pbf_clamp(pred_at[pidx] + delta_at[pidx]);
+
+            fpoint d = sph_periodic_delta(pred_at[pidx] - p->at);
+            drift = std::max(drift, d.x * d.x + d.y * d.y);
+        } FOR_ALL_PARTICLES_END()
+    }
+
+    return (drift);
+}
+
+//
+// Move particles to where the solve has them and find their neighbours
+// again there.
+//
+void PBFSolver::refind (void)
+{
+    FOR_ALL_PARTICLES(p) {
+        game->move_particle(p, pred_at[pidx]);
+    } FOR_ALL_PARTICLES_END()
+
+    nebs.find(KERNEL_RANGE);
+}
+
+void PBFSolver::updateVelocity (float dt)
+{
+    float v2max = 0.0f;
+
+    FOR_ALL_PARTICLES(p) {
+        p->velocity = sph_periodic_delta(pred_at[pidx] - prev_at[pidx]) / dt;
+    } FOR_ALL_PARTICLES_END()
+
+    {
+        FOR_ALL_PARTICLES(p) {
+            fpoint smooth(0.0f, 0.0f);
+
+            FOR_ALL_CACHED_NEBS(nebs, pidx, qidx) {
+                auto q = getptr(game->particles, qidx);
+                if (q->density <= 0) {
+                    continue;
+                }
+                fpoint x = sph_periodic_delta(pred_at[pidx] -
+                                              pred_at[qidx]);
+                smooth += (q->velocity - p->velocity) *
+                          (PARTICLE_MASS / q->density) *
+                          sph_kernel(x, KERNEL_RANGE);
+            } FOR_ALL_CACHED_NEBS_END()
+
+            p->velocity += PBF_XSPH * smooth;
+
+            v2max = std::max(v2max, p->velocity.x * p->velocity.x +
+                                    p->velocity.y * p->velocity.y);
+
+            game->move_particle(p, pred_at[pidx]);
+        } FOR_ALL_PARTICLES_END()
+    }
+
+    max_v2 = v2max;
+    have_limits = true;
+}
+
+//
+// The step is split into at least the configured number of substeps, and
+// more while the fluid moves too fast for one to stay within its limit.
+//
+void PBFSolver::update (float dt)
+{
+    float longest = dt / std::max(sph_pbf_substeps, 1);
+    float shortest = std::min(sph_dt_min, longest);
+    float left = dt;
+
+    sph_brush_tick();
+
+    iterations = 0;
+    substeps = 0;
+
+    while (left > 0.0f) {
+        float sub_dt = std::max(std::min(longest, substep_limit()), shortest);
+
+        //
+        // Take the rest in one go rather than leave a sliver for the end.
+        //
+        if (sub_dt > left - shortest) {
+            sub_dt = left;
+        }
+        left -= sub_dt;
+        substeps++;
+
+        predict(sub_dt);
+        nebs.find(KERNEL_RANGE);
+
+        //
+        // Far from rest, e.g. from a start denser than rest, the solve can
+        // move particles further than the substep did; once any has gone
+        // as far, the neighbours found after prediction no longer cover it.
+        //
+        float reach = PBF_CFL * KERNEL_RANGE;
+
+        for (auto i = 0; i < sph_pbf_iterations; i++) {
+            calculateLambda();
+            if (calculateDelta() > reach * reach) {
+                refind();
+            }
+            iterations++;
+        }
+
+        density_error = calculateLambda();
+        updateVelocity(sub_dt);
+    }
+}
+
+SPHSolver *sph_solver_new_pbf (void)
+{
+    return (new PBFSolver());
+}
@@ -0,0 +1,539 @@
+//
+// Copyright goblinhack@gmail.com
+// See the README file for license info.
+//
+
+#include "my_game.h"
+#include "my_sph_solver.h"
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+using namespace Constants;
+
+//
+// Stop once the mean compression is under this fraction of the rest
+// density, but always run a few iterations so pressure can spread.
+//
+static const float PCISPH_TOLERANCE      = 0.001;
+static const int   PCISPH_MIN_ITERATIONS = 2;
+static const int   PCISPH_MAX_ITERATIONS = 100;
+
+//
+// Each correction moves pressure this fraction of the way to what would
+// fix the particle's own density error with its neighbours held still;
+// the neighbours move too, so the full step overshoots.
+//
+static const float PCISPH_RELAXATION     = 0.5;
+
+//
+// Far from rest, e.g. with particles stacked on each other, a particle's
+// neighbours' pressures sway its density more than its own does and the
+// corrections feed on each other. An iteration that leaves the error this
+// much worse than the best so far is undone, and the rest of the solve
+// takes smaller steps.
+//
+static const float PCISPH_DIVERGENCE     = 1.5;
+
+//
+// Particles sit at the spacing every other solver seeds at, but are
+// summed over a wider kernel: at two spacings to the kernel the pressure
+// gradient of alternate rows cancels, and the solve settles with them
+// checkerboarded rather than level.
+//
+static const float PCISPH_SPACING        = REST_SPACING;
+static const float PCISPH_KERNEL         = KERNEL_RANGE * 1.5f;
+
+//
+// Fraction of the kernel a particle may cross per step.
+//
+static const float PCISPH_CFL            = 0.4;
+
+//
+// Most the step may grow by from one step to the next, so the pressure
+// carried over is still close to the answer for the new one.
+//
+static const float PCISPH_DT_GROWTH      = 1.1;
+
+//
+// Walls are mirrors half a spacing outside the clamp lines, so a particle
+// resting on one sees the fluid continue through it as a lattice would
+// and is neither under dense nor left without anything to push against.
+// Returns the images of this point that could be within reach of anything
+// inside, up to 3, and for each the signs that reflect a vector with it.
+//
+static inline int pcisph_wall_images (const fpoint &at, fpoint *image,
+                                      fpoint *flip)
+{
+    if (sph_boundary_enabled) {
+        return (0);
+    }
+
+    const float reach = PCISPH_KERNEL;
+    float x0 = GL_BORDER - PCISPH_SPACING / 2;
+    float x1 = GL_WIDTH - GL_BORDER + PCISPH_SPACING / 2;
+    float y0 = GL_BORDER - PCISPH_SPACING / 2;
+    float y1 = GL_HEIGHT - GL_BORDER + PCISPH_SPACING / 2;
+    float mx = at.x, my = at.y;
+
+    if (!sph_periodic_x) {
+        if (at.x - x0 < reach) {
+            mx = 2 * x0 - at.x;
+        } else if (x1 - at.x < reach) {
+            mx = 2 * x1 - at.x;
+        }
+    }
+
+    if (!sph_periodic_y) {
+        if (at.y - y0 < reach) {
+            my = 2 * y0 - at.y;
+        } else if (y1 - at.y < reach) {
+            my = 2 * y1 - at.y;
+        }
+    }
+
+    int n = 0;
+    if (mx != at.x) {
+        image[n] = fpoint(mx, at.y);
+        flip[n++] = fpoint(-1, 1);
+    }
+    if (my != at.y) {
+        image[n] = fpoint(at.x, my);
+        flip[n++] = fpoint(1, -1);
+    }
+    if ((mx != at.x) && (my != at.y)) {
+        image[n] = fpoint(mx, my);
+        flip[n++] = fpoint(-1, -1);
+    }
+    return (n);
+}
+
+//
+// Visit each neighbour of a particle and then each wall image of it, with
+// the separation to it and the signs that reflect the neighbour's vectors
+// onto it; a neighbour is its own image with no reflection.
+//
+#define FOR_ALL_PCISPH_NEBS(nebs, p, pidx, q, qidx, x, flip) \
+    FOR_ALL_CACHED_NEBS(nebs, pidx, qidx) { \
+        auto q = getptr(game->particles, qidx); \
+        fpoint image_[4]; \
+        fpoint flip_[4]; \
+        image_[0] = q->at; \
+        flip_[0] = fpoint(1, 1); \
+        auto images_ = 1 + pcisph_wall_images(q->at, image_ + 1, flip_ + 1); \
+        for (auto i_ = 0; i_ < images_; i_++) { \
+            fpoint x = sph_periodic_delta(p->at - image_[i_]); \
+            if (x.x * x.x + x.y * x.y > PCISPH_KERNEL * PCISPH_KERNEL) { \
+                continue; \
+            } \
+            [[maybe_unused]] fpoint flip = flip_[i_];
+
+#define FOR_ALL_PCISPH_NEBS_END() } } FOR_ALL_CACHED_NEBS_END()
+
+static inline fpoint pcisph_grad (const fpoint &x)
+{
+    return sph_grad_kernel(x, PCISPH_KERNEL);
+}
+
+static inline fpoint pcisph_reflect (const fpoint &v, const fpoint &flip)
+{
+    return (fpoint(v.x * flip.x, v.y * flip.y));
+}
+
+//
+// Predictive-corrective incompressible SPH (Solenthaler and Pajarola).
+// Pressure is not an equation of state but is iterated until predicted
+// densities are back at rest density, so the stiffness no longer limits
+// the timestep.
+//
+// The density a pressure would leave is predicted from the velocity it
+// gives each pair, which is linear in the pressures, rather than by
+// moving the particles and summing the kernel again, which stops being
+// once a step carries particles a fair part of the kernel. And each
+// particle's correction is scaled by its own response to its pressure,
+// not by a full lattice's, so a particle at a surface or wall is not
+// overcorrected (the form Ihmsen et al. give as implicit incompressible
+// SPH).
+//
+class PCISPHSolver : public SPHSolver {
+public:
+    PCISPHSolver(void);
+    const char *name (void) const { return ("pcisph"); }
+    float choose_dt(void);
+    void update(float dt);
+    void seed(void);
+
+private:
+    void calculateDensity(void);
+    void calculateNonPressureForce(float dt);
+    void predict(float dt);
+    float correct_pressure(float dt, float relaxation);
+    void calculatePressureForce(void);
+
+    //
+    // Neighbours of each particle, found once per step from the grid and
+    // reused by every pressure iteration.
+    //
+    SPHNeighbours nebs;
+
+    //
+    // Per particle scratch, indexed like game->particles: velocity and
+    // density with every force but pressure applied, density change per
+    // unit of the particle's own pressure, and pressure acceleration.
+    // Then the pressure before the last correction, and the pressure with
+    // the least error so far.
+    //
+    std::array<fpoint, PARTICLE_MAX> pred_velocity {};
+    std::array<float, PARTICLE_MAX> pred_density {};
+    std::array<float, PARTICLE_MAX> delta {};
+    std::array<fpoint, PARTICLE_MAX> pressure_accel {};
+    std::array<float, PARTICLE_MAX> last_pressure {};
+    std::array<float, PARTICLE_MAX> best_pressure {};
+
+    float rest_density {};
+
+    //
+    // How long this step's acceleration acts on velocity before particles
+    // move, for the integrator in use; see predict.
+    //
+    float kick {};
+
+    //
+    // Pressure is carried from one step to the next as the first guess for
+    // the solve; particle pressures left by another solver are not.
+    //
+    bool warm {};
+};
+
+PCISPHSolver::PCISPHSolver (void)
+{
+    //
+    // Pressure already stops a particle at a wall; bouncing it back off
+    // as well would throw it at the fluid above.
+    //
+    bounce = 0.0f;
+
+    int n = ceil(PCISPH_KERNEL / PCISPH_SPACING);
+    for (auto x = -n; x <= n; x++) {
+        for (auto y = -n; y <= n; y++) {
+            fpoint r(x * PCISPH_SPACING, y * PCISPH_SPACING);
+            rest_density += PARTICLE_MASS * sph_kernel(r, PCISPH_KERNEL);
+        }
+    }
+
+    //
+    // The boundary samples are baked with the standard kernel, so they are
+    // scaled to a lattice measured with it.
+    //
+    float unused1, unused2;
+    wall_density = sph_lattice_density(PCISPH_SPACING, &unused1, &unused2);
+
+    LOG("pcisph: rest density %g at spacing %g", rest_density, PCISPH_SPACING);
+}
+
+void PCISPHSolver::seed (void)
+{
+    seed_lattice(PCISPH_SPACING);
+}
+
+//
+// Pressure is solved implicitly and viscosity is damped implicitly, so
+// neither the stiffness, force nor viscous limits of the explicit solver
+// apply; what does is how far a particle may travel before the neighbour
+// list found at the start of the step stops covering it. That is bounded
+// with the last step's velocity and net acceleration, pressure included,
+// so fluid at rest under gravity is not held to gravity's time scale:
+//
+//   |v| dt + |a| dt^2 <= CFL h
+//
+float PCISPHSolver::choose_dt (void)
+{
+    if (!sph_dt_adaptive || !have_limits) {
+        return (TIMESTEP);
+    }
+
+    //
+    // A solve that ran out of iterations left the fluid compressed; back
+    // off until it catches up.
+    //
+    if (density_error > PCISPH_TOLERANCE) {
+        return (std::max(dt_prev * 0.5f, sph_dt_min));
+    }
+
+    float dt = std::min(sph_dt_max, dt_prev * PCISPH_DT_GROWTH);
+    float v = sqrt(max_v2);
+    float a = sqrt(max_a2);
+    float reach = PCISPH_CFL * KERNEL_RANGE;
+
+    if (a > 0) {
+        dt = std::min(dt, (2.0f * reach) /
+                          (v + (float) sqrt(v * v + 4.0f * a * reach)));
+    } else if (v > 0) {
+        dt = std::min(dt, reach / v);
+    }
+
+    return (std::max(dt, sph_dt_min));
+}
+
+void PCISPHSolver::calculateDensity (void)
+{
+    FOR_ALL_PARTICLES(p) {
+        float densitySum = 0.0f;
+
+        FOR_ALL_PCISPH_NEBS(nebs, p, pidx, q, qidx, x, flip) {
+            densitySum += q->mass * sph_kernel(x, PCISPH_KERNEL);
+        } FOR_ALL_PCISPH_NEBS_END()
+
+        SphBoundarySample b;
+        if (sph_boundary_lookup(p->at, &b)) {
+            densitySum += b.density;
+        }
+
+        p->density = densitySum;
+
+        if (!warm) {
+            p->pressure = 0.0f;
+        }
+    } FOR_ALL_PARTICLES_END()
+
+    warm = true;
+}
+
+//
+// Viscosity and gravity, added on top of anything the brush put in force.
+// Viscosity takes one Jacobi step of backward Euler, relaxing towards the
+// neighbours' velocity without passing it however large the step.
+//
+void PCISPHSolver::calculateNonPressureForce (float dt)
+{
+    FOR_ALL_PARTICLES(p) {
+        fpoint aViscosity(0.0f, 0.0f);
+        float rate = 0.0f;
+
+        FOR_ALL_CACHED_NEBS(nebs, pidx, qidx) {
+            auto q = getptr(game->particles, qidx);
+            fpoint x = sph_periodic_delta(p->at - q->at);
+            if (x.x * x.x + x.y * x.y > KERNEL_RANGE * KERNEL_RANGE) {
+                continue;
+            }
+            float k = VISCOCITY * q->mass / (q->density * p->density) *
+                      sph_laplace_kernel(x, KERNEL_RANGE);
+            aViscosity += k * (q->velocity - p->velocity);
+            rate += k;
+        } FOR_ALL_CACHED_NEBS_END()
+
+        aViscosity *= 1.0f / (1.0f + rate * dt);
+
+        p->force += p->density * (aViscosity + fpoint(0, GRAVITY));
+    } FOR_ALL_PARTICLES_END()
+}
+
+//
+// Velocity each particle moves at over this step without pressure, and
+// how much a particle's own pressure would lower its density:
+//
+//   dt kick sum m (d_ii - d_ji) . grad W_ij
+//
+// where d_ii is the acceleration its pressure gives it and d_ji the one it
+// gives neighbour j, per unit pressure. Both follow the integrator that
+// will take the step; kick is how long this step's acceleration acts on
+// velocity before the particle moves.
+//
+void PCISPHSolver::predict (float dt)
+{
+    switch (sph_integrator) {
+    case SPH_INTEGRATOR_LEAPFROG:
+    case SPH_INTEGRATOR_VERLET:
+        kick = 0.5f * (dt_prev + dt);
+        break;
+
+    default:
+        kick = dt;
+        break;
+    }
+
+    {
+        FOR_ALL_PARTICLES(p) {
+            fpoint accel = p->force / p->density;
+
+            if (sph_integrator == SPH_INTEGRATOR_VERLET) {
+                pred_velocity[pidx] = p->velocity +
+                                      (0.5f * dt_prev) * p->accel +
+                                      kick * accel;
+            } else {
+                pred_velocity[pidx] = p->velocity + kick * accel;
+            }
+        } FOR_ALL_PARTICLES_END()
+    }
+
+    FOR_ALL_PARTICLES(p) {
+        float rho2 = p->density * p->density;
+        float div = 0.0f;
+        fpoint grad_sum(0.0f, 0.0f);
+        float grad2_sum = 0.0f;
+
+        FOR_ALL_PCISPH_NEBS(nebs, p, pidx, q, qidx, x, flip) {
+            fpoint g = q->mass * pcisph_grad(x);
+            fpoint v = pred_velocity[pidx] -
+                       pcisph_reflect(pred_velocity[qidx], flip);
+            div += v.x * g.x + v.y * g.y;
+            grad_sum += g;
+            grad2_sum += g.x * g.x + g.y * g.y;
+        } FOR_ALL_PCISPH_NEBS_END()
+
+        SphBoundarySample b;
+        if (sph_boundary_lookup(p->at, &b)) {
+            fpoint v = pred_velocity[pidx];
+            div += v.x * b.grad.x + v.y * b.grad.y;
+            grad_sum += b.grad;
+        }
+
+        pred_density[pidx] = p->density + dt * div;
+        delta[pidx] = dt * kick *
+                      (grad_sum.x * grad_sum.x + grad_sum.y * grad_sum.y +
+                       grad2_sum) / rho2;
+    } FOR_ALL_PARTICLES_END()
+}
+
+//
+// Move pressure towards whatever brings the predicted density back to
+// rest density, never below zero, so a free surface is let be under
+// density. Returns the mean relative compression the pressures before
+// this correction leave, which are kept in last_pressure.
+//
+float PCISPHSolver::correct_pressure (float dt, float relaxation)
+{
+    float error = 0.0f;
+    int n = 0;
+
+    FOR_ALL_PARTICLES(p) {
+        fpoint a = pressure_accel[pidx];
+        float change = 0.0f;
+
+        FOR_ALL_PCISPH_NEBS(nebs, p, pidx, q, qidx, x, flip) {
+            fpoint g = q->mass * pcisph_grad(x);
+            fpoint d = a - pcisph_reflect(pressure_accel[qidx], flip);
+            change += d.x * g.x + d.y * g.y;
+        } FOR_ALL_PCISPH_NEBS_END()
+
+        SphBoundarySample b;
+        if (sph_boundary_lookup(p->at, &b)) {
+            change += a.x * b.grad.x + a.y * b.grad.y;
+        }
+
+        float err = pred_density[pidx] + dt * kick * change - rest_density;
+
+        last_pressure[pidx] = p->pressure;
+
+        if (delta[pidx] > 0.0f) {
+            p->pressure = std::max(p->pressure + relaxation * err /
+                                   delta[pidx], 0.0f);
+        }
+
+        error += std::max(err, 0.0f);
+        n++;
+    } FOR_ALL_PARTICLES_END()
+
+    if (!n) {
+        return (0.0f);
+    }
+
+    return (error / (n * rest_density));
+}
+
+void PCISPHSolver::calculatePressureForce (void)
+{
+    FOR_ALL_PARTICLES(p) {
+        fpoint aPressure(0.0f, 0.0f);
+        float pi = p->pressure / (p->density * p->density);
+
+        FOR_ALL_PCISPH_NEBS(nebs, p, pidx, q, qidx, x, flip) {
+            //
+            // Particles stacked on the same spot (e.g. in a corner) have no
+            // kernel gradient between them; split them apart along an
+            // arbitrary direction that is opposite for the other one.
+            //
+            if (unlikely((x.x == 0.0f) && (x.y == 0.0f) && (pidx != qidx))) {
+                x = fpoint(pidx < qidx ? -0.01f : 0.01f,
+                           (pidx ^ qidx) & 1 ? -0.01f : 0.01f);
+                if (pidx > qidx) {
+                    x.y = -x.y;
+                }
+            }
+
+            aPressure += q->mass *
+                         (pi + q->pressure / (q->density * q->density)) *
+                         pcisph_grad(x);
+        } FOR_ALL_PCISPH_NEBS_END()
+
+        SphBoundarySample b;
+        if (sph_boundary_lookup(p->at, &b)) {
+            aPressure += pi * b.grad;
+        }
+
+        pressure_accel[pidx] = aPressure * -1.0f;
+    } FOR_ALL_PARTICLES_END()
+}
+
+void PCISPHSolver::update (float dt)
+{
+    nebs.find(PCISPH_KERNEL);
+    calculateDensity();
+    sph_brush_tick();
+    calculateNonPressureForce(dt);
+    predict(dt);
+
+    iterations = 0;
+    density_error = 0;
+
+    calculatePressureForce();
+
+    float relaxation = PCISPH_RELAXATION;
+    float best = std::numeric_limits<float>::max();
+
+    while (iterations < PCISPH_MAX_ITERATIONS) {
+        float error = correct_pressure(dt, relaxation);
+        iterations++;
+
+        if (error <= best) {
+            best = error;
+            best_pressure = last_pressure;
+        } else if (!(error < best * PCISPH_DIVERGENCE)) {
+            FOR_ALL_PARTICLES(p) {
+                p->pressure = best_pressure[pidx];
+            } FOR_ALL_PARTICLES_END()
+            relaxation *= 0.5f;
+        }
+
+        density_error = best;
+        calculatePressureForce();
+
+        if ((iterations >= PCISPH_MIN_ITERATIONS) &&
+            (density_error < PCISPH_TOLERANCE)) {
+            break;
+        }
+    }
+
+    //
+    // After a solve that diverged, leave the best pressures found rather
+    // than wherever the last correction got to.
+    //
+    if (relaxation < PCISPH_RELAXATION) {
+        FOR_ALL_PARTICLES(p) {
+            p->pressure = best_pressure[pidx];
+        } FOR_ALL_PARTICLES_END()
+        calculatePressureForce();
+    }
+
+    FOR_ALL_PARTICLES(p) {
+        p->force += p->density * pressure_accel[pidx];
+    } FOR_ALL_PARTICLES_END()
+
+    integrationStep(dt);
+}
+
+SPHSolver *sph_solver_new_pcisph (void)
+{
+    return (new PCISPHSolver());
+}
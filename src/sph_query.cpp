@@ -0,0 +1,302 @@
+//
+// Copyright goblinhack@gmail.com
+// See the README file for license info.
+//
+
+#include "my_game.h"
+#include "my_sph_query.h"
+#include "my_sph_solver.h"
+
+#include <algorithm>
+#include <chrono>
+
+using namespace Constants;
+
+//
+// Grid cells covering the given box, clamped to the grid.
+//
+static inline void grid_box (fpoint tl, fpoint br, spoint *gtl, spoint *gbr)
+{
+    tl.x = std::max(tl.x, 0.0f);
+    tl.y = std::max(tl.y, 0.0f);
+    br.x = std::min(br.x, GL_WIDTH);
+    br.y = std::min(br.y, GL_HEIGHT);
+
+    *gtl = point_to_grid(tl);
+    *gbr = point_to_grid(br);
+
+    gtl->x = std::max(gtl->x, (int16_t) 0);
+    gtl->y = std::max(gtl->y, (int16_t) 0);
+    gbr->x = std::min(gbr->x, (int16_t) (PARTICLES_WIDTH - 1));
+    gbr->y = std::min(gbr->y, (int16_t) (PARTICLES_HEIGHT - 1));
+}
+
+//
+// Call fn(idx) for every particle attached to a cell in the box, at every
+// grid level that has particles. Cells are walked in memory order.
+//
+template<typename F>
+static inline void grid_walk (spoint gtl, spoint gbr, F fn)
+{
+    for (int level = 0; level < PARTICLE_LEVELS; level++) {
+        if (level && !game->num_coarse_particles) {
+            continue;
+        }
+
+        for (int x = gtl.x >> level; x <= gbr.x >> level; x++) {
+            for (int y = gtl.y >> level; y <= gbr.y >> level; y++) {
+                auto slots = game->particle_ids_at(level, x, y);
+                for (int slot = 0; slot < PARTICLE_SLOTS; slot++) {
+                    auto idx = slots[slot];
+                    if (likely(!idx)) {
+                        continue;
+                    }
+                    fn(idx);
+                }
+            }
+        }
+    }
+}
+
+//
+// Call fn(idx) for every particle the search backend has in or near the
+// box.
+//
+template<typename F>
+static inline void search_walk (fpoint tl, fpoint br, F fn)
+{
+    if (sph_search == SPH_SEARCH_SORT) {
+        sph_sort_walk(tl, br, fn);
+        return;
+    }
+
+    spoint gtl, gbr;
+    grid_box(tl, br, &gtl, &gbr);
+    grid_walk(gtl, gbr, fn);
+}
+
+//
+// Near a periodic seam the particle's images are searched too, and
+// distances are to whichever image is nearer. Radii over half the period
+// are searched without images, so no particle is returned twice.
+//
+ParticleSpan ParticleQuery::radius (fpoint at, float r)
+{
+    fpoint image[4];
+    int images = 1;
+    image[0] = at;
+
+    if ((!sph_periodic_x || (r * 2 < sph_periodic_period_x())) &&
+        (!sph_periodic_y || (r * 2 < sph_periodic_period_y()))) {
+        images = sph_periodic_images(at, r, image);
+    }
+
+    auto out = result.data();
+    auto out_end = out + result.size();
+    float r2 = r * r;
+
+    for (auto i = 0; i < images; i++) {
+        fpoint tl = image[i] - fpoint(r, r);
+        fpoint br = image[i] + fpoint(r, r);
+
+        search_walk(tl, br, [&](uint16_t idx) {
+            auto p = getptr(game->particles, idx);
+            fpoint d = p->at - image[i];
+            float d2 = d.x * d.x + d.y * d.y;
+            if (d2 > r2) {
+                return;
+            }
+            if (likely(out < out_end)) {
+                dist2[idx] = d2;
+                *out++ = idx;
+            }
+        });
+    }
+
+    return (ParticleSpan(result.data(), out));
+}
+
+ParticleSpan ParticleQuery::aabb (fpoint tl, fpoint br)
+{
+    auto out = result.data();
+    auto out_end = out + result.size();
+
+    search_walk(tl, br, [&](uint16_t idx) {
+        auto p = getptr(game->particles, idx);
+        if ((p->at.x < tl.x) || (p->at.x > br.x) ||
+            (p->at.y < tl.y) || (p->at.y > br.y)) {
+            return;
+        }
+        if (likely(out < out_end)) {
+            *out++ = idx;
+        }
+    });
+
+    return (ParticleSpan(result.data(), out));
+}
+
+//
+// Grow the search circle until it holds at least k particles; anything
+// outside the circle is further away than everything inside it, so the k
+// closest inside are the k closest overall. Results are nearest first.
+//
+ParticleSpan ParticleQuery::nearest (fpoint at, int k, float max_r)
+{
+    ParticleSpan found;
+
+    if (k <= 0) {
+        return (found);
+    }
+
+    for (float r = KERNEL_RANGE; ; r *= 2) {
+        r = std::min(r, max_r);
+        found = radius(at, r);
+        if (((int) found.size() >= k) || (r >= max_r)) {
+            break;
+        }
+    }
+
+    auto b = result.data();
+    auto e = b + found.size();
+    auto m = b + std::min((int) found.size(), k);
+
+    std::partial_sort(b, m, e, [this](uint16_t x, uint16_t y) {
+        return (dist2[x] < dist2[y]);
+    });
+
+    return (ParticleSpan(b, m));
+}
+
+//
+// Resolve a batch of probes in one call. Probes are visited in grid order
+// so neighbouring probes reuse cells that are still in cache; each probe's
+// hits are appended to the batch store and located via start/count.
+//
+template<typename F>
+void ParticleQuery::batch (int n, const fpoint *key, ParticleBatch *out,
+                           F query)
+{
+    n = std::min(n, PARTICLE_BATCH_MAX_PROBES);
+
+    for (auto i = 0; i < n; i++) {
+        order[i] = i;
+    }
+
+    std::sort(order.begin(), order.begin() + n, [key](uint16_t a, uint16_t b) {
+        auto ga = point_to_grid(key[a]);
+        auto gb = point_to_grid(key[b]);
+        return ((ga.x < gb.x) || ((ga.x == gb.x) && (ga.y < gb.y)));
+    });
+
+    size_t total = 0;
+    out->probes = n;
+    out->truncated = false;
+
+    for (auto i = 0; i < n; i++) {
+        auto probe = order[i];
+        ParticleSpan found = query(probe);
+
+        auto copy = std::min(found.size(), out->indices.size() - total);
+        if (copy < found.size()) {
+            out->truncated = true;
+        }
+
+        std::copy(found.begin(), found.begin() + copy,
+                  out->indices.begin() + total);
+        out->start[probe] = total;
+        out->count[probe] = copy;
+        total += copy;
+    }
+}
+
+void ParticleQuery::radius_batch (const fpoint *at, int n, float r,
+                                  ParticleBatch *out)
+{
+    batch(n, at, out, [&](int probe) { return (radius(at[probe], r)); });
+}
+
+void ParticleQuery::aabb_batch (const fpoint *tl, const fpoint *br, int n,
+                                ParticleBatch *out)
+{
+    batch(n, tl, out, [&](int probe) { return (aabb(tl[probe], br[probe])); });
+}
+
+//
+// Microbenchmarks against the current particle set; compares the grid
+// queries with the plain loop over every particle they replace.
+//
+#define BENCH_QUERY_PROBES 1000
+
+static double bench_usecs (std::chrono::steady_clock::time_point since)
+{
+    auto d = std::chrono::steady_clock::now() - since;
+    return (std::chrono::duration<double, std::micro>(d).count());
+}
+
+uint8_t sph_bench_query (tokens_t *tokens, void *context)
+{_
+    static ParticleQuery q;
+    static ParticleBatch batch;
+    static std::array<fpoint, BENCH_QUERY_PROBES> probes;
+    const float r = KERNEL_RANGE * 2;
+    const int k = 16;
+
+    for (auto &at : probes) {
+        at = fpoint(random_range(0, (int) GL_WIDTH),
+                    random_range(0, (int) GL_HEIGHT));
+    }
+
+    CON("bench query: %d particles, %d probes, radius %.0f",
+        game->num_particles, BENCH_QUERY_PROBES, r);
+
+    size_t hits = 0;
+    auto t = std::chrono::steady_clock::now();
+    for (auto at : probes) {
+        FOR_ALL_PARTICLES(p) {
+            fpoint d = p->at - at;
+            if (d.x * d.x + d.y * d.y <= r * r) {
+                hits++;
+            }
+        } FOR_ALL_PARTICLES_END()
+    }
+    CON("  brute force radius : %8.2f us/query, %" PRI_SIZET " hits",
+        bench_usecs(t) / BENCH_QUERY_PROBES, hits);
+
+    hits = 0;
+    t = std::chrono::steady_clock::now();
+    for (auto at : probes) {
+        hits += q.radius(at, r).size();
+    }
+    CON("  grid radius        : %8.2f us/query, %" PRI_SIZET " hits",
+        bench_usecs(t) / BENCH_QUERY_PROBES, hits);
+
+    hits = 0;
+    t = std::chrono::steady_clock::now();
+    for (auto at : probes) {
+        hits += q.aabb(at - fpoint(r, r), at + fpoint(r, r)).size();
+    }
+    CON("  grid aabb          : %8.2f us/query, %" PRI_SIZET " hits",
+        bench_usecs(t) / BENCH_QUERY_PROBES, hits);
+
+    hits = 0;
+    t = std::chrono::steady_clock::now();
+    for (auto at : probes) {
+        hits += q.nearest(at, k, GL_WIDTH).size();
+    }
+    CON("  grid %d-nearest    : %8.2f us/query, %" PRI_SIZET " hits",
+        k, bench_usecs(t) / BENCH_QUERY_PROBES, hits);
+
+    hits = 0;
+    t = std::chrono::steady_clock::now();
+    for (auto i = 0; i < BENCH_QUERY_PROBES; i += PARTICLE_BATCH_MAX_PROBES) {
+        auto n = std::min(PARTICLE_BATCH_MAX_PROBES, BENCH_QUERY_PROBES - i);
+        q.radius_batch(probes.data() + i, n, r, &batch);
+        for (auto j = 0; j < n; j++) {
+            hits += batch.at(j).size();
+        }
+    }
+    CON("  grid radius batch  : %8.2f us/query, %" PRI_SIZET " hits",
+        bench_usecs(t) / BENCH_QUERY_PROBES, hits);
+
+    return (true);
+}
@@ -0,0 +1,1043 @@
+//
+// Copyright goblinhack@gmail.com
+// See the README file for license info.
+//
+
+#include "my_game.h"
+#include "my_gl.h"
+#include "my_tile.h"
+#include "my_sph_render.h"
+#include "my_sph_sdf.h"
+#include "my_thread_pool.h"
+
+#include <chrono>
+#include <vector>
+
+using namespace Constants;
+
+int sph_render_mode = SPH_RENDER_INSTANCED;
+int sph_render_density_from = SPH_RENDER_DENSITY_FROM;
+int sph_render_density_until = SPH_RENDER_DENSITY_UNTIL;
+
+static const char *sph_render_names[] = {
+    "sprites", "instanced", "parallel", "density",
+};
+
+//
+// Each instance is the quad's corners, 0 to 1, placed by one particle's
+// centre and size. uv is the tile's corners within its texture, the top of
+// the quad being the top of the tile, as tile_blit draws it.
+//
+static const char *render_instanced_vs =
+    "#version 120\n"
+    "attribute vec2 corner;\n"
+    "attribute vec2 at;\n"
+    "attribute float size;\n"
+    "uniform vec4 uv;\n"
+    "varying vec2 tex_at;\n"
+    "void main ()\n"
+    "{\n"
+    "    vec2 xy = at + (corner - 0.5) * size;\n"
+    "    gl_Position = gl_ModelViewProjectionMatrix * vec4(xy, 0.0, 1.0);\n"
+    "    tex_at = mix(uv.xy, uv.zw, corner);\n"
+    "}\n";
+
+static const char *render_instanced_fs =
+    "#version 120\n"
+    "uniform sampler2D tex;\n"
+    "uniform vec4 color;\n"
+    "varying vec2 tex_at;\n"
+    "void main ()\n"
+    "{\n"
+    "    gl_FragColor = texture2D(tex, tex_at) * color;\n"
+    "}\n";
+
+//
+// The same for a core profile context, with the projection as a uniform.
+//
+static const char *render_instanced_core_vs =
+    "#version 330 core\n"
+    "in vec2 corner;\n"
+    "in vec2 at;\n"
+    "in float size;\n"
+    "uniform vec4 uv;\n"
+    "uniform mat4 projection;\n"
+    "out vec2 tex_at;\n"
+    "void main ()\n"
+    "{\n"
+    "    vec2 xy = at + (corner - 0.5) * size;\n"
+    "    gl_Position = projection * vec4(xy, 0.0, 1.0);\n"
+    "    tex_at = mix(uv.xy, uv.zw, corner);\n"
+    "}\n";
+
+static const char *render_instanced_core_fs =
+    "#version 330 core\n"
+    "uniform sampler2D tex;\n"
+    "uniform vec4 color;\n"
+    "in vec2 tex_at;\n"
+    "out vec4 frag;\n"
+    "void main ()\n"
+    "{\n"
+    "    frag = texture(tex, tex_at) * color;\n"
+    "}\n";
+
+static GLuint instanced_program;
+static GLuint instanced_vao;
+static GLuint instanced_corners_vbo;
+static GLuint instanced_vbo;
+static GLint instanced_corner;
+static GLint instanced_at;
+static GLint instanced_size;
+static GLint instanced_tex;
+static GLint instanced_uv;
+static GLint instanced_color;
+static GLint instanced_projection;
+
+//
+// Set once the instanced path has been tried, and whether it works.
+//
+static bool instanced_tried;
+static bool instanced_ok;
+
+static std::vector<float> instanced_at_buf;
+static std::vector<float> instanced_size_buf;
+
+//
+// Bytes uploaded for the last instanced draw.
+//
+static size_t instanced_bytes;
+
+static bool render_instanced_init (void)
+{_
+    if (instanced_tried) {
+        return (instanced_ok);
+    }
+    instanced_tried = true;
+
+    if (!gl_version_at_least(3, 3) ||
+        !glVertexAttribDivisor_EXT || !glDrawArraysInstanced_EXT) {
+        CON("render: no instanced arrays, using sprites");
+        return (false);
+    }
+
+    instanced_program = gl_program_new("particle instances",
+                                       gl_core ? render_instanced_core_vs :
+                                                 render_instanced_vs,
+                                       gl_core ? render_instanced_core_fs :
+                                                 render_instanced_fs);
+    if (!instanced_program) {
+        CON("render: no particle instance shader, using sprites");
+        return (false);
+    }
+
+    instanced_corner = glGetAttribLocation_EXT(instanced_program, "corner");
+    instanced_at = glGetAttribLocation_EXT(instanced_program, "at");
+    instanced_size = glGetAttribLocation_EXT(instanced_program, "size");
+    instanced_tex = glGetUniformLocation_EXT(instanced_program, "tex");
+    instanced_uv = glGetUniformLocation_EXT(instanced_program, "uv");
+    instanced_color = glGetUniformLocation_EXT(instanced_program, "color");
+    instanced_projection = glGetUniformLocation_EXT(instanced_program,
+                                                    "projection");
+
+    if (gl_core) {
+        glGenVertexArrays_EXT(1, &instanced_vao);
+    }
+
+    static const float corners[] = {
+        0, 0,
+        0, 1,
+        1, 0,
+        1, 1,
+    };
+
+    glGenBuffersARB_EXT(1, &instanced_corners_vbo);
+    glBindBufferARB_EXT(GL_ARRAY_BUFFER, instanced_corners_vbo);
+    glBufferDataARB_EXT(GL_ARRAY_BUFFER, sizeof(corners), corners,
+                        GL_STATIC_DRAW);
+    glBindBufferARB_EXT(GL_ARRAY_BUFFER, 0);
+
+    glGenBuffersARB_EXT(1, &instanced_vbo);
+
+    instanced_ok = true;
+    return (true);
+}
+
+//
+// Each particle is two triangles, six vertices of uv, xy and rgba, so where
+// its vertices go follows from how many particles are in use before it.
+//
+static const int PARALLEL_VERTICES = 6;
+static const int PARALLEL_FLOATS = PARALLEL_VERTICES * 8;
+
+static GLuint parallel_vbo;
+static bool parallel_tried;
+static bool parallel_ok;
+
+//
+// Particles in use in each chunk, then the first vertex slot of each.
+//
+static std::vector<int> parallel_first;
+
+//
+// Where the vertices go when the buffer cannot be mapped.
+//
+static std::vector<float> parallel_buf;
+
+static bool render_parallel_init (void)
+{_
+    if (parallel_tried) {
+        return (parallel_ok);
+    }
+    parallel_tried = true;
+
+    if (!glGenBuffersARB_EXT || !glBufferDataARB_EXT) {
+        CON("render: no vertex buffers, using sprites");
+        return (false);
+    }
+
+    glGenBuffersARB_EXT(1, &parallel_vbo);
+
+    parallel_ok = true;
+    return (true);
+}
+
+static inline float *render_parallel_vertex (float *v,
+                                             float u, float tv,
+                                             float x, float y,
+                                             const float *rgba)
+{
+    v[0] = u;
+    v[1] = tv;
+    v[2] = x;
+    v[3] = y;
+    v[4] = rgba[0];
+    v[5] = rgba[1];
+    v[6] = rgba[2];
+    v[7] = rgba[3];
+    return (v + 8);
+}
+
+//
+// The vertices are built by the thread pool, each chunk of the particle
+// array into its own slice of the buffer, and drawn with one call.
+//
+static void render_parallel (const Tilep &tile)
+{
+    static const fpoint sprite_size(TILE_WIDTH / 2, TILE_HEIGHT / 2);
+
+    auto pool = thread_pool();
+    int chunks = pool->size();
+
+    parallel_first.assign(chunks, 0);
+
+    pool->parallel_for(PARTICLE_MAX, [&](int begin, int end, int chunk) {
+        int n = 0;
+
+        for (auto pidx = begin; pidx < end; pidx++) {
+            auto p = getptr(game->particles, pidx);
+            if (!p->in_use) {
+                continue;
+            }
+            p->force = fpoint(0.0f, 0.0f);
+            n++;
+        }
+
+        parallel_first[chunk] = n;
+    });
+
+    int n = 0;
+    for (auto c = 0; c < chunks; c++) {
+        auto count = parallel_first[c];
+        parallel_first[c] = n;
+        n += count;
+    }
+
+    if (!n) {
+        return;
+    }
+
+    size_t bytes = (size_t) n * PARALLEL_FLOATS * sizeof(float);
+
+    glBindBufferARB_EXT(GL_ARRAY_BUFFER, parallel_vbo);
+    glBufferDataARB_EXT(GL_ARRAY_BUFFER, bytes, 0, GL_STREAM_DRAW);
+
+    float *out = 0;
+    if (glMapBufferRange_EXT) {
+        out = (float *)
+            glMapBufferRange_EXT(GL_ARRAY_BUFFER, 0, bytes,
+                                 GL_MAP_WRITE_BIT |
+                                 GL_MAP_INVALIDATE_BUFFER_BIT);
+    }
+    if (!out) {
+        parallel_buf.resize((size_t) n * PARALLEL_FLOATS);
+        out = parallel_buf.data();
+    }
+
+    color c = gl_color_current();
+    const float rgba[4] = {
+        c.r / 255.0f, c.g / 255.0f, c.b / 255.0f, c.a / 255.0f,
+    };
+
+    //
+    // As tile_blit draws it; the top of the quad is the top of the tile.
+    //
+    float u1 = tile->x1;
+    float u2 = tile->x2;
+    float v1 = tile->y1;
+    float v2 = tile->y2;
+
+    pool->parallel_for(PARTICLE_MAX, [&](int begin, int end, int chunk) {
+        float *v = out + (size_t) parallel_first[chunk] * PARALLEL_FLOATS;
+
+        for (auto pidx = begin; pidx < end; pidx++) {
+            auto p = getptr(game->particles, pidx);
+            if (!p->in_use) {
+                continue;
+            }
+
+            fpoint size = sprite_size * (p->h / KERNEL_RANGE);
+            fpoint tl = p->at - size;
+            fpoint br = p->at + size;
+
+            v = render_parallel_vertex(v, u1, v2, tl.x, br.y, rgba);
+            v = render_parallel_vertex(v, u1, v1, tl.x, tl.y, rgba);
+            v = render_parallel_vertex(v, u2, v2, br.x, br.y, rgba);
+            v = render_parallel_vertex(v, u2, v2, br.x, br.y, rgba);
+            v = render_parallel_vertex(v, u1, v1, tl.x, tl.y, rgba);
+            v = render_parallel_vertex(v, u2, v1, br.x, tl.y, rgba);
+        }
+    });
+
+    if (out == parallel_buf.data()) {
+        glBufferSubDataARB_EXT(GL_ARRAY_BUFFER, 0, bytes, out);
+    } else {
+        glUnmapBuffer_EXT(GL_ARRAY_BUFFER);
+    }
+
+    GLsizei vertices = n * PARALLEL_VERTICES;
+
+    if (gl_core) {
+        gl_core_draw(GL_TRIANGLES, GL_CORE_UV_XY_RGBA, 0, vertices,
+                     tile->gl_binding());
+        glBindBufferARB_EXT(GL_ARRAY_BUFFER, 0);
+        return;
+    }
+
+    static const GLsizei F = sizeof(GLfloat);
+
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+
+    glBindTexture(GL_TEXTURE_2D, tile->gl_binding());
+    glTexCoordPointer(2, GL_FLOAT, 8 * F, (void *) 0);
+    glVertexPointer(2, GL_FLOAT, 8 * F, (void *) (2 * F));
+    glColorPointer(4, GL_FLOAT, 8 * F, (void *) (4 * F));
+
+    glDrawArrays(GL_TRIANGLES, 0, vertices);
+    gl_draw_calls++;
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glDisableClientState(GL_COLOR_ARRAY);
+
+    glBindBufferARB_EXT(GL_ARRAY_BUFFER, 0);
+}
+
+static void render_sprites (const Tilep &tile)
+{
+    static const fpoint sprite_size(TILE_WIDTH / 2, TILE_HEIGHT / 2);
+
+    blit_init();
+
+    FOR_ALL_PARTICLES(p) {
+        p->force = fpoint(0.0f, 0.0f);
+        fpoint at = p->at;
+        fpoint size = sprite_size * (p->h / KERNEL_RANGE);
+        tile_blit(tile, at - size, at + size);
+    } FOR_ALL_PARTICLES_END()
+
+    blit_flush();
+}
+
+static void render_instanced (const Tilep &tile)
+{
+    auto &at = instanced_at_buf;
+    auto &size = instanced_size_buf;
+
+    at.resize(game->num_particles * 2);
+    size.resize(game->num_particles);
+
+    size_t n = 0;
+    bool sizes_differ = false;
+
+    FOR_ALL_PARTICLES(p) {
+        p->force = fpoint(0.0f, 0.0f);
+        if (unlikely(n >= size.size())) {
+            at.resize(n * 2 + 2);
+            size.resize(n + 1);
+        }
+        at[n * 2] = p->at.x;
+        at[n * 2 + 1] = p->at.y;
+        size[n] = TILE_WIDTH * (p->h / KERNEL_RANGE);
+        sizes_differ |= (size[n] != size[0]);
+        n++;
+    } FOR_ALL_PARTICLES_END()
+
+    if (!n) {
+        return;
+    }
+
+    color c = gl_color_current();
+
+    glUseProgram_EXT(instanced_program);
+    glUniform1i_EXT(instanced_tex, 0);
+    glUniform4f_EXT(instanced_uv, tile->x1, tile->y1, tile->x2, tile->y2);
+    glUniform4f_EXT(instanced_color, c.r / 255.0f, c.g / 255.0f,
+                    c.b / 255.0f, c.a / 255.0f);
+
+    if (gl_core) {
+        glUniformMatrix4fv_EXT(instanced_projection, 1, GL_FALSE,
+                               gl_core_projection());
+        glBindVertexArray_EXT(instanced_vao);
+    }
+
+    glBindTexture(GL_TEXTURE_2D, tile->gl_binding());
+
+    glBindBufferARB_EXT(GL_ARRAY_BUFFER, instanced_corners_vbo);
+    glVertexAttribPointer_EXT(instanced_corner, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    glEnableVertexAttribArray_EXT(instanced_corner);
+
+    //
+    // Respecifying the whole buffer each frame lets the driver hand us
+    // fresh storage rather than wait on the last frame's draw. Sizes only
+    // go up when they are not all the same.
+    //
+    size_t at_bytes = n * 2 * sizeof(float);
+    size_t size_bytes = sizes_differ ? n * sizeof(float) : 0;
+    instanced_bytes = at_bytes + size_bytes;
+
+    glBindBufferARB_EXT(GL_ARRAY_BUFFER, instanced_vbo);
+    glBufferDataARB_EXT(GL_ARRAY_BUFFER, instanced_bytes, 0, GL_STREAM_DRAW);
+    glBufferSubDataARB_EXT(GL_ARRAY_BUFFER, 0, at_bytes, at.data());
+    glVertexAttribPointer_EXT(instanced_at, 2, GL_FLOAT, GL_FALSE, 0, 0);
+    glVertexAttribDivisor_EXT(instanced_at, 1);
+    glEnableVertexAttribArray_EXT(instanced_at);
+
+    if (sizes_differ) {
+        glBufferSubDataARB_EXT(GL_ARRAY_BUFFER, at_bytes, size_bytes,
+                               size.data());
+        glVertexAttribPointer_EXT(instanced_size, 1, GL_FLOAT, GL_FALSE, 0,
+                                  (void *) at_bytes);
+        glVertexAttribDivisor_EXT(instanced_size, 1);
+        glEnableVertexAttribArray_EXT(instanced_size);
+    } else {
+        glVertexAttrib1f_EXT(instanced_size, size[0]);
+    }
+
+    glDrawArraysInstanced_EXT(GL_TRIANGLE_STRIP, 0, 4, (GLsizei) n);
+
+    //
+    // Divisors are not part of the program, so leave them as the fixed
+    // function arrays expect.
+    //
+    if (sizes_differ) {
+        glVertexAttribDivisor_EXT(instanced_size, 0);
+        glDisableVertexAttribArray_EXT(instanced_size);
+    }
+    glVertexAttribDivisor_EXT(instanced_at, 0);
+    glDisableVertexAttribArray_EXT(instanced_at);
+    glDisableVertexAttribArray_EXT(instanced_corner);
+    if (gl_core) {
+        glBindVertexArray_EXT(0);
+    }
+    glBindBufferARB_EXT(GL_ARRAY_BUFFER, 0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glUseProgram_EXT(0);
+}
+
+//
+// The density field is splatted a cell of this many pixels at a time. Each
+// particle adds up to 1 at its centre, falling to 0 at the edge of its
+// sprite, and the sum is kept to a byte with DENSITY_RANGE as 255.
+//
+static const int DENSITY_CELL = 2;
+static const float DENSITY_RANGE = 4.0;
+
+//
+// For both shaders: where the fluid's edge is, in overlapping particles,
+// and the colours from there to where it is deepest.
+//
+#define DENSITY_RAMP \
+    "uniform float range;\n" \
+    "const float edge = 0.3;\n" \
+    "const vec3 shallow = vec3(0.55, 0.8, 1.0);\n" \
+    "const vec3 deep = vec3(0.05, 0.25, 0.75);\n"
+
+//
+// The field is shaded in one draw over the whole map: clear below the edge,
+// then from shallow to deep as more particles overlap.
+//
+static const char *render_density_vs =
+    "#version 120\n"
+    "varying vec2 tex_at;\n"
+    "void main ()\n"
+    "{\n"
+    "    gl_Position = ftransform();\n"
+    "    tex_at = gl_MultiTexCoord0.xy;\n"
+    "}\n";
+
+static const char *render_density_fs =
+    "#version 120\n"
+    DENSITY_RAMP
+    "uniform sampler2D tex;\n"
+    "uniform vec4 color;\n"
+    "varying vec2 tex_at;\n"
+    "void main ()\n"
+    "{\n"
+    "    float d = texture2D(tex, tex_at).r * range;\n"
+    "    float a = smoothstep(edge * 0.5, edge, d);\n"
+    "    vec3 c = mix(shallow, deep, clamp((d - edge) / range, 0.0, 1.0));\n"
+    "    gl_FragColor = vec4(c, a) * color;\n"
+    "}\n";
+
+//
+// The same for a core profile context. rect is the part of the map to
+// shade, 0 to 1 from its top left, the top being the top of clip space;
+// extent is how much of the field the map covers.
+//
+static const char *render_density_core_vs =
+    "#version 330 core\n"
+    "uniform vec2 extent;\n"
+    "uniform vec4 rect;\n"
+    "out vec2 tex_at;\n"
+    "void main ()\n"
+    "{\n"
+    "    vec2 at = mix(rect.xy, rect.zw,\n"
+    "                  vec2(gl_VertexID & 1, gl_VertexID >> 1));\n"
+    "    tex_at = at * extent;\n"
+    "    gl_Position = vec4(at.x * 2.0 - 1.0, 1.0 - at.y * 2.0, 0.0, 1.0);\n"
+    "}\n";
+
+static const char *render_density_core_fs =
+    "#version 330 core\n"
+    DENSITY_RAMP
+    "uniform sampler2D tex;\n"
+    "uniform vec4 color;\n"
+    "in vec2 tex_at;\n"
+    "out vec4 frag;\n"
+    "void main ()\n"
+    "{\n"
+    "    float d = texture(tex, tex_at).r * range;\n"
+    "    float a = smoothstep(edge * 0.5, edge, d);\n"
+    "    vec3 c = mix(shallow, deep, clamp((d - edge) / range, 0.0, 1.0));\n"
+    "    frag = vec4(c, a) * color;\n"
+    "}\n";
+
+static GLuint density_program;
+static GLuint density_vao;
+static GLuint density_tex;
+static GLint density_color;
+static GLint density_extent;
+static GLint density_rect;
+static bool density_tried;
+static bool density_ok;
+
+static int density_w;
+static int density_h;
+static int density_tex_w;
+static int density_tex_h;
+
+//
+// A particle as the splat wants it, in cells.
+//
+class DensitySplat {
+public:
+    float x;
+    float y;
+    float r;
+};
+
+//
+// Rows of the field per band. Splats are binned by the bands they reach
+// into, so each band only walks its own, and a band is the unit of work
+// handed to the thread pool. A standard particle splats about 9 rows, so
+// with bands this deep it lands in at most two.
+//
+static const int DENSITY_BAND_ROWS = 16;
+
+static std::vector<DensitySplat> density_splats;
+static std::vector<int> density_band_start;
+static std::vector<DensitySplat> density_band_splats;
+static std::vector<float> density_field;
+static std::vector<uint8_t> density_bytes;
+
+//
+// Bytes uploaded for the last density draw.
+//
+static size_t density_uploaded;
+
+static bool render_density_init (void)
+{_
+    if (density_tried) {
+        return (density_ok);
+    }
+    density_tried = true;
+
+    density_program = gl_program_new("particle density",
+                                     gl_core ? render_density_core_vs :
+                                               render_density_vs,
+                                     gl_core ? render_density_core_fs :
+                                               render_density_fs);
+    if (!density_program) {
+        CON("render: no particle density shader, using sprites");
+        return (false);
+    }
+
+    density_color = glGetUniformLocation_EXT(density_program, "color");
+    density_extent = glGetUniformLocation_EXT(density_program, "extent");
+    density_rect = glGetUniformLocation_EXT(density_program, "rect");
+
+    glUseProgram_EXT(density_program);
+    glUniform1i_EXT(glGetUniformLocation_EXT(density_program, "tex"), 0);
+    glUniform1f_EXT(glGetUniformLocation_EXT(density_program, "range"),
+                    DENSITY_RANGE);
+    glUseProgram_EXT(0);
+
+    if (gl_core) {
+        glGenVertexArrays_EXT(1, &density_vao);
+    }
+
+    glGenTextures(1, &density_tex);
+
+    density_ok = true;
+    return (true);
+}
+
+//
+// Add one splat to the field, in rows row0 to row1 only.
+//
+static void density_splat (const DensitySplat &s, int row0, int row1)
+{
+    int w = density_w;
+    int y0 = std::max((int) floor(s.y - s.r), row0);
+    int y1 = std::min((int) ceil(s.y + s.r), row1);
+    int x0 = std::max((int) floor(s.x - s.r), 0);
+    int x1 = std::min((int) ceil(s.x + s.r), w - 1);
+    float inv_r2 = 1.0f / (s.r * s.r);
+
+    for (auto y = y0; y <= y1; y++) {
+        float dy = (y + 0.5f) - s.y;
+        float *row = density_field.data() + (size_t) y * w;
+
+        for (auto x = x0; x <= x1; x++) {
+            float dx = (x + 0.5f) - s.x;
+            float q = (dx * dx + dy * dy) * inv_r2;
+            if (q < 1.0f) {
+                row[x] += (1.0f - q) * (1.0f - q);
+            }
+        }
+    }
+}
+
+//
+// Splat every particle into the field and shade it over the map. The field
+// is split into bands of rows over the thread pool; each band takes the
+// particles binned into it and only writes its own rows, so no two
+// threads touch the same cell.
+//
+static void render_density (void)
+{
+    static const float sprite_size = TILE_WIDTH / 2;
+
+    density_w = (GL_WIDTH + DENSITY_CELL - 1) / DENSITY_CELL;
+    density_h = (GL_HEIGHT + DENSITY_CELL - 1) / DENSITY_CELL;
+    if ((density_w <= 0) || (density_h <= 0)) {
+        return;
+    }
+
+    //
+    // The cells any particle reaches; only those are shaded.
+    //
+    float tlx = density_w;
+    float tly = density_h;
+    float brx = 0;
+    float bry = 0;
+
+    density_splats.clear();
+    FOR_ALL_PARTICLES(p) {
+        p->force = fpoint(0.0f, 0.0f);
+
+        DensitySplat s;
+        s.x = p->at.x / DENSITY_CELL;
+        s.y = p->at.y / DENSITY_CELL;
+        s.r = sprite_size * (p->h / KERNEL_RANGE) / DENSITY_CELL;
+        density_splats.push_back(s);
+
+        tlx = std::min(tlx, s.x - s.r);
+        tly = std::min(tly, s.y - s.r);
+        brx = std::max(brx, s.x + s.r);
+        bry = std::max(bry, s.y + s.r);
+    } FOR_ALL_PARTICLES_END()
+
+    if (density_splats.empty()) {
+        return;
+    }
+
+    size_t cells = (size_t) density_w * density_h;
+    density_field.resize(cells);
+    density_bytes.resize(cells);
+
+    int w = density_w;
+    int bands = (density_h + DENSITY_BAND_ROWS - 1) / DENSITY_BAND_ROWS;
+
+    //
+    // Counting sort of the splats into every band they reach.
+    //
+    auto band_range = [&](const DensitySplat &s, int *b0, int *b1) {
+        *b0 = std::max((int) floor(s.y - s.r), 0) / DENSITY_BAND_ROWS;
+        *b1 = std::min((int) ceil(s.y + s.r), density_h - 1) /
+              DENSITY_BAND_ROWS;
+    };
+
+    density_band_start.assign(bands + 1, 0);
+    for (const auto &s : density_splats) {
+        int b0, b1;
+        band_range(s, &b0, &b1);
+        for (auto b = b0; b <= b1; b++) {
+            density_band_start[b + 1]++;
+        }
+    }
+
+    for (auto b = 0; b < bands; b++) {
+        density_band_start[b + 1] += density_band_start[b];
+    }
+
+    density_band_splats.resize(density_band_start[bands]);
+    {
+        std::vector<int> next(density_band_start.begin(),
+                              density_band_start.end() - 1);
+        for (const auto &s : density_splats) {
+            int b0, b1;
+            band_range(s, &b0, &b1);
+            for (auto b = b0; b <= b1; b++) {
+                density_band_splats[next[b]++] = s;
+            }
+        }
+    }
+
+    thread_pool()->parallel_for(bands, [&](int band_begin, int band_end,
+                                           int chunk) {
+        int begin = band_begin * DENSITY_BAND_ROWS;
+        int end = std::min(band_end * DENSITY_BAND_ROWS, density_h);
+
+        float *field = density_field.data() + (size_t) begin * w;
+        std::fill(field, field + (size_t) (end - begin) * w, 0.0f);
+
+        for (auto b = band_begin; b < band_end; b++) {
+            int row0 = b * DENSITY_BAND_ROWS;
+            int row1 = std::min(row0 + DENSITY_BAND_ROWS, density_h) - 1;
+
+            for (auto i = density_band_start[b];
+                 i < density_band_start[b + 1]; i++) {
+                density_splat(density_band_splats[i], row0, row1);
+            }
+        }
+
+        uint8_t *out = density_bytes.data() + (size_t) begin * w;
+        for (size_t i = 0; i < (size_t) (end - begin) * w; i++) {
+            out[i] = (uint8_t)
+                std::min(field[i] * (255.0f / DENSITY_RANGE) + 0.5f, 255.0f);
+        }
+    });
+
+    //
+    // One upload, respecified only when the map changes size.
+    //
+    glBindTexture(GL_TEXTURE_2D, density_tex);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    if ((density_tex_w != density_w) || (density_tex_h != density_h)) {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexImage2D(GL_TEXTURE_2D, 0, gl_core ? GL_R8 : GL_LUMINANCE,
+                     density_w, density_h, 0,
+                     gl_core ? GL_RED : GL_LUMINANCE, GL_UNSIGNED_BYTE,
+                     density_bytes.data());
+        density_tex_w = density_w;
+        density_tex_h = density_h;
+    } else {
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, density_w, density_h,
+                        gl_core ? GL_RED : GL_LUMINANCE, GL_UNSIGNED_BYTE,
+                        density_bytes.data());
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    density_uploaded = cells;
+
+    //
+    // Cells past the edge of the map are cut off, rather than the field
+    // stretched to fit.
+    //
+    const float extent[2] = {
+        (float) GL_WIDTH / (density_w * DENSITY_CELL),
+        (float) GL_HEIGHT / (density_h * DENSITY_CELL),
+    };
+
+    //
+    // The particles' extent, a cell more all round for the filtering, as a
+    // part of the map.
+    //
+    float field_w = (float) density_w * DENSITY_CELL;
+    float field_h = (float) density_h * DENSITY_CELL;
+    const float rect[4] = {
+        std::max((floor(tlx) - 1) * DENSITY_CELL / GL_WIDTH, 0.0f),
+        std::max((floor(tly) - 1) * DENSITY_CELL / GL_HEIGHT, 0.0f),
+        std::min((ceil(brx) + 1) * DENSITY_CELL / GL_WIDTH, 1.0f),
+        std::min((ceil(bry) + 1) * DENSITY_CELL / GL_HEIGHT, 1.0f),
+    };
+
+    if ((rect[0] >= rect[2]) || (rect[1] >= rect[3])) {
+        glBindTexture(GL_TEXTURE_2D, 0);
+        return;
+    }
+
+    color c = gl_color_current();
+
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glUseProgram_EXT(density_program);
+    glUniform4f_EXT(density_color, c.r / 255.0f, c.g / 255.0f,
+                    c.b / 255.0f, c.a / 255.0f);
+
+    if (gl_core) {
+        glUniform2fv_EXT(density_extent, 1, extent);
+        glUniform4f_EXT(density_rect, rect[0], rect[1], rect[2], rect[3]);
+        glBindVertexArray_EXT(density_vao);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+        gl_draw_calls++;
+        glBindVertexArray_EXT(0);
+    } else {
+        blit_init();
+        blit(density_tex,
+             rect[0] * GL_WIDTH / field_w, rect[1] * GL_HEIGHT / field_h,
+             rect[2] * GL_WIDTH / field_w, rect[3] * GL_HEIGHT / field_h,
+             rect[0] * GL_WIDTH, rect[1] * GL_HEIGHT,
+             rect[2] * GL_WIDTH, rect[3] * GL_HEIGHT);
+        blit_flush();
+    }
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glUseProgram_EXT(0);
+    glBlendFunc(GL_ONE, GL_ZERO);
+}
+
+void sph_render (void)
+{
+    static auto tile = tile_find_mand("ball");
+
+    blit_fbo_bind(FBO_MAP);
+    glClearColor(0, 0, 0, 0);
+    glClear(GL_COLOR_BUFFER_BIT);
+    glBlendFunc(GL_ONE, GL_ZERO);
+    glcolorfast(WHITE);
+
+    sph_sdf_render();
+
+    //
+    // Past so many particles, sprites are too many to draw or make out.
+    //
+    static bool density_forced;
+    if (!sph_render_density_from) {
+        density_forced = false;
+    } else if (game->num_particles >= sph_render_density_from) {
+        density_forced = true;
+    } else if (game->num_particles <
+               std::min(sph_render_density_until, sph_render_density_from)) {
+        density_forced = false;
+    }
+
+    int mode = sph_render_mode;
+    if (density_forced) {
+        mode = SPH_RENDER_DENSITY;
+    }
+
+    if ((mode == SPH_RENDER_DENSITY) && render_density_init()) {
+        render_density();
+    } else if ((mode == SPH_RENDER_INSTANCED) && render_instanced_init()) {
+        render_instanced(tile);
+    } else if ((mode == SPH_RENDER_PARALLEL) && render_parallel_init()) {
+        render_parallel(tile);
+    } else {
+        render_sprites(tile);
+    }
+}
+
+bool sph_render_parse (const char *name)
+{
+    for (auto i = 0; i < SPH_RENDER_MAX; i++) {
+        if (!strcasecmp(name, sph_render_names[i])) {
+            sph_render_mode = i;
+            return (true);
+        }
+    }
+
+    return (false);
+}
+
+const char *sph_render_name (int mode)
+{
+    if ((mode < 0) || (mode >= SPH_RENDER_MAX)) {
+        return ("?");
+    }
+    return (sph_render_names[mode]);
+}
+
+//
+// User has entered a command, run it
+//
+uint8_t sph_render_set (tokens_t *tokens, void *context)
+{_
+    char *s = tokens->args[2];
+
+    if (s && (*s != '\0') && !sph_render_parse(s)) {
+        CON("unknown render %s; try sprites, instanced, parallel or density",
+            s);
+        return (false);
+    }
+
+    if ((sph_render_mode == SPH_RENDER_INSTANCED) &&
+        !render_instanced_init()) {
+        CON("particle render instanced unavailable, drawing sprites");
+        return (true);
+    }
+
+    if ((sph_render_mode == SPH_RENDER_PARALLEL) &&
+        !render_parallel_init()) {
+        CON("particle render parallel unavailable, drawing sprites");
+        return (true);
+    }
+
+    if ((sph_render_mode == SPH_RENDER_DENSITY) &&
+        !render_density_init()) {
+        CON("particle render density unavailable, drawing sprites");
+        return (true);
+    }
+
+    CON("particle render %s", sph_render_name(sph_render_mode));
+    return (true);
+}
+
+//
+// User has entered a command, run it
+//
+uint8_t sph_bench_render (tokens_t *tokens, void *context)
+{_
+    //
+    // Vertices a sprite pushes: its four corners and the two that join it
+    // to the last with degenerate triangles.
+    //
+    static const int SPRITE_BYTES = 6 * NUMBER_BYTES_PER_VERTICE_2D;
+
+    char *s = tokens->args[2];
+    int frames = 100;
+
+    if (s && (*s != '\0')) {
+        frames = atoi(s);
+    }
+    if (frames <= 0) {
+        frames = 1;
+    }
+
+    auto mode = sph_render_mode;
+    auto density_from = sph_render_density_from;
+
+    //
+    // Each mode as asked for, not switched to density by the count.
+    //
+    sph_render_density_from = 0;
+
+    CON("bench render: %d particles, %d frames", game->num_particles, frames);
+
+    for (auto m = 0; m < SPH_RENDER_MAX; m++) {
+        if ((m == SPH_RENDER_INSTANCED) && !render_instanced_init()) {
+            CON("  %-7s: unavailable", sph_render_name(m));
+            continue;
+        }
+        if ((m == SPH_RENDER_PARALLEL) && !render_parallel_init()) {
+            CON("  %-7s: unavailable", sph_render_name(m));
+            continue;
+        }
+        if ((m == SPH_RENDER_DENSITY) && !render_density_init()) {
+            CON("  %-7s: unavailable", sph_render_name(m));
+            continue;
+        }
+
+        sph_render_mode = m;
+        sph_render();
+        glFinish();
+
+        //
+        // Submit is the time to build and hand the frames to the driver;
+        // the rest is the driver and GPU catching up.
+        //
+        auto start = std::chrono::steady_clock::now();
+        for (auto f = 0; f < frames; f++) {
+            sph_render();
+        }
+        auto submitted = std::chrono::steady_clock::now();
+        glFinish();
+        auto end = std::chrono::steady_clock::now();
+        double submit_ms =
+            std::chrono::duration<double, std::milli>(submitted - start).count();
+        double ms =
+            std::chrono::duration<double, std::milli>(end - start).count();
+
+        double bytes = SPRITE_BYTES;
+        if ((m == SPH_RENDER_INSTANCED) && game->num_particles) {
+            bytes = (double) instanced_bytes / game->num_particles;
+        }
+        if ((m == SPH_RENDER_DENSITY) && game->num_particles) {
+            bytes = (double) density_uploaded / game->num_particles;
+        }
+
+        CON("  %-9s: %8.3f ms/frame, %8.3f ms submit, "
+            "%5.1f bytes/particle uploaded",
+            sph_render_name(m), ms / frames, submit_ms / frames, bytes);
+    }
+
+    sph_render_mode = mode;
+    sph_render_density_from = density_from;
+    blit_fbo_unbind();
+
+    return (true);
+}
+
+//
+// User has entered a command, run it
+//
+uint8_t sph_render_density_set (tokens_t *tokens, void *context)
+{_
+    char *s = tokens->args[2];
+    char *u = tokens->args[3];
+
+    if (s && (*s != '\0')) {
+        sph_render_density_from = std::max(atoi(s), 0);
+    }
+
+    if (u && (*u != '\0')) {
+        sph_render_density_until = std::max(atoi(u), 0);
+    }
+
+    if (sph_render_density_from) {
+        CON("particles drawn as density from %d particles until under %d",
+            sph_render_density_from,
+            std::min(sph_render_density_until, sph_render_density_from));
+    } else {
+        CON("particles never drawn as density unless asked");
+    }
+    return (true);
+}
@@ -0,0 +1,273 @@
+//
+// Copyright goblinhack@gmail.com
+// See the README file for license info.
+//
+
+#include "my_game.h"
+#include "my_file.h"
+#include "my_sph_sdf.h"
+#include "my_thread_pool.h"
+#include "my_tex.h"
+#include "my_gl.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace Constants;
+
+bool sph_sdf_loaded;
+std::string sph_sdf_file;
+
+//
+// Particles are kept this far clear of an obstacle surface.
+//
+static const float SDF_MARGIN = 1.0;
+
+//
+// Stands in for infinity in the distance transform; squared distances
+// never get near it.
+//
+static const float SDF_FAR = 1e20;
+
+typedef struct {
+    float dist;
+    fpoint normal;
+} SphSdfSample;
+
+static int sdf_w;
+static int sdf_h;
+static std::vector<SphSdfSample> sdf;
+static std::vector<uint8_t> sdf_mask;
+static Texp sdf_tex;
+
+//
+// Felzenszwalb and Huttenlocher: squared distance to the nearest set
+// sample along one line, as the lower envelope of parabolas rooted at
+// each sample. Linear in n.
+//
+static void sdf_edt_1d (const float *f, float *d, int n, int *v, float *z)
+{
+    int k = 0;
+    v[0] = 0;
+    z[0] = -SDF_FAR;
+    z[1] = SDF_FAR;
+
+    for (auto q = 1; q < n; q++) {
+        auto r = v[k];
+        float s = ((f[q] + q * q) - (f[r] + r * r)) / (2 * q - 2 * r);
+        while (s <= z[k]) {
+            k--;
+            r = v[k];
+            s = ((f[q] + q * q) - (f[r] + r * r)) / (2 * q - 2 * r);
+        }
+        k++;
+        v[k] = q;
+        z[k] = s;
+        z[k + 1] = SDF_FAR;
+    }
+
+    k = 0;
+    for (auto q = 0; q < n; q++) {
+        while (z[k + 1] < q) {
+            k++;
+        }
+        auto r = v[k];
+        d[q] = (q - r) * (q - r) + f[r];
+    }
+}
+
+//
+// Squared distance from every sample to the nearest one where mask equals
+// want; columns then rows, each line independent so split over the pool.
+//
+static void sdf_edt (std::vector<float> &out, uint8_t want)
+{
+    int n = std::max(sdf_w, sdf_h);
+
+    out.resize(sdf_w * sdf_h);
+    for (auto i = 0; i < sdf_w * sdf_h; i++) {
+        out[i] = (sdf_mask[i] == want) ? 0 : SDF_FAR;
+    }
+
+    auto pass = [&](int lines, int len, int stride, int step) {
+        thread_pool()->parallel_for(lines, [&](int begin, int end, int chunk) {
+            std::vector<float> f(n), d(n), z(n + 1);
+            std::vector<int> v(n);
+
+            for (auto line = begin; line < end; line++) {
+                auto base = line * step;
+                for (auto i = 0; i < len; i++) {
+                    f[i] = out[base + i * stride];
+                }
+                sdf_edt_1d(f.data(), d.data(), len, v.data(), z.data());
+                for (auto i = 0; i < len; i++) {
+                    out[base + i * stride] = d[i];
+                }
+            }
+        });
+    };
+
+    pass(sdf_w, sdf_h, sdf_w, 1);
+    pass(sdf_h, sdf_w, 1, sdf_w);
+}
+
+//
+// Load an obstacle mask and build its distance field.
+//
+bool sph_sdf_load (const std::string &file)
+{_
+    if (!file_exists(file.c_str())) {
+        ERR("no obstacle mask '%s'", file.c_str());
+        return (false);
+    }
+
+    int32_t w, h;
+    if (!tex_load_mask(file, sdf_mask, &w, &h) || (w < 2) || (h < 2)) {
+        ERR("could not load obstacle mask '%s'", file.c_str());
+        return (false);
+    }
+
+    sdf_w = w;
+    sdf_h = h;
+
+    std::vector<float> to_solid, to_free;
+    sdf_edt(to_solid, 1);
+    sdf_edt(to_free, 0);
+
+    //
+    // Mask samples to window pixels; masks should share the window's
+    // aspect, as distances are scaled by the mean.
+    //
+    float scale = (GL_WIDTH / sdf_w + GL_HEIGHT / sdf_h) / 2.0f;
+
+    sdf.resize(sdf_w * sdf_h);
+    for (auto i = 0; i < sdf_w * sdf_h; i++) {
+        sdf[i].dist = (sqrt(to_solid[i]) - sqrt(to_free[i])) * scale;
+    }
+
+    for (auto y = 0; y < sdf_h; y++) {
+        for (auto x = 0; x < sdf_w; x++) {
+            auto x0 = std::max(x - 1, 0), x1 = std::min(x + 1, sdf_w - 1);
+            auto y0 = std::max(y - 1, 0), y1 = std::min(y + 1, sdf_h - 1);
+            fpoint n(sdf[y * sdf_w + x1].dist - sdf[y * sdf_w + x0].dist,
+                     sdf[y1 * sdf_w + x].dist - sdf[y0 * sdf_w + x].dist);
+            float len = sqrt(n.x * n.x + n.y * n.y);
+            sdf[y * sdf_w + x].normal = (len > 0) ? n * (1.0f / len) :
+                                                    fpoint(0, -1);
+        }
+    }
+
+    //
+    // The old mask's texture is made again from this one when next drawn.
+    //
+    if (sdf_tex) {
+        tex_free(sdf_tex);
+        sdf_tex = nullptr;
+    }
+
+    sph_sdf_loaded = true;
+
+    CON("obstacles from %s, %d x %d", file.c_str(), sdf_w, sdf_h);
+
+    return (true);
+}
+
+//
+// Bilinear fetch of distance and normal at a window position.
+//
+static inline SphSdfSample sdf_sample (const fpoint &at)
+{
+    float gx = at.x * sdf_w / GL_WIDTH - 0.5f;
+    float gy = at.y * sdf_h / GL_HEIGHT - 0.5f;
+    int i = std::min(std::max((int) floor(gx), 0), sdf_w - 2);
+    int j = std::min(std::max((int) floor(gy), 0), sdf_h - 2);
+    float fx = std::min(std::max(gx - i, 0.0f), 1.0f);
+    float fy = std::min(std::max(gy - j, 0.0f), 1.0f);
+
+    const auto &a = sdf[j * sdf_w + i];
+    const auto &b = sdf[j * sdf_w + i + 1];
+    const auto &c = sdf[(j + 1) * sdf_w + i];
+    const auto &d = sdf[(j + 1) * sdf_w + i + 1];
+
+    float wa = (1 - fx) * (1 - fy), wb = fx * (1 - fy);
+    float wc = (1 - fx) * fy, wd = fx * fy;
+
+    SphSdfSample s;
+    s.dist = a.dist * wa + b.dist * wb + c.dist * wc + d.dist * wd;
+    s.normal = a.normal * wa + b.normal * wb + c.normal * wc + d.normal * wd;
+    return (s);
+}
+
+float sph_sdf_distance (const fpoint &at, fpoint *normal)
+{
+    auto s = sdf_sample(at);
+    float len = sqrt(s.normal.x * s.normal.x + s.normal.y * s.normal.y);
+
+    *normal = (len > 0) ? s.normal * (1.0f / len) : fpoint(0, -1);
+    return (s.dist);
+}
+
+bool sph_sdf_inside (const fpoint &at)
+{
+    if (!sph_sdf_loaded) {
+        return (false);
+    }
+
+    return (sdf_sample(at).dist < SDF_MARGIN);
+}
+
+void sph_sdf_push (fpoint &at, fpoint *velocity, float bounce)
+{
+    auto s = sdf_sample(at);
+    if (s.dist >= SDF_MARGIN) {
+        return;
+    }
+
+    float len = sqrt(s.normal.x * s.normal.x + s.normal.y * s.normal.y);
+    if (len <= 0) {
+        return;
+    }
+    fpoint n = s.normal * (1.0f / len);
+
+    at += n * (SDF_MARGIN - s.dist);
+
+    if (velocity) {
+        float vn = velocity->x * n.x + velocity->y * n.y;
+        if (vn < 0) {
+            *velocity -= n * ((1.0f + bounce) * vn);
+        }
+    }
+}
+
+//
+// Obstacles are drawn under the particles, from the mask.
+//
+void sph_sdf_render (void)
+{
+    if (!sph_sdf_loaded) {
+        return;
+    }
+
+    if (!sdf_tex) {
+        auto surf = SDL_CreateRGBSurface(0, sdf_w, sdf_h, 32,
+                                         0x000000ff, 0x0000ff00,
+                                         0x00ff0000, 0xff000000);
+        newptr(surf, "SDL_CreateRGBSurface");
+
+        auto pixels = (uint32_t*) surf->pixels;
+        for (auto y = 0; y < sdf_h; y++) {
+            auto row = (uint32_t*) ((uint8_t*) pixels + y * surf->pitch);
+            for (auto x = 0; x < sdf_w; x++) {
+                row[x] = sdf_mask[y * sdf_w + x] ? 0xff606060 : 0;
+            }
+        }
+
+        sdf_tex = tex_from_surface(surf, sph_sdf_file, "obstacles",
+                                   GL_NEAREST);
+    }
+
+    blit_init();
+    blit(tex_get_gl_binding(sdf_tex), 0, 0, GL_WIDTH, GL_HEIGHT);
+    blit_flush();
+}
@@ -0,0 +1,221 @@
+//
+// Copyright goblinhack@gmail.com
+// See the README file for license info.
+//
+
+#include "my_game.h"
+#include "my_sph_solver.h"
+
+#include <algorithm>
+#include <vector>
+
+using namespace Constants;
+
+bool sph_sleep_enabled;
+float sph_sleep_active = 1.0f;
+
+//
+// Resting fluid here is never still: every particle jitters against its
+// neighbours at thousands of pixels a second and wanders off a spacing or
+// more within a few hundred steps, however long the pool has settled. What
+// does settle is each cell as a whole, so a cell is calm while the mean of
+// its particles' movement since it last went busy stays within this
+// distance, and while they are not on average moving faster than a fall
+// of one rest spacing would make them, so fluid arriving from elsewhere
+// keeps its cell busy from the first step.
+//
+static const float SLEEP_DRIFT = REST_SPACING;
+static const float SLEEP_SPEED = sqrt(2 * GRAVITY * REST_SPACING);
+
+//
+// Steps a cell and all its neighbours must stay calm before its particles
+// are put to sleep.
+//
+static const int SLEEP_STEPS = 30;
+
+//
+// Cells are kernel sized, so anything that can affect a particle is in
+// its own cell or one of the eight around it.
+//
+static std::vector<uint8_t> calm;
+static std::vector<fpoint> drift;
+static std::vector<fpoint> moved;
+static std::vector<fpoint> speed;
+static std::vector<uint16_t> count;
+static std::vector<uint8_t> asleep;
+static int cells_w;
+static int cells_h;
+static int sleeping;
+
+static inline int sleep_cell (const fpoint &at)
+{
+    int x = std::min(std::max((int) (at.x / KERNEL_RANGE), 0), cells_w - 1);
+    int y = std::min(std::max((int) (at.y / KERNEL_RANGE), 0), cells_h - 1);
+    return (y * cells_w + x);
+}
+
+static void sleep_resize (void)
+{
+    int w = GL_WIDTH / KERNEL_RANGE + 1;
+    int h = GL_HEIGHT / KERNEL_RANGE + 1;
+
+    if ((w == cells_w) && (h == cells_h)) {
+        return;
+    }
+
+    cells_w = w;
+    cells_h = h;
+    calm.assign(w * h, 0);
+    drift.assign(w * h, fpoint(0, 0));
+    moved.assign(w * h, fpoint(0, 0));
+    speed.assign(w * h, fpoint(0, 0));
+    count.assign(w * h, 0);
+    asleep.assign(w * h, 0);
+}
+
+static void sleep_wake_all (void)
+{
+    FOR_ALL_PARTICLES(p) {
+        p->asleep = false;
+    } FOR_ALL_PARTICLES_END()
+
+    std::fill(calm.begin(), calm.end(), 0);
+    std::fill(drift.begin(), drift.end(), fpoint(0, 0));
+    sleeping = 0;
+}
+
+//
+// Once per step, before the density pass. Cells whose particles have
+// drifted or are moving fast are busy and restart their count; a cell
+// sleeps once it and its neighbours have all been calm long enough, so
+// activity next door wakes it straight away.
+//
+void sph_sleep_update (void)
+{
+    if (!sph_sleep_enabled) {
+        if (sleeping) {
+            sleep_wake_all();
+        }
+        sph_sleep_active = 1.0f;
+        return;
+    }
+
+    sleep_resize();
+    std::fill(moved.begin(), moved.end(), fpoint(0, 0));
+    std::fill(speed.begin(), speed.end(), fpoint(0, 0));
+    std::fill(count.begin(), count.end(), 0);
+
+    //
+    // Sleepers are counted too, both because they hold their cell's mean
+    // down and in case something other than the solver moved them.
+    //
+    FOR_ALL_PARTICLES(p) {
+        int c = sleep_cell(p->at);
+        moved[c] += p->at - p->sleep_at;
+        speed[c] += p->velocity;
+        count[c]++;
+        p->sleep_at = p->at;
+    } FOR_ALL_PARTICLES_END()
+
+    for (size_t c = 0; c < calm.size(); c++) {
+        bool busy = false;
+
+        if (count[c]) {
+            drift[c] += moved[c] / count[c];
+            fpoint v = speed[c] / count[c];
+            busy = (drift[c].x * drift[c].x + drift[c].y * drift[c].y >
+                    SLEEP_DRIFT * SLEEP_DRIFT) ||
+                   (v.x * v.x + v.y * v.y > SLEEP_SPEED * SLEEP_SPEED);
+        }
+
+        if (busy) {
+            drift[c] = fpoint(0, 0);
+            calm[c] = 0;
+        } else {
+            calm[c] = std::min(calm[c] + 1, SLEEP_STEPS);
+        }
+    }
+
+    for (auto y = 0; y < cells_h; y++) {
+        for (auto x = 0; x < cells_w; x++) {
+            uint8_t quiet = SLEEP_STEPS;
+            for (auto oy = std::max(y - 1, 0);
+                 oy <= std::min(y + 1, cells_h - 1); oy++) {
+                for (auto ox = std::max(x - 1, 0);
+                     ox <= std::min(x + 1, cells_w - 1); ox++) {
+                    quiet = std::min(quiet, calm[oy * cells_w + ox]);
+                }
+            }
+            asleep[y * cells_w + x] = (quiet >= SLEEP_STEPS);
+        }
+    }
+
+    int total = 0;
+    sleeping = 0;
+
+    {
+        FOR_ALL_PARTICLES(p) {
+            bool sleep = asleep[sleep_cell(p->at)];
+
+            //
+            // Settle exactly, so there is no drift to pick up on waking.
+            //
+            if (sleep && !p->asleep) {
+                p->velocity = fpoint(0, 0);
+                p->accel = fpoint(0, 0);
+            }
+
+            p->asleep = sleep;
+            sleeping += sleep;
+            total++;
+        } FOR_ALL_PARTICLES_END()
+    }
+
+    sph_sleep_active = total ? 1.0f - (float) sleeping / total : 1.0f;
+}
+
+//
+// Restart the count for every cell touching this circle, so particles
+// there are awake from the next step on.
+//
+void sph_sleep_wake (const fpoint &at, float radius)
+{
+    if (!sph_sleep_enabled || calm.empty()) {
+        return;
+    }
+
+    float r = radius + KERNEL_RANGE;
+    int x0 = std::max((int) ((at.x - r) / KERNEL_RANGE), 0);
+    int y0 = std::max((int) ((at.y - r) / KERNEL_RANGE), 0);
+    int x1 = std::min((int) ((at.x + r) / KERNEL_RANGE), cells_w - 1);
+    int y1 = std::min((int) ((at.y + r) / KERNEL_RANGE), cells_h - 1);
+
+    for (auto y = y0; y <= y1; y++) {
+        for (auto x = x0; x <= x1; x++) {
+            calm[y * cells_w + x] = 0;
+        }
+    }
+}
+
+//
+// User has entered a command, run it
+//
+uint8_t sph_sleep_set (tokens_t *tokens, void *context)
+{_
+    char *s = tokens->args[2];
+
+    if (!s || (*s == '\0') || (*s == '1')) {
+        sph_sleep_enabled = true;
+        CON("sleeping on; cells calm for %d steps sleep", SLEEP_STEPS);
+
+        if (sph_solver_name != "wcsph") {
+            CON("only wcsph sleeps; %s keeps every particle awake",
+                sph_solver_name.c_str());
+        }
+    } else {
+        sph_sleep_enabled = false;
+        CON("sleeping off");
+    }
+
+    return (true);
+}
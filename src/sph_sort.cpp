@@ -0,0 +1,343 @@
+//
+// Copyright goblinhack@gmail.com
+// See the README file for license info.
+//
+
+#include "my_game.h"
+#include "my_sph_solver.h"
+#include "my_sph_sort.h"
+#include "my_thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <memory>
+
+using namespace Constants;
+
+int sph_search = SPH_SEARCH_SLOTS;
+bool sph_sort_permute;
+bool sph_sort_dirty = true;
+
+std::vector<uint16_t> sph_sort_ids;
+std::vector<SphSortCell> sph_sort_cells;
+std::vector<uint32_t> sph_sort_cell_start;
+int sph_sort_cells_w;
+int sph_sort_cells_h;
+float sph_sort_cell = KERNEL_RANGE / 2;
+float sph_sort_h_max;
+double sph_sort_build_us;
+
+static const char *sph_search_names[] = {
+    "slots", "sort",
+};
+
+//
+// Bits of key sorted per pass, and so how many buckets each pass counts.
+//
+static const int SORT_RADIX_BITS = 8;
+static const int SORT_RADIX = 1 << SORT_RADIX_BITS;
+
+//
+// Every particle slot is keyed, empty ones one past the last cell so they
+// sort to the end. The last slot is left out, as FOR_ALL_PARTICLES does.
+//
+static const int SORT_SLOTS = PARTICLE_MAX - 1;
+
+static std::vector<uint32_t> keys;
+static std::vector<uint32_t> keys_next;
+static std::vector<uint16_t> ids_next;
+
+//
+// Per chunk counts: of each radix digit for the pass being sorted, and of
+// each cell for the cell ranges.
+//
+static std::vector<uint32_t> digit_counts;
+static std::vector<uint32_t> cell_counts;
+static std::vector<uint32_t> chunk_sums;
+static std::vector<float> chunk_h_max;
+
+static std::unique_ptr<std::array<Particle, PARTICLE_MAX>> permuted;
+
+static void sort_resize (int chunks)
+{
+    sph_sort_cells_w = GL_WIDTH / sph_sort_cell + 1;
+    sph_sort_cells_h = GL_HEIGHT / sph_sort_cell + 1;
+    int cells = sph_sort_cells_w * sph_sort_cells_h;
+
+    keys.resize(SORT_SLOTS);
+    keys_next.resize(SORT_SLOTS);
+    sph_sort_ids.resize(SORT_SLOTS);
+    ids_next.resize(SORT_SLOTS);
+    sph_sort_cells.resize(SORT_SLOTS);
+    sph_sort_cell_start.resize(cells + 1);
+
+    digit_counts.resize(chunks * SORT_RADIX);
+    cell_counts.resize(chunks * cells);
+    chunk_sums.resize(chunks);
+    chunk_h_max.assign(chunks, 0);
+}
+
+//
+// Cell key for every slot, counting particles per cell as we go.
+//
+static void sort_keys (ThreadPool *pool)
+{
+    int w = sph_sort_cells_w;
+    int cells = sph_sort_cells_w * sph_sort_cells_h;
+
+    pool->parallel_for(SORT_SLOTS, [&](int begin, int end, int chunk) {
+        auto counts = cell_counts.data() + chunk * cells;
+        std::fill(counts, counts + cells, 0);
+        float h_max = 0;
+
+        for (auto i = begin; i < end; i++) {
+            auto p = getptr(game->particles, i);
+            sph_sort_ids[i] = i;
+
+            if (!p->in_use) {
+                keys[i] = cells;
+                continue;
+            }
+
+            uint32_t key = sph_sort_cell_y(p->at.y) * w +
+                           sph_sort_cell_x(p->at.x);
+            keys[i] = key;
+            counts[key]++;
+            h_max = std::max(h_max, p->h);
+        }
+
+        chunk_h_max[chunk] = h_max;
+    });
+
+    sph_sort_h_max = *std::max_element(chunk_h_max.begin(),
+                                       chunk_h_max.end());
+}
+
+//
+// One least significant digit first pass. Each chunk counts its digits,
+// the counts are turned into where each chunk's run of each digit starts,
+// and each chunk then scatters its own slots in order, so the sort is
+// stable and earlier passes are kept.
+//
+static void sort_pass (ThreadPool *pool, int shift)
+{
+    int chunks = pool->size();
+    std::fill(digit_counts.begin(), digit_counts.end(), 0);
+
+    pool->parallel_for(SORT_SLOTS, [&](int begin, int end, int chunk) {
+        auto counts = digit_counts.data() + chunk * SORT_RADIX;
+        for (auto i = begin; i < end; i++) {
+            counts[(keys[i] >> shift) & (SORT_RADIX - 1)]++;
+        }
+    });
+
+    uint32_t total = 0;
+    for (auto d = 0; d < SORT_RADIX; d++) {
+        for (auto c = 0; c < chunks; c++) {
+            auto &count = digit_counts[c * SORT_RADIX + d];
+            auto n = count;
+            count = total;
+            total += n;
+        }
+    }
+
+    pool->parallel_for(SORT_SLOTS, [&](int begin, int end, int chunk) {
+        auto next = digit_counts.data() + chunk * SORT_RADIX;
+        for (auto i = begin; i < end; i++) {
+            auto key = keys[i];
+            auto to = next[(key >> shift) & (SORT_RADIX - 1)]++;
+            keys_next[to] = key;
+            ids_next[to] = sph_sort_ids[i];
+        }
+    });
+
+    keys.swap(keys_next);
+    sph_sort_ids.swap(ids_next);
+}
+
+//
+// Where each cell's run starts: the per chunk counts summed, then an
+// exclusive scan done as a scan within each chunk of cells, a scan of the
+// chunk totals, and the totals added back. Returns the particles sorted.
+//
+static uint32_t sort_cell_ranges (ThreadPool *pool)
+{
+    int chunks = pool->size();
+    int cells = sph_sort_cells_w * sph_sort_cells_h;
+
+    pool->parallel_for(cells, [&](int begin, int end, int chunk) {
+        uint32_t sum = 0;
+        for (auto c = begin; c < end; c++) {
+            uint32_t n = 0;
+            for (auto k = 0; k < chunks; k++) {
+                n += cell_counts[k * cells + c];
+            }
+            sph_sort_cell_start[c] = sum;
+            sum += n;
+        }
+        chunk_sums[chunk] = sum;
+    });
+
+    uint32_t total = 0;
+    for (auto &sum : chunk_sums) {
+        auto n = sum;
+        sum = total;
+        total += n;
+    }
+
+    pool->parallel_for(cells, [&](int begin, int end, int chunk) {
+        for (auto c = begin; c < end; c++) {
+            sph_sort_cell_start[c] += chunk_sums[chunk];
+        }
+    });
+
+    sph_sort_cell_start[cells] = total;
+
+    return (total);
+}
+
+//
+// Each sorted particle's slot grid cell, so searches can keep to it.
+//
+static void sort_cells (ThreadPool *pool, uint32_t total)
+{
+    pool->parallel_for(total, [&](int begin, int end, int chunk) {
+        for (auto i = begin; i < end; i++) {
+            auto p = getptr(game->particles, sph_sort_ids[i]);
+            uint8_t level = particle_grid_level(p);
+            auto sp = point_to_grid(p->at, level);
+            sph_sort_cells[i] = SphSortCell { sp.x, sp.y, level };
+        }
+    });
+}
+
+//
+// Pack the particles into slots 1 on in sorted order; slot 0 is never used,
+// and the last slot, which was not sorted, is left as it is.
+//
+static void sort_permute (ThreadPool *pool, uint32_t total)
+{
+    if (!permuted) {
+        permuted = std::make_unique<std::array<Particle, PARTICLE_MAX>>();
+    }
+
+    auto &to = *permuted;
+
+    pool->parallel_for(SORT_SLOTS, [&](int begin, int end, int chunk) {
+        for (auto i = begin; i < end; i++) {
+            if ((i >= 1) && (i <= (int) total)) {
+                to[i] = game->particles[sph_sort_ids[i - 1]];
+            } else {
+                to[i] = Particle {};
+            }
+        }
+    });
+
+    pool->parallel_for(SORT_SLOTS, [&](int begin, int end, int chunk) {
+        std::copy(to.begin() + begin, to.begin() + end,
+                  game->particles.begin() + begin);
+        for (auto i = begin; i < std::min(end, (int) total); i++) {
+            sph_sort_ids[i] = i + 1;
+        }
+    });
+}
+
+void sph_sort_build (bool permute)
+{
+    auto t = std::chrono::steady_clock::now();
+    auto pool = thread_pool();
+
+    sort_resize(pool->size());
+    sort_keys(pool);
+
+    uint32_t max_key = sph_sort_cells_w * sph_sort_cells_h;
+    for (auto shift = 0; (max_key >> shift) != 0; shift += SORT_RADIX_BITS) {
+        sort_pass(pool, shift);
+    }
+
+    auto total = sort_cell_ranges(pool);
+    sort_cells(pool, total);
+
+    if (permute) {
+        sort_permute(pool, total);
+    }
+
+    sph_sort_dirty = false;
+
+    auto d = std::chrono::steady_clock::now() - t;
+    sph_sort_build_us = std::chrono::duration<double, std::micro>(d).count();
+}
+
+void sph_search_select (int search)
+{
+    if (search == sph_search) {
+        return;
+    }
+
+    sph_search = search;
+
+    if (search == SPH_SEARCH_SORT) {
+        sph_sort_dirty = true;
+        return;
+    }
+
+    memset(game->all_particle_ids_at.data(), 0,
+           sizeof(game->all_particle_ids_at));
+    memset(game->coarse_particle_ids_at.data(), 0,
+           sizeof(game->coarse_particle_ids_at));
+    game->num_coarse_particles = 0;
+
+    FOR_ALL_PARTICLES(p) {
+        game->attach_particle(p);
+    } FOR_ALL_PARTICLES_END()
+}
+
+//
+// One of the backend names, or "permute" for sorted with the particles
+// moved into order too. Returns false, changing nothing, on anything else.
+//
+bool sph_search_parse (const char *name)
+{
+    if (!strcasecmp(name, "permute")) {
+        sph_search_select(SPH_SEARCH_SORT);
+        sph_sort_permute = true;
+        return (true);
+    }
+
+    for (auto i = 0; i < SPH_SEARCH_MAX; i++) {
+        if (!strcasecmp(name, sph_search_names[i])) {
+            sph_search_select(i);
+            sph_sort_permute = false;
+            return (true);
+        }
+    }
+
+    return (false);
+}
+
+const char *sph_search_name (int search)
+{
+    if ((search < 0) || (search >= SPH_SEARCH_MAX)) {
+        return ("?");
+    }
+    return (sph_search_names[search]);
+}
+
+//
+// User has entered a command, run it
+//
+uint8_t sph_search_set (tokens_t *tokens, void *context)
+{_
+    char *s = tokens->args[2];
+
+    if (s && (*s != '\0') && !sph_search_parse(s)) {
+        CON("unknown search %s; try slots sort or permute", s);
+        return (false);
+    }
+
+    CON("neighbour search %s%s", sph_search_name(sph_search),
+        ((sph_search == SPH_SEARCH_SORT) && sph_sort_permute) ?
+            ", particles permuted" : "");
+    return (true);
+}
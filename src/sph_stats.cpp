@@ -0,0 +1,301 @@
+//
+// Copyright goblinhack@gmail.com
+// See the README file for license info.
+//
+
+#include "my_game.h"
+#include "my_sph_stats.h"
+#include "my_thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <memory>
+
+using namespace Constants;
+
+int sph_stats_every;
+std::string sph_stats_file = "sph_stats.csv";
+
+typedef struct {
+    uint64_t step;
+    double   time;
+    float    dt_mean;
+    float    dt_min;
+    float    dt_max;
+    int      particles;
+    double   kinetic;
+    double   potential;
+    float    max_velocity;
+    double   mean_density_error;
+    float    max_density_error;
+    fpoint   centre_of_mass;
+    float    active;
+    double   cost_us;
+} SphStatsSample;
+
+//
+// One per pool chunk; aligned so chunks do not share cache lines.
+//
+typedef struct alignas(64) {
+    int    count;
+    double mass;
+    double kinetic;
+    double potential;
+    float  max_v2;
+    double density_error;
+    float  max_density_error;
+    double mx;
+    double my;
+} SphStatsPartial;
+
+//
+// Formatting and file IO happen on their own thread so the solver only
+// pays for the reductions.
+//
+class SphStatsWriter {
+public:
+    SphStatsWriter (FILE *fp) : fp(fp)
+    {
+        fprintf(fp, "step,time,dt_mean,dt_min,dt_max,particles,kinetic,potential,max_velocity,"
+                    "mean_density_error,max_density_error,com_x,com_y,"
+                    "active,cost_us\n");
+        thread = std::thread(&SphStatsWriter::run, this);
+    }
+
+    ~SphStatsWriter (void)
+    {
+        {
+            std::lock_guard<std::mutex> l(lock);
+            quit = true;
+        }
+        wake.notify_one();
+        thread.join();
+        fclose(fp);
+    }
+
+    void push (const SphStatsSample &s)
+    {
+        {
+            std::lock_guard<std::mutex> l(lock);
+            queue.push_back(s);
+        }
+        wake.notify_one();
+    }
+
+private:
+    void run (void)
+    {
+        std::vector<SphStatsSample> todo;
+
+        for (;;) {
+            bool last;
+            {
+                std::unique_lock<std::mutex> l(lock);
+                wake.wait(l, [&] { return (quit || !queue.empty()); });
+                todo.swap(queue);
+                last = quit;
+            }
+
+            for (const auto &s : todo) {
+                fprintf(fp, "%" PRIu64 ",%g,%g,%g,%g,%d,%g,%g,%g,%g,%g,%g,"
+                            "%g,%g,%.2f\n",
+                        s.step, s.time, s.dt_mean, s.dt_min, s.dt_max,
+                        s.particles,
+                        s.kinetic, s.potential, s.max_velocity,
+                        s.mean_density_error, s.max_density_error,
+                        s.centre_of_mass.x, s.centre_of_mass.y,
+                        s.active, s.cost_us);
+            }
+            todo.clear();
+            fflush(fp);
+
+            if (last) {
+                return;
+            }
+        }
+    }
+
+    FILE *fp;
+    std::thread thread;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::vector<SphStatsSample> queue;
+    bool quit {};
+};
+
+static std::unique_ptr<SphStatsWriter> writer;
+static std::vector<SphStatsPartial> partials;
+
+static uint64_t samples;
+static uint64_t steps_since_enabled;
+static double cost_us_total;
+
+//
+// Steps taken since the last sample, and their dt.
+//
+static int interval_steps;
+static double interval_dt;
+static float interval_dt_min;
+static float interval_dt_max;
+
+static void sph_stats_report (void)
+{
+    if (!samples) {
+        return;
+    }
+
+    CON("stats: %" PRIu64 " samples over %" PRIu64 " steps, "
+        "%.2f us/sample, %.3f us/step amortised",
+        samples, steps_since_enabled,
+        cost_us_total / samples, cost_us_total / steps_since_enabled);
+}
+
+void sph_stats_set_every (int every)
+{
+    every = std::max(every, 0);
+
+    if (!every) {
+        sph_stats_report();
+        writer.reset();
+        sph_stats_every = 0;
+        return;
+    }
+
+    if (!writer) {
+        auto fp = fopen(sph_stats_file.c_str(), "w");
+        if (!fp) {
+            ERR("Failed to open stats file \"%s\" for writing: %s",
+                sph_stats_file.c_str(), strerror(errno));
+            sph_stats_every = 0;
+            return;
+        }
+
+        writer = std::make_unique<SphStatsWriter>(fp);
+        samples = 0;
+        steps_since_enabled = 0;
+        cost_us_total = 0;
+        interval_steps = 0;
+    }
+
+    sph_stats_every = every;
+}
+
+void sph_stats_sample (uint64_t step, double sim_time, float dt)
+{
+    steps_since_enabled++;
+
+    if (!interval_steps) {
+        interval_dt = 0;
+        interval_dt_min = dt;
+        interval_dt_max = dt;
+    }
+    interval_steps++;
+    interval_dt += dt;
+    interval_dt_min = std::min(interval_dt_min, dt);
+    interval_dt_max = std::max(interval_dt_max, dt);
+
+    if (step % sph_stats_every) {
+        return;
+    }
+
+    auto t = std::chrono::steady_clock::now();
+    auto pool = thread_pool();
+
+    partials.resize(pool->size());
+
+    pool->parallel_for(PARTICLE_MAX, [](int begin, int end, int chunk) {
+        SphStatsPartial s {};
+
+        for (auto i = begin; i < end; i++) {
+            auto p = getptr(game->particles, i);
+            if (!p->in_use) {
+                continue;
+            }
+
+            float v2 = p->velocity.x * p->velocity.x +
+                       p->velocity.y * p->velocity.y;
+            float err = fabs(p->density - REST_DENSITY) / REST_DENSITY;
+
+            s.count++;
+            s.mass += p->mass;
+            s.kinetic += 0.5 * p->mass * v2;
+            s.potential += p->mass * GRAVITY * (GL_HEIGHT - p->at.y);
+            s.max_v2 = std::max(s.max_v2, v2);
+            s.density_error += err;
+            s.max_density_error = std::max(s.max_density_error, err);
+            s.mx += p->mass * p->at.x;
+            s.my += p->mass * p->at.y;
+        }
+
+        partials[chunk] = s;
+    });
+
+    //
+    // Combine in chunk order so the result does not depend on timing.
+    //
+    SphStatsPartial all {};
+    for (const auto &s : partials) {
+        all.count += s.count;
+        all.mass += s.mass;
+        all.kinetic += s.kinetic;
+        all.potential += s.potential;
+        all.max_v2 = std::max(all.max_v2, s.max_v2);
+        all.density_error += s.density_error;
+        all.max_density_error = std::max(all.max_density_error,
+                                         s.max_density_error);
+        all.mx += s.mx;
+        all.my += s.my;
+    }
+
+    SphStatsSample out {};
+    out.step = step;
+    out.time = sim_time;
+    out.dt_mean = interval_dt / interval_steps;
+    out.dt_min = interval_dt_min;
+    out.dt_max = interval_dt_max;
+    interval_steps = 0;
+    out.particles = all.count;
+    out.kinetic = all.kinetic;
+    out.potential = all.potential;
+    out.max_velocity = sqrt(all.max_v2);
+    out.max_density_error = all.max_density_error;
+    out.active = sph_sleep_active;
+    if (all.count) {
+        out.mean_density_error = all.density_error / all.count;
+    }
+    if (all.mass > 0) {
+        out.centre_of_mass = fpoint(all.mx / all.mass, all.my / all.mass);
+    }
+
+    auto d = std::chrono::steady_clock::now() - t;
+    out.cost_us = std::chrono::duration<double, std::micro>(d).count();
+
+    samples++;
+    cost_us_total += out.cost_us;
+
+    writer->push(out);
+}
+
+//
+// User has entered a command, run it
+//
+uint8_t sph_stats_set (tokens_t *tokens, void *context)
+{_
+    char *s = tokens->args[2];
+
+    if (!s || (*s == '\0')) {
+        sph_stats_set_every(10);
+    } else {
+        sph_stats_set_every(strtol(s, 0, 10));
+    }
+
+    if (sph_stats_every) {
+        CON("stats every %d steps to %s", sph_stats_every,
+            sph_stats_file.c_str());
+    } else {
+        CON("stats disabled");
+    }
+
+    return (true);
+}
@@ -152,6 +152,42 @@ static SDL_Surface *load_image (std::string filename)
     return (surf);
 }
 
+//
+// Load an image as one byte per pixel, set wherever it is opaque; or for
+// images with no alpha, wherever it is bright.
+//
+bool tex_load_mask (std::string file, std::vector<uint8_t> &mask,
+                    int32_t *w, int32_t *h)
+{_
+    int32_t comp;
+    unsigned char *image_data;
+
+    image_data = load_raw_image(file, w, h, &comp);
+    if (!image_data) {
+        return (false);
+    }
+
+    mask.resize(*w * *h);
+
+    for (auto i = 0; i < *w * *h; i++) {
+        const unsigned char *px = image_data + i * comp;
+        int v;
+
+        switch (comp) {
+        case 1:  v = px[0]; break;
+        case 2:  v = px[1]; break;
+        case 3:  v = (px[0] + px[1] + px[2]) / 3; break;
+        default: v = px[3]; break;
+        }
+
+        mask[i] = (v >= 128);
+    }
+
+    free_raw_image(image_data);
+
+    return (true);
+}
+
 //
 // Load a texture
 //
@@ -258,7 +294,9 @@ Texp tex_from_surface (SDL_Surface *surface,
     //
     GLuint gl_surface_binding = 0;
 
-    glEnable(GL_TEXTURE_2D); // Apparently needed for ATI drivers
+    if (!gl_core) {
+        glEnable(GL_TEXTURE_2D); // Apparently needed for ATI drivers
+    }
 
     glGenTextures(1, &gl_surface_binding);
 
@@ -0,0 +1,93 @@
+//
+// Copyright goblinhack@gmail.com
+// See the README file for license info.
+//
+
+#include "my_main.h"
+#include "my_thread_pool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool (int size)
+{
+    for (auto chunk = 1; chunk < size; chunk++) {
+        threads.push_back(std::thread(&ThreadPool::worker, this, chunk));
+    }
+}
+
+ThreadPool::~ThreadPool (void)
+{
+    {
+        std::lock_guard<std::mutex> l(lock);
+        quit = true;
+    }
+    wake.notify_all();
+
+    for (auto &t : threads) {
+        t.join();
+    }
+}
+
+void ThreadPool::run_chunk (int chunk)
+{
+    int per = (job_n + size() - 1) / size();
+    int begin = std::min(job_n, chunk * per);
+    int end = std::min(job_n, begin + per);
+
+    (*job)(begin, end, chunk);
+}
+
+void ThreadPool::worker (int chunk)
+{
+    unsigned seen = 0;
+
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> l(lock);
+            wake.wait(l, [&] { return (quit || (generation != seen)); });
+            if (quit) {
+                return;
+            }
+            seen = generation;
+        }
+
+        run_chunk(chunk);
+
+        {
+            std::lock_guard<std::mutex> l(lock);
+            if (!--pending) {
+                done.notify_one();
+            }
+        }
+    }
+}
+
+void ThreadPool::parallel_for (int n, const range_fn &fn)
+{
+    if (threads.empty()) {
+        fn(0, n, 0);
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> l(lock);
+        job = &fn;
+        job_n = n;
+        pending = threads.size();
+        generation++;
+    }
+    wake.notify_all();
+
+    run_chunk(0);
+
+    std::unique_lock<std::mutex> l(lock);
+    done.wait(l, [&] { return (!pending); });
+    job = nullptr;
+}
+
+ThreadPool *thread_pool (void)
+{
+    static ThreadPool pool(std::max(1u, std::thread::hardware_concurrency()));
+
+    return (&pool);
+}
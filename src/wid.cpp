@@ -4629,6 +4629,10 @@ void wid_mouse_down (uint32_t button, int32_t x, int32_t y)
 
     w = wid_mouse_down_handler(x, y);
     if (!w) {
+        //
+        // Nothing on screen here, so let the game have it.
+        //
+        game_mouse_down(x, y, button);
         return;
     }
 
@@ -4678,6 +4682,7 @@ void wid_mouse_up (uint32_t button, int32_t x, int32_t y)
 
     w = wid_mouse_up_handler(x, y);
     if (!w) {
+        game_mouse_up(x, y, button);
         return;
     }
 
@@ -5580,7 +5585,6 @@ void wid_mouse_move (Widp w)
 void wid_display_all (void)
 {_
     blit_fbo_bind(FBO_WID);
-    glClear(GL_COLOR_BUFFER_BIT);
     glcolor(WHITE);
 
     wid_tick_all();
@@ -7,7 +7,12 @@
 
 #include "my_wid.h"
 #include "my_ascii.h"
+#include "my_atlas.h"
 #include "my_string.h"
+#include "my_sph_query.h"
+#include "my_sph_render.h"
+#include "my_sph_solver.h"
+#include "my_sph_stats.h"
 #include <algorithm>
 
 static int32_t wid_console_inited;
@@ -46,6 +51,30 @@ uint8_t wid_console_init (void)
     command_add(config_gfx_vsync_enable, "set vsync [01]", "enable vertical sync enable");
     command_add(config_debug_mode, "set debug [01]", "enable debug mode");
     command_add(config_errored, "clear errored", "used to clear a previous error");
+    command_add(sph_brush_set, "set brush [a-z]*", "mouse brush: push pull vortex drain emit");
+    command_add(sph_dt_set, "set dt [a-z]*", "timestep: adaptive or fixed");
+    command_add(sph_boundary_set, "set boundary [01]", "static wall particles for density at the walls");
+    command_add(sph_adapt_set, "set adapt [01]", "merge particles deep in the fluid, split them near the surface");
+    command_add(sph_sleep_set, "set sleep [01]", "skip resting fluid a cell at a time (wcsph only)");
+    command_add(sph_periodic_set, "set periodic [a-z]*", "wrap axes: x y xy or none");
+    command_add(sph_search_set, "set search [a-z]*", "neighbour search: slots sort permute");
+    command_add(sph_render_set, "set render [a-z]*", "particle drawing: sprites, instanced, parallel or density");
+    command_add(sph_render_density_set, "set density [0-9]* [0-9]*", "draw particles as density from N of them until under M, 0 never");
+    command_add(atlas_set, "set atlas [01]", "draw tiles from the packed atlas");
+    command_add(gl_stream_set, "set glstream [a-z]*", "blit batches: client orphan or persistent");
+    command_add(sph_integrator_set, "set integrator [a-z]*", "integrator for wcsph and pcisph: euler leapfrog verlet");
+    command_add(sph_stats_set, "set stats [0-9]*", "write solver stats to csv every N steps, 0 is off");
+    command_add(sph_bench_query, "bench query", "time spatial queries over the particle grid");
+    command_add(sph_bench_adapt, "bench adapt [0-9]*", "run a deep tank for N ms of simulated time with adaptive resolution off and on");
+    command_add(sph_bench_sleep, "bench sleep [0-9]*", "run the fluid as it is for N ms of simulated time with sleeping off and on");
+    command_add(sph_bench_search, "bench search [0-9]*", "run N ms of simulated time with each neighbour search backend and compare");
+    command_add(sph_bench_render, "bench render [0-9]*", "draw N frames of particles each way and compare");
+    command_add(atlas_bench, "bench atlas", "count the draws in a UI frame with the atlas off and on");
+    command_add(gl_bench_blit, "bench blit [0-9]*", "draw N tiles a frame with each blit stream and compare");
+    command_add(ascii_cache_set, "set uicache [01]", "only redraw the UI cells that change");
+    command_add(ascii_bench, "bench ui [0-9]*", "draw N UI frames with the UI cache off and on and compare");
+    command_add(gl_bench_composite, "bench composite [0-9]*", "composite N frames in three passes and in one and compare");
+    command_add(sph_bench_solvers, "bench solvers [0-9]*", "run each solver for N ms of simulated time and compare");
     command_add(sdl_user_exit, "quit", "exit game");
 
     wid_console_wid_create();